@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+
+#include "bhava_host.h"
+#include "synthetic_images.h"
+
+/*
+ * Loads synthetic kernels and fonts the way efi_main does and reports how many firmware calls each load
+ * takes and how fast the loader gets through the data. The firmware here costs next to nothing, so the
+ * throughput is that of the loader's own code, and the call counts are what to compare against real
+ * hardware, where every call is expensive.
+ */
+
+/** Every configuration moves roughly this much data, so small images get enough iterations to time. */
+#define BENCH_BYTES_PER_CONFIG (256ull << 20)
+
+struct KernelBenchConfig {
+   const char *name;
+   SyntheticKernelSpec spec;
+   UINT64 revision;
+};
+
+struct BenchResult {
+   UINTN iterations;
+   double seconds;
+   HostCallCounts counts;
+   UINTN imageSize;
+   bool failed;
+};
+
+static bool LoadKernel(const std::vector<UINT8> &image, UINT64 revision) {
+   HostFile file;
+   HostOpenFile(image.data(), image.size(), revision, &file);
+   UINTN size        = 0;
+   UINT8 *kernelFile = ReadFileToBuffer(&file.protocol, &size);
+   if (!kernelFile) {
+      return false;
+   }
+   Elf64_Ehdr *header   = ParseELFHeader(kernelFile, size);
+   Elf64_Phdr *segments = header ? ParseELFPHeader(header, kernelFile, size) : nullptr;
+   Elf64_Shdr *sections = header ? ParseELFSHeader(header, kernelFile, size) : nullptr;
+   KernelImageLayout layout {};
+   if (!segments || !sections || !LoadKernelSegments(header, segments, kernelFile, size, &layout)) {
+      return false;
+   }
+   GlobalInitializers initializers =
+      ParseGlobalInitializers(sections, header->e_shnum, kernelFile, size, (UINT8 *)layout.physicalBase,
+                              layout.vaddrBase);
+   return initializers.ctorAddresses != nullptr;
+}
+
+static bool LoadFont(const std::vector<UINT8> &font, UINT64 revision) {
+   HostFile file;
+   HostOpenFile(font.data(), font.size(), revision, &file);
+   UINTN size      = 0;
+   UINT8 *fontFile = ReadFileToBuffer(&file.protocol, &size);
+   if (!fontFile) {
+      return false;
+   }
+   psf2_header *header = ParsePSF2Header(fontFile, size);
+   return header && VerifyPSF2File(*header);
+}
+
+static BenchResult RunBench(const std::vector<UINT8> &image, UINT64 revision, bool isKernel) {
+   BenchResult result {};
+   result.imageSize  = image.size();
+   result.iterations = BENCH_BYTES_PER_CONFIG / image.size() + 1;
+   HostResetCallCounts();
+   auto start = std::chrono::steady_clock::now();
+   for (UINTN i = 0; i < result.iterations && !result.failed; i++) {
+      result.failed = isKernel ? !LoadKernel(image, revision) : !LoadFont(image, revision);
+      HostFreeAllMemory();
+   }
+   result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   result.counts  = HostGetCallCounts();
+   return result;
+}
+
+static void PrintResult(const char *name, const BenchResult &result) {
+   if (result.failed) {
+      printf("%-28s FAILED\n", name);
+      return;
+   }
+   const HostCallCounts &counts = result.counts;
+   double perLoad               = 1.0 / result.iterations;
+   double mebibytes             = (double)result.imageSize * result.iterations / (1 << 20);
+   printf("%-28s %9.1f KiB %8.1f %7.1f %7.1f %7.1f %9.1f %10.1f\n", name, result.imageSize / 1024.0,
+          HostTotalCalls(counts) * perLoad, (counts.fileRead + counts.fileReadEx) * perLoad,
+          (counts.allocatePages + counts.allocatePool) * perLoad,
+          (counts.freePages + counts.freePool) * perLoad, result.seconds * 1e6 * perLoad,
+          mebibytes / result.seconds);
+}
+
+int main() {
+   HostInitialize();
+   const KernelBenchConfig kernels[] = {
+      {"kernel 4x64KiB", {4, 0x10000, 0x4000, 16, 0x400000}, EFI_FILE_PROTOCOL_REVISION},
+      {"kernel 4x64KiB ReadEx", {4, 0x10000, 0x4000, 16, 0x400000}, EFI_FILE_PROTOCOL_REVISION2},
+      {"kernel 8x1MiB", {8, 0x100000, 0x40000, 64, 0x400000}, EFI_FILE_PROTOCOL_REVISION},
+      {"kernel 8x1MiB ReadEx", {8, 0x100000, 0x40000, 64, 0x400000}, EFI_FILE_PROTOCOL_REVISION2},
+      {"kernel 16x4MiB", {16, 0x400000, 0x100000, 256, 0x400000}, EFI_FILE_PROTOCOL_REVISION},
+   };
+
+   printf("%-28s %13s %8s %7s %7s %7s %9s %10s\n", "configuration", "size", "calls", "reads", "allocs",
+          "frees", "us/load", "MiB/s");
+   bool failed = false;
+   for (const KernelBenchConfig &config : kernels) {
+      BenchResult result = RunBench(BuildSyntheticKernel(config.spec), config.revision, true);
+      PrintResult(config.name, result);
+      failed |= result.failed;
+   }
+   BenchResult font = RunBench(BuildSyntheticFont(512, 8, 16), EFI_FILE_PROTOCOL_REVISION, false);
+   PrintResult("font 512 glyphs 8x16", font);
+   BenchResult largeFont = RunBench(BuildSyntheticFont(65536, 32, 64), EFI_FILE_PROTOCOL_REVISION, false);
+   PrintResult("font 65536 glyphs 32x64", largeFont);
+   failed |= font.failed || largeFont.failed;
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
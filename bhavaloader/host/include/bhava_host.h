@@ -0,0 +1,128 @@
+#pragma once
+#include <stdint.h>
+
+#include "efi.h"
+#include "efiprot.h"
+#include "boot/bootinfo.h"
+#include "config/loader_config.h"
+#include "config/manifest_format.h"
+#include "elf/elf_header.h"
+#include "font/psf.h"
+#include "mem/kernel_layout.h"
+
+/*
+ * BhavaLoader's file, ELF, font, configuration, checksum and decompression handling built for a Linux host.
+ * The loader code itself is unchanged, it runs against a mock of the boot services and of EFI_FILE_PROTOCOL
+ * that serves files from memory and counts every call into the "firmware", so regressions in how the loader
+ * talks to the firmware show up without booting anything.
+ */
+
+/** The number of calls made into the mock firmware since the last HostResetCallCounts(). */
+struct HostCallCounts {
+   UINTN allocatePool;
+   UINTN freePool;
+   UINTN allocatePages;
+   UINTN freePages;
+   UINTN createEvent;
+   UINTN closeEvent;
+   UINTN waitForEvent;
+   UINTN fileRead;
+   UINTN fileReadEx;
+   UINTN fileSetPosition;
+   UINTN fileGetInfo;
+   UINTN consoleOutput;
+   /** The number of bytes handed out by Read() and ReadEx(). */
+   UINT64 bytesRead;
+   /** The number of bytes handed out by AllocatePool() and AllocatePages(). */
+   UINT64 bytesAllocated;
+};
+
+/** A file served from memory through EFI_FILE_PROTOCOL. The protocol must stay the first member. */
+struct HostFile {
+   EFI_FILE_PROTOCOL protocol;
+   const UINT8 *data;
+   UINTN size;
+   UINT64 position;
+};
+
+/**
+ * @brief Points ST at the mock firmware and picks the loader's memory primitives for the host CPU. Must be
+ * called before anything else.
+ */
+void HostInitialize();
+
+/**
+ * @brief Sets up a file that reads from memory. The data is not copied and must outlive the file.
+ * @param data: The contents of the file.
+ * @param size: The size of the file, in bytes.
+ * @param revision: EFI_FILE_PROTOCOL_REVISION, or EFI_FILE_PROTOCOL_REVISION2 to offer ReadEx().
+ * @param OUTfile: The file to set up.
+ */
+void HostOpenFile(const void *data, UINTN size, UINT64 revision, HostFile *OUTfile);
+
+/**
+ * @brief Makes the loader split work as if this many processors took part. Everything still runs on the
+ * calling thread, but the code paths that divide work between processors are taken.
+ */
+void HostSetProcessorCount(UINTN count);
+
+HostCallCounts HostGetCallCounts();
+void HostResetCallCounts();
+/** @brief The total number of firmware calls in a set of counts. */
+UINTN HostTotalCalls(const HostCallCounts &counts);
+
+/**
+ * @brief Frees every allocation the mock firmware still holds, including the pages the loader trimmed off
+ * aligned allocations. Any pointer the loader handed out becomes invalid.
+ */
+void HostFreeAllMemory();
+
+/** @brief The number of bytes the loader has allocated and not yet freed. */
+UINT64 HostOutstandingBytes();
+
+/**
+ * @brief Searches one cluster of directory entries for a name, the way FatFindEntry() searches every cluster
+ * of a directory.
+ * @param entries: The directory entries.
+ * @param size: The size of the cluster in bytes.
+ * @param component: The name to look for. Not null terminated.
+ * @param componentLength: The length of the name.
+ * @param OUTfirstCluster: Filled with the first cluster of the entry if it is found.
+ * @param OUTintact: Set to false if gathering a long name wrote outside of the name buffer.
+ *
+ * @return True if the entry was found.
+ */
+bool HostFatSearchCluster(const UINT8 *entries, UINTN size, const CHAR16 *component, UINTN componentLength,
+                          UINT32 *OUTfirstCluster, bool *OUTintact);
+
+/*
+ * The loader functions the host library exposes. These match the definitions in bhavaloader/src, which the
+ * library includes as they are.
+ */
+
+UINTN GetFileSize(EFI_FILE_PROTOCOL *fileHandle);
+UINTN GetDataPageSize(UINTN dataSize);
+UINT8 *ReadFileToBuffer(EFI_FILE_PROTOCOL *fileHandle, UINTN *OUTfileSize);
+Elf64_Ehdr *ParseELFHeader(UINT8 *kernelImage, UINTN imageSize);
+Elf64_Phdr *ParseELFPHeader(const Elf64_Ehdr *elfHeader, UINT8 *kernelImage, UINTN imageSize);
+Elf64_Shdr *ParseELFSHeader(const Elf64_Ehdr *elfHeader, UINT8 *kernelImage, UINTN imageSize);
+bool LoadKernelSegments(const Elf64_Ehdr *elfHeader, const Elf64_Phdr *programHeaders, UINT8 *kernelImage,
+                        UINTN imageSize, KernelImageLayout *OUTlayout);
+GlobalInitializers ParseGlobalInitializers(Elf64_Shdr *headerArray, int headerCount, UINT8 *kernelImage,
+                                           UINTN imageSize, UINT8 *kernelData, Elf64_Addr vaddr);
+psf2_header *ParsePSF2Header(UINT8 *fontImage, UINTN imageSize);
+bool VerifyPSF2File(psf2_header header);
+void GetDefaultLoaderConfig(LoaderConfig *OUTconfig);
+UINTN ParseLoaderConfig(const char *text, UINTN size, LoaderConfig *config);
+bool ParseChecksumManifest(const UINT8 *data, UINTN size, ChecksumManifest *OUTmanifest);
+const ManifestEntry *FindManifestEntry(const ChecksumManifest *manifest, const CHAR16 *path, UINT32 segment);
+extern bool cpuHasSse42;
+void BuildCrc32cTable();
+UINT32 Crc32cHardware(UINT32 crc, const UINT8 *data, UINTN size);
+UINT32 Crc32cSoftware(UINT32 crc, const UINT8 *data, UINTN size);
+UINT32 Crc32c(const void *data, UINTN size);
+bool IsLz4Frame(const UINT8 *data, UINTN size);
+bool Lz4DecompressFrame(const UINT8 *src, UINTN srcSize, UINT8 *dst, UINTN dstCapacity,
+                        UINTN *OUTdecompressedSize);
+bool Lz4DecompressFrameParallel(const UINT8 *src, UINTN srcSize, UINT8 *dst, UINTN dstCapacity,
+                                UINTN *OUTdecompressedSize);
@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+
+#include "bhava_host.h"
+
+/** Describes a kernel for BuildSyntheticKernel(). */
+struct SyntheticKernelSpec {
+   /** The number of PT_LOAD segments. */
+   UINTN segmentCount;
+   /** The file size of every segment, in bytes. */
+   UINTN segmentSize;
+   /** The bytes of .bss after the file contents of the last segment. */
+   UINTN bssSize;
+   /** The number of entries in .init_array. */
+   UINTN ctorCount;
+   /** The virtual address of the first segment. */
+   Elf64_Addr baseAddress;
+};
+
+/**
+ * @brief Builds a 64 bit ELF executable laid out the way the linker lays out LanternOS: the headers, then
+ * every segment at its own page aligned offset and address, then .init_array and the section headers.
+ * Segment contents are a pattern that depends on the segment index and offset, see SyntheticSegmentByte().
+ */
+std::vector<UINT8> BuildSyntheticKernel(const SyntheticKernelSpec &spec);
+
+/** @brief The byte at an offset into the file contents of a segment built by BuildSyntheticKernel(). */
+UINT8 SyntheticSegmentByte(UINTN segment, UINTN offset);
+
+/** @brief The virtual address of a segment built by BuildSyntheticKernel(). */
+Elf64_Addr SyntheticSegmentAddress(const SyntheticKernelSpec &spec, UINTN segment);
+
+/** @brief The address stored in an .init_array entry built by BuildSyntheticKernel(). */
+Elf64_Addr SyntheticCtorAddress(const SyntheticKernelSpec &spec, UINTN ctor);
+
+/** @brief Builds a PSF2 font with the given glyph geometry and a pattern for the glyph bitmaps. */
+std::vector<UINT8> BuildSyntheticFont(UINT32 glyphCount, UINT32 width, UINT32 height);
+
+/**
+ * @brief Compresses data into an LZ4 frame that records its content size, the way build.py stores the kernel.
+ * Runs that do not compress are stored as uncompressed blocks, as the reference compressor does.
+ * @param data: The data to compress.
+ * @param blockMaxSizeId: The block maximum size as the frame descriptor encodes it, 4 (64 KiB) to 7 (4 MiB).
+ * @param independentBlocks: Set to keep every match within its own block, so blocks can be decoded on their
+ * own.
+ * @param flushOffset: If not 0, the block holding this offset of data ends there, short of the maximum block
+ * size, as it does when an encoder is flushed. The blocks after it start from there.
+ */
+std::vector<UINT8> BuildLz4Frame(const std::vector<UINT8> &data, UINT8 blockMaxSizeId, bool independentBlocks,
+                                 UINTN flushOffset = 0);
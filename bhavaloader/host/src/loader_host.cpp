@@ -0,0 +1,53 @@
+#include "bhava_host.h"
+
+/*
+ * The loader sources, built for the host. Like main.cpp, this is the one translation unit that includes
+ * them, and ST has to be declared before any of them.
+ */
+
+EFI_SYSTEM_TABLE *ST;
+
+#include "config/config.h"
+#include "config/manifest.h"
+#include "elf/elf_parse.h"
+#include "font/psf_parse.h"
+#include "fs/fat.h"
+#include "fs/file_read.h"
+#include "mem/pages.h"
+#include "util/crc32c.h"
+#include "util/lz4.h"
+#include "util/memcpy.h"
+
+void HostInitializeFirmware();
+
+void HostInitialize() {
+   HostInitializeFirmware();
+   InitMemoryPrimitives();
+   InitCrc32c();
+}
+
+void HostSetProcessorCount(UINTN count) {
+   // Without the protocol itself ParallelFor() still runs everything on this thread.
+   mpState = {nullptr, count};
+}
+
+bool HostFatSearchCluster(const UINT8 *entries, UINTN size, const CHAR16 *component, UINTN componentLength,
+                          UINT32 *OUTfirstCluster, bool *OUTintact) {
+   // FatFindEntry() gathers long names on its stack. Guard words on either side catch writes past the name.
+   struct {
+      UINT64 guardBefore[4];
+      FatLongName longName;
+      UINT64 guardAfter[4];
+   } frame;
+   memset(&frame, 0xA5, sizeof(frame));
+   frame.longName.valid = false;
+   FatDirEntry entry {};
+   bool end   = false;
+   bool found = FatSearchEntries(entries, size, component, componentLength, &frame.longName, &entry, &end);
+   *OUTfirstCluster = entry.firstCluster;
+   *OUTintact       = true;
+   for (UINTN i = 0; i < 4; i++) {
+      *OUTintact &= frame.guardBefore[i] == 0xA5A5A5A5A5A5A5A5 && frame.guardAfter[i] == 0xA5A5A5A5A5A5A5A5;
+   }
+   return found;
+}
@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+
+#include "bhava_host.h"
+
+/*
+ * Just enough of a UEFI firmware for the loader's file and image handling. Memory comes from the host heap,
+ * files are served from memory, and every call is counted.
+ */
+
+extern EFI_SYSTEM_TABLE *ST;
+
+static HostCallCounts callCounts;
+/** The page count of every block handed out by AllocatePages(), by address. */
+static std::map<UINT64, UINTN> pageAllocations;
+static std::map<void *, UINTN> poolAllocations;
+static UINT64 outstandingBytes;
+
+static EFI_BOOT_SERVICES hostBootServices;
+static SIMPLE_TEXT_OUTPUT_INTERFACE hostConsole;
+static EFI_SYSTEM_TABLE hostSystemTable;
+
+static EFI_STATUS EFIAPI HostAllocatePool(EFI_MEMORY_TYPE, UINTN size, VOID **buffer) {
+   callCounts.allocatePool++;
+   *buffer = malloc(size == 0 ? 1 : size);
+   if (!*buffer) {
+      return EFI_OUT_OF_RESOURCES;
+   }
+   poolAllocations[*buffer]   = size;
+   callCounts.bytesAllocated += size;
+   outstandingBytes          += size;
+   return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI HostFreePool(VOID *buffer) {
+   callCounts.freePool++;
+   auto allocation = poolAllocations.find(buffer);
+   if (allocation == poolAllocations.end()) {
+      return EFI_INVALID_PARAMETER;
+   }
+   outstandingBytes -= allocation->second;
+   poolAllocations.erase(allocation);
+   free(buffer);
+   return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI HostAllocatePages(EFI_ALLOCATE_TYPE type, EFI_MEMORY_TYPE, UINTN pageCount,
+                                           EFI_PHYSICAL_ADDRESS *memory) {
+   callCounts.allocatePages++;
+   if (type != AllocateAnyPages || pageCount == 0) {
+      return EFI_UNSUPPORTED;
+   }
+   void *pages = aligned_alloc(EFI_PAGE_SIZE, pageCount * EFI_PAGE_SIZE);
+   if (!pages) {
+      return EFI_OUT_OF_RESOURCES;
+   }
+   *memory                        = (EFI_PHYSICAL_ADDRESS)pages;
+   pageAllocations[(UINT64)pages] = pageCount;
+   callCounts.bytesAllocated     += pageCount * EFI_PAGE_SIZE;
+   outstandingBytes              += pageCount * EFI_PAGE_SIZE;
+   return EFI_SUCCESS;
+}
+
+/**
+ * Real firmware can free any page of an allocation on its own, as the loader does when it trims aligned
+ * allocations. The host heap can not, so a partial free is only accounted for, and the block itself stays
+ * until HostFreeAllMemory().
+ */
+static EFI_STATUS EFIAPI HostFreePages(EFI_PHYSICAL_ADDRESS memory, UINTN pageCount) {
+   callCounts.freePages++;
+   auto allocation = pageAllocations.upper_bound(memory);
+   if (allocation == pageAllocations.begin()) {
+      return EFI_NOT_FOUND;
+   }
+   allocation--;
+   UINT64 blockEnd = allocation->first + allocation->second * EFI_PAGE_SIZE;
+   if (memory + pageCount * EFI_PAGE_SIZE > blockEnd) {
+      return EFI_NOT_FOUND;
+   }
+   outstandingBytes -= pageCount * EFI_PAGE_SIZE;
+   if (memory == allocation->first && pageCount == allocation->second) {
+      free((void *)allocation->first);
+      pageAllocations.erase(allocation);
+   }
+   return EFI_SUCCESS;
+}
+
+/** Events are never signalled by anything but the mock itself, so a non-null placeholder is all they need. */
+static EFI_STATUS EFIAPI HostCreateEvent(UINT32, EFI_TPL, EFI_EVENT_NOTIFY, VOID *, EFI_EVENT *event) {
+   callCounts.createEvent++;
+   *event = (EFI_EVENT)&hostBootServices;
+   return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI HostCloseEvent(EFI_EVENT) {
+   callCounts.closeEvent++;
+   return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI HostWaitForEvent(UINTN, EFI_EVENT *, UINTN *index) {
+   callCounts.waitForEvent++;
+   *index = 0;
+   return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI HostLocateProtocol(EFI_GUID *, VOID *, VOID **interface) {
+   *interface = nullptr;
+   return EFI_NOT_FOUND;
+}
+
+static EFI_STATUS EFIAPI HostStall(UINTN) {
+   return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI HostOutputString(SIMPLE_TEXT_OUTPUT_INTERFACE *, CHAR16 *) {
+   callCounts.consoleOutput++;
+   return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI HostFileRead(EFI_FILE_PROTOCOL *protocol, UINTN *bufferSize, VOID *buffer) {
+   callCounts.fileRead++;
+   HostFile *file = (HostFile *)protocol;
+   UINTN left     = file->position < file->size ? file->size - file->position : 0;
+   UINTN count    = *bufferSize < left ? *bufferSize : left;
+   memcpy(buffer, file->data + file->position, count);
+   file->position       += count;
+   *bufferSize           = count;
+   callCounts.bytesRead += count;
+   return EFI_SUCCESS;
+}
+
+/** Completes the read before returning, which the specification allows. */
+static EFI_STATUS EFIAPI HostFileReadEx(EFI_FILE_PROTOCOL *protocol, EFI_FILE_IO_TOKEN *token) {
+   callCounts.fileReadEx++;
+   HostFile *file = (HostFile *)protocol;
+   UINTN left     = file->position < file->size ? file->size - file->position : 0;
+   UINTN count    = token->BufferSize < left ? token->BufferSize : left;
+   memcpy(token->Buffer, file->data + file->position, count);
+   file->position       += count;
+   token->BufferSize     = count;
+   token->Status         = EFI_SUCCESS;
+   callCounts.bytesRead += count;
+   return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI HostFileSetPosition(EFI_FILE_PROTOCOL *protocol, UINT64 position) {
+   callCounts.fileSetPosition++;
+   ((HostFile *)protocol)->position = position;
+   return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI HostFileGetInfo(EFI_FILE_PROTOCOL *protocol, EFI_GUID *, UINTN *bufferSize,
+                                         VOID *buffer) {
+   callCounts.fileGetInfo++;
+   UINTN infoSize = SIZE_OF_EFI_FILE_INFO + sizeof(CHAR16);
+   if (*bufferSize < infoSize) {
+      *bufferSize = infoSize;
+      return EFI_BUFFER_TOO_SMALL;
+   }
+   EFI_FILE_INFO *info = (EFI_FILE_INFO *)buffer;
+   memset(info, 0, infoSize);
+   info->Size         = infoSize;
+   info->FileSize     = ((HostFile *)protocol)->size;
+   info->PhysicalSize = info->FileSize;
+   return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI HostFileClose(EFI_FILE_PROTOCOL *) {
+   return EFI_SUCCESS;
+}
+
+void HostOpenFile(const void *data, UINTN size, UINT64 revision, HostFile *OUTfile) {
+   *OUTfile                      = {};
+   OUTfile->protocol.Revision    = revision;
+   OUTfile->protocol.Close       = HostFileClose;
+   OUTfile->protocol.Read        = HostFileRead;
+   OUTfile->protocol.SetPosition = HostFileSetPosition;
+   OUTfile->protocol.GetInfo     = HostFileGetInfo;
+   if (revision >= EFI_FILE_PROTOCOL_REVISION2) {
+      OUTfile->protocol.ReadEx = HostFileReadEx;
+   }
+   OUTfile->data = (const UINT8 *)data;
+   OUTfile->size = size;
+}
+
+void HostInitializeFirmware() {
+   hostBootServices.AllocatePool   = HostAllocatePool;
+   hostBootServices.FreePool       = HostFreePool;
+   hostBootServices.AllocatePages  = HostAllocatePages;
+   hostBootServices.FreePages      = HostFreePages;
+   hostBootServices.CreateEvent    = HostCreateEvent;
+   hostBootServices.CloseEvent     = HostCloseEvent;
+   hostBootServices.WaitForEvent   = HostWaitForEvent;
+   hostBootServices.LocateProtocol = HostLocateProtocol;
+   hostBootServices.Stall          = HostStall;
+   hostConsole.OutputString        = HostOutputString;
+   hostSystemTable.BootServices    = &hostBootServices;
+   hostSystemTable.ConOut          = &hostConsole;
+   ST                              = &hostSystemTable;
+}
+
+HostCallCounts HostGetCallCounts() {
+   return callCounts;
+}
+
+void HostResetCallCounts() {
+   callCounts = {};
+}
+
+UINTN HostTotalCalls(const HostCallCounts &counts) {
+   return counts.allocatePool + counts.freePool + counts.allocatePages + counts.freePages +
+          counts.createEvent + counts.closeEvent + counts.waitForEvent + counts.fileRead + counts.fileReadEx +
+          counts.fileSetPosition + counts.fileGetInfo + counts.consoleOutput;
+}
+
+void HostFreeAllMemory() {
+   for (auto &allocation : pageAllocations) { free((void *)allocation.first); }
+   for (auto &allocation : poolAllocations) { free(allocation.first); }
+   pageAllocations.clear();
+   poolAllocations.clear();
+   outstandingBytes = 0;
+}
+
+UINT64 HostOutstandingBytes() {
+   return outstandingBytes;
+}
@@ -0,0 +1,188 @@
+#include <string.h>
+
+#include "synthetic_images.h"
+
+#define SYNTHETIC_PAGE_SIZE 0x1000
+
+static UINTN AlignUp(UINTN value, UINTN alignment) {
+   return (value + alignment - 1) & ~(alignment - 1);
+}
+
+UINT8 SyntheticSegmentByte(UINTN segment, UINTN offset) {
+   return (UINT8)(segment * 31 + offset * 7 + (offset >> 12));
+}
+
+Elf64_Addr SyntheticSegmentAddress(const SyntheticKernelSpec &spec, UINTN segment) {
+   return spec.baseAddress + segment * AlignUp(spec.segmentSize, SYNTHETIC_PAGE_SIZE);
+}
+
+Elf64_Addr SyntheticCtorAddress(const SyntheticKernelSpec &spec, UINTN ctor) {
+   return spec.baseAddress + 0x10 * (ctor + 1);
+}
+
+std::vector<UINT8> BuildSyntheticKernel(const SyntheticKernelSpec &spec) {
+   // A null section header, then .init_array.
+   UINTN sectionCount    = 2;
+   UINTN headersSize     = sizeof(Elf64_Ehdr) + spec.segmentCount * sizeof(Elf64_Phdr);
+   UINTN segmentsOffset  = AlignUp(headersSize, SYNTHETIC_PAGE_SIZE);
+   UINTN segmentStride   = AlignUp(spec.segmentSize, SYNTHETIC_PAGE_SIZE);
+   UINTN initArrayOffset = segmentsOffset + spec.segmentCount * segmentStride;
+   UINTN initArraySize   = spec.ctorCount * sizeof(UINT64);
+   UINTN sectionsOffset  = AlignUp(initArrayOffset + initArraySize, 8);
+   std::vector<UINT8> image(sectionsOffset + sectionCount * sizeof(Elf64_Shdr));
+
+   Elf64_Ehdr header {};
+   const UINT8 ident[] = {0x7F, 'E', 'L', 'F', 2, 1, 1};
+   memcpy(header.e_ident, ident, sizeof(ident));
+   header.e_type      = ET_EXEC;
+   header.e_machine   = 62;
+   header.e_version   = 1;
+   header.e_entry     = spec.baseAddress;
+   header.e_phoff     = sizeof(Elf64_Ehdr);
+   header.e_shoff     = sectionsOffset;
+   header.e_ehsize    = sizeof(Elf64_Ehdr);
+   header.e_phentsize = sizeof(Elf64_Phdr);
+   header.e_phnum     = spec.segmentCount;
+   header.e_shentsize = sizeof(Elf64_Shdr);
+   header.e_shnum     = sectionCount;
+   memcpy(image.data(), &header, sizeof(header));
+
+   for (UINTN i = 0; i < spec.segmentCount; i++) {
+      Elf64_Phdr segment {};
+      segment.p_type   = PT_LOAD;
+      segment.p_flags  = 6;
+      segment.p_offset = segmentsOffset + i * segmentStride;
+      segment.p_vaddr  = SyntheticSegmentAddress(spec, i);
+      segment.p_paddr  = segment.p_vaddr;
+      segment.p_filesz = spec.segmentSize;
+      segment.p_memsz  = spec.segmentSize + (i == spec.segmentCount - 1 ? spec.bssSize : 0);
+      segment.p_align  = SYNTHETIC_PAGE_SIZE;
+      memcpy(image.data() + sizeof(Elf64_Ehdr) + i * sizeof(Elf64_Phdr), &segment, sizeof(segment));
+      for (UINTN offset = 0; offset < spec.segmentSize; offset++) {
+         image[segment.p_offset + offset] = SyntheticSegmentByte(i, offset);
+      }
+   }
+
+   for (UINTN i = 0; i < spec.ctorCount; i++) {
+      UINT64 address = SyntheticCtorAddress(spec, i);
+      memcpy(image.data() + initArrayOffset + i * sizeof(UINT64), &address, sizeof(address));
+   }
+   Elf64_Shdr initArray {};
+   initArray.sh_type      = SHT_INIT_ARRAY;
+   initArray.sh_offset    = initArrayOffset;
+   initArray.sh_size      = initArraySize;
+   initArray.sh_addralign = 8;
+   initArray.sh_entsize   = sizeof(UINT64);
+   memcpy(image.data() + sectionsOffset + sizeof(Elf64_Shdr), &initArray, sizeof(initArray));
+   return image;
+}
+
+std::vector<UINT8> BuildSyntheticFont(UINT32 glyphCount, UINT32 width, UINT32 height) {
+   UINT32 glyphSize = (width + 7) / 8 * height;
+   std::vector<UINT8> font(sizeof(psf2_header) + (UINTN)glyphCount * glyphSize);
+
+   psf2_header header {};
+   const UINT8 magic[] = {0x72, 0xb5, 0x4a, 0x86};
+   memcpy(header.magic, magic, sizeof(magic));
+   header.headerSize = sizeof(psf2_header);
+   header.length     = glyphCount;
+   header.charSize   = glyphSize;
+   header.height     = height;
+   header.width      = width;
+   memcpy(font.data(), &header, sizeof(header));
+   for (UINTN i = sizeof(psf2_header); i < font.size(); i++) { font[i] = (UINT8)(i * 13); }
+   return font;
+}
+
+static void AppendLE32(std::vector<UINT8> &out, UINT32 value) {
+   for (UINTN i = 0; i < 4; i++) { out.push_back((UINT8)(value >> (8 * i))); }
+}
+
+static void AppendLz4Length(std::vector<UINT8> &out, UINTN length) {
+   for (; length >= 255; length -= 255) { out.push_back(255); }
+   out.push_back((UINT8)length);
+}
+
+/** Appends one sequence to a block. A matchLength of 0 makes it the literals-only sequence ending a block. */
+static void AppendLz4Sequence(std::vector<UINT8> &out, const UINT8 *literals, UINTN literalLength,
+                              UINTN offset, UINTN matchLength) {
+   UINTN matchCode = matchLength == 0 ? 0 : matchLength - 4;
+   UINTN literalCode = literalLength < 15 ? literalLength : 15;
+   out.push_back((UINT8)((literalCode << 4) | (matchCode < 15 ? matchCode : 15)));
+   if (literalLength >= 15) {
+      AppendLz4Length(out, literalLength - 15);
+   }
+   out.insert(out.end(), literals, literals + literalLength);
+   if (matchLength == 0) {
+      return;
+   }
+   out.push_back((UINT8)offset);
+   out.push_back((UINT8)(offset >> 8));
+   if (matchCode >= 15) {
+      AppendLz4Length(out, matchCode - 15);
+   }
+}
+
+std::vector<UINT8> BuildLz4Frame(const std::vector<UINT8> &data, UINT8 blockMaxSizeId, bool independentBlocks,
+                                 UINTN flushOffset) {
+   std::vector<UINT8> frame;
+   AppendLE32(frame, 0x184D2204);
+   // Version 1 and a content size. The header checksum is left 0, the loader does not check it.
+   frame.push_back(0x40 | (independentBlocks ? 0x20 : 0) | 0x08);
+   frame.push_back((UINT8)(blockMaxSizeId << 4));
+   AppendLE32(frame, (UINT32)data.size());
+   AppendLE32(frame, (UINT32)((UINT64)data.size() >> 32));
+   frame.push_back(0);
+
+   // A greedy compressor: look up the last position whose next 4 bytes hashed the same, and take the match
+   // if it is real. The format wants the last 5 bytes of a block as literals, and no match to start in the
+   // last 12.
+   const UINTN noPosition = ~(UINTN)0;
+   std::vector<UINTN> lastPosition(1 << 16, noPosition);
+   UINTN blockMaxSize = (UINTN)1 << (2 * blockMaxSizeId + 8);
+   UINTN blockEnd     = 0;
+   for (UINTN blockStart = 0; blockStart < data.size(); blockStart = blockEnd) {
+      blockEnd           = blockStart + blockMaxSize < data.size() ? blockStart + blockMaxSize : data.size();
+      blockEnd           = flushOffset > blockStart && flushOffset < blockEnd ? flushOffset : blockEnd;
+      UINTN windowStart  = independentBlocks ? blockStart : 0;
+      UINTN literalStart = blockStart;
+      UINTN position     = blockStart;
+      std::vector<UINT8> block;
+      while (position + 12 <= blockEnd) {
+         UINT32 sequence;
+         memcpy(&sequence, &data[position], 4);
+         UINT32 hash              = (sequence * 2654435761u) >> 16;
+         UINTN candidate          = lastPosition[hash];
+         lastPosition[hash]       = position;
+         UINT32 candidateSequence = 0;
+         if (candidate != noPosition) {
+            memcpy(&candidateSequence, &data[candidate], 4);
+         }
+         if (candidate == noPosition || candidate < windowStart || position - candidate > 0xFFFF ||
+             candidateSequence != sequence) {
+            position++;
+            continue;
+         }
+         UINTN matchLength = 4;
+         while (position + matchLength + 5 < blockEnd &&
+                data[candidate + matchLength] == data[position + matchLength]) {
+            matchLength++;
+         }
+         AppendLz4Sequence(block, &data[literalStart], position - literalStart, position - candidate,
+                           matchLength);
+         position     += matchLength;
+         literalStart  = position;
+      }
+      AppendLz4Sequence(block, &data[literalStart], blockEnd - literalStart, 0, 0);
+
+      if (block.size() >= blockEnd - blockStart) {
+         AppendLE32(frame, (UINT32)(blockEnd - blockStart) | 0x80000000);
+         frame.insert(frame.end(), data.begin() + blockStart, data.begin() + blockEnd);
+      } else {
+         AppendLE32(frame, (UINT32)block.size());
+         frame.insert(frame.end(), block.begin(), block.end());
+      }
+   }
+   AppendLE32(frame, 0);
+   return frame;
+}
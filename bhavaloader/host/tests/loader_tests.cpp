@@ -0,0 +1,534 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include "bhava_host.h"
+#include "synthetic_images.h"
+
+/*
+ * Tests for the loader's file, ELF, font, configuration, checksum, decompression and FAT handling, run
+ * against the mock firmware. Each test starts with fresh call counts and leaves no memory behind.
+ */
+
+static int failedChecks = 0;
+
+#define EXPECT(condition)                                                             \
+   do {                                                                               \
+      if (!(condition)) {                                                             \
+         printf("    %s:%d: expected %s\n", __FILE__, __LINE__, #condition);          \
+         failedChecks++;                                                              \
+      }                                                                               \
+   } while (0)
+
+static const SyntheticKernelSpec testKernel = {3, 0x2345, 0x1800, 4, 0x400000};
+
+static void TestGetFileSize() {
+   std::vector<UINT8> data(12345);
+   HostFile file;
+   HostOpenFile(data.data(), data.size(), EFI_FILE_PROTOCOL_REVISION, &file);
+   EXPECT(GetFileSize(&file.protocol) == 12345);
+   HostCallCounts counts = HostGetCallCounts();
+   // One call to learn the size of the information, one to get it.
+   EXPECT(counts.fileGetInfo == 2);
+   EXPECT(counts.allocatePool == counts.freePool);
+   EXPECT(HostOutstandingBytes() == 0);
+}
+
+static void TestReadFileSynchronously() {
+   std::vector<UINT8> data = BuildSyntheticKernel(testKernel);
+   HostFile file;
+   HostOpenFile(data.data(), data.size(), EFI_FILE_PROTOCOL_REVISION, &file);
+   UINTN size    = 0;
+   UINT8 *buffer = ReadFileToBuffer(&file.protocol, &size);
+   EXPECT(buffer != nullptr);
+   EXPECT(size == data.size());
+   EXPECT(buffer && memcmp(buffer, data.data(), data.size()) == 0);
+   EXPECT(((UINT64)buffer & (EFI_PAGE_SIZE - 1)) == 0);
+   HostCallCounts counts = HostGetCallCounts();
+   // The whole file comes in with a single read.
+   EXPECT(counts.fileRead == 1);
+   EXPECT(counts.fileReadEx == 0);
+   EXPECT(counts.bytesRead == data.size());
+   EXPECT(counts.allocatePages == 1);
+}
+
+static void TestReadFileAsynchronously() {
+   std::vector<UINT8> data = BuildSyntheticKernel(testKernel);
+   HostFile file;
+   HostOpenFile(data.data(), data.size(), EFI_FILE_PROTOCOL_REVISION2, &file);
+   UINTN size    = 0;
+   UINT8 *buffer = ReadFileToBuffer(&file.protocol, &size);
+   EXPECT(buffer && size == data.size() && memcmp(buffer, data.data(), data.size()) == 0);
+   HostCallCounts counts = HostGetCallCounts();
+   EXPECT(counts.fileReadEx == 1);
+   EXPECT(counts.fileRead == 0);
+   EXPECT(counts.createEvent == 1 && counts.waitForEvent == 1 && counts.closeEvent == 1);
+}
+
+static void TestReadEmptyFile() {
+   HostFile file;
+   HostOpenFile(nullptr, 0, EFI_FILE_PROTOCOL_REVISION, &file);
+   UINTN size = 0;
+   EXPECT(ReadFileToBuffer(&file.protocol, &size) == nullptr);
+   EXPECT(HostGetCallCounts().fileRead == 0);
+}
+
+static void TestParseELFHeader() {
+   std::vector<UINT8> image = BuildSyntheticKernel(testKernel);
+   Elf64_Ehdr *header       = ParseELFHeader(image.data(), image.size());
+   EXPECT(header == (Elf64_Ehdr *)image.data());
+   EXPECT(ParseELFHeader(image.data(), sizeof(Elf64_Ehdr) - 1) == nullptr);
+
+   std::vector<UINT8> badMagic = image;
+   badMagic[1]                 = 'X';
+   EXPECT(ParseELFHeader(badMagic.data(), badMagic.size()) == nullptr);
+   std::vector<UINT8> elf32 = image;
+   elf32[4]                 = 1;
+   EXPECT(ParseELFHeader(elf32.data(), elf32.size()) == nullptr);
+}
+
+static void TestParseELFHeaders() {
+   std::vector<UINT8> image = BuildSyntheticKernel(testKernel);
+   Elf64_Ehdr *header       = ParseELFHeader(image.data(), image.size());
+   Elf64_Phdr *segments     = ParseELFPHeader(header, image.data(), image.size());
+   Elf64_Shdr *sections     = ParseELFSHeader(header, image.data(), image.size());
+   EXPECT(segments == (Elf64_Phdr *)(image.data() + sizeof(Elf64_Ehdr)));
+   EXPECT(sections != nullptr && sections[1].sh_type == SHT_INIT_ARRAY);
+
+   header->e_phnum = 0xFFFF;
+   EXPECT(ParseELFPHeader(header, image.data(), image.size()) == nullptr);
+   header->e_shoff = image.size();
+   EXPECT(ParseELFSHeader(header, image.data(), image.size()) == nullptr);
+   header->e_shoff = 0;
+   EXPECT(ParseELFSHeader(header, image.data(), image.size()) == nullptr);
+}
+
+static void TestLoadKernelSegments() {
+   std::vector<UINT8> image = BuildSyntheticKernel(testKernel);
+   Elf64_Ehdr *header       = ParseELFHeader(image.data(), image.size());
+   Elf64_Phdr *segments     = ParseELFPHeader(header, image.data(), image.size());
+   KernelImageLayout layout {};
+   EXPECT(LoadKernelSegments(header, segments, image.data(), image.size(), &layout));
+   EXPECT(layout.physicalBase % 0x200000 == 0);
+   EXPECT(layout.vaddrBase == 0x400000);
+   EXPECT(layout.size == 0x200000);
+
+   bool contentsMatch = true;
+   for (UINTN i = 0; i < testKernel.segmentCount; i++) {
+      const UINT8 *loaded =
+         (const UINT8 *)(layout.physicalBase + SyntheticSegmentAddress(testKernel, i) - layout.vaddrBase);
+      for (UINTN offset = 0; offset < testKernel.segmentSize; offset++) {
+         contentsMatch &= loaded[offset] == SyntheticSegmentByte(i, offset);
+      }
+   }
+   EXPECT(contentsMatch);
+   const UINT8 *bss = (const UINT8 *)(layout.physicalBase + SyntheticSegmentAddress(testKernel, 2) -
+                                      layout.vaddrBase + testKernel.segmentSize);
+   bool bssZeroed   = true;
+   for (UINTN offset = 0; offset < testKernel.bssSize; offset++) { bssZeroed &= bss[offset] == 0; }
+   EXPECT(bssZeroed);
+
+   segments[1].p_filesz = image.size();
+   EXPECT(!LoadKernelSegments(header, segments, image.data(), image.size(), &layout));
+}
+
+static void TestParseGlobalInitializers() {
+   std::vector<UINT8> image = BuildSyntheticKernel(testKernel);
+   Elf64_Ehdr *header       = ParseELFHeader(image.data(), image.size());
+   Elf64_Phdr *segments     = ParseELFPHeader(header, image.data(), image.size());
+   Elf64_Shdr *sections     = ParseELFSHeader(header, image.data(), image.size());
+   KernelImageLayout layout {};
+   EXPECT(LoadKernelSegments(header, segments, image.data(), image.size(), &layout));
+   GlobalInitializers initializers = ParseGlobalInitializers(
+      sections, header->e_shnum, image.data(), image.size(), (UINT8 *)layout.physicalBase, layout.vaddrBase);
+   EXPECT(initializers.ctorCount == (int)testKernel.ctorCount);
+   EXPECT(initializers.dtorCount == 0);
+   bool translated = initializers.ctorAddresses != nullptr;
+   for (int i = 0; translated && i < initializers.ctorCount; i++) {
+      translated = initializers.ctorAddresses[i] ==
+                   layout.physicalBase + SyntheticCtorAddress(testKernel, i) - layout.vaddrBase;
+   }
+   EXPECT(translated);
+
+   // .init_array running past the end of the file, and starting past it.
+   sections[1].sh_size = image.size();
+   initializers        = ParseGlobalInitializers(sections, header->e_shnum, image.data(), image.size(),
+                                                 (UINT8 *)layout.physicalBase, layout.vaddrBase);
+   EXPECT(initializers.ctorAddresses == nullptr && initializers.ctorCount == 0);
+   sections[1].sh_size   = testKernel.ctorCount * sizeof(UINT64);
+   sections[1].sh_offset = image.size() + 8;
+   initializers          = ParseGlobalInitializers(sections, header->e_shnum, image.data(), image.size(),
+                                                   (UINT8 *)layout.physicalBase, layout.vaddrBase);
+   EXPECT(initializers.ctorAddresses == nullptr && initializers.ctorCount == 0);
+}
+
+static void TestParsePSF2Header() {
+   std::vector<UINT8> font = BuildSyntheticFont(256, 8, 16);
+   psf2_header *header     = ParsePSF2Header(font.data(), font.size());
+   EXPECT(header != nullptr && VerifyPSF2File(*header));
+   EXPECT(header && header->length == 256 && header->charSize == 16);
+   EXPECT(ParsePSF2Header(font.data(), sizeof(psf2_header) - 1) == nullptr);
+   font[0] = 0;
+   EXPECT(!VerifyPSF2File(*(psf2_header *)font.data()));
+}
+
+/** "LanternOS LanternOS LanternOS LanternOS boots with BhavaLoader.\n" as compressed by lz4 -9 -B4. */
+static const UINT8 knownLz4Frame[] = {
+   0x04, 0x22, 0x4D, 0x18, 0x68, 0x40, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x5C, 0x28,
+   0x00, 0x00, 0x00, 0xAF, 0x4C, 0x61, 0x6E, 0x74, 0x65, 0x72, 0x6E, 0x4F, 0x53, 0x20, 0x0A, 0x00,
+   0x0B, 0xF0, 0x09, 0x62, 0x6F, 0x6F, 0x74, 0x73, 0x20, 0x77, 0x69, 0x74, 0x68, 0x20, 0x42, 0x68,
+   0x61, 0x76, 0x61, 0x4C, 0x6F, 0x61, 0x64, 0x65, 0x72, 0x2E, 0x0A, 0x00, 0x00, 0x00, 0x00};
+static const char knownLz4Text[] = "LanternOS LanternOS LanternOS LanternOS boots with BhavaLoader.\n";
+
+static void TestLz4KnownAnswer() {
+   const UINTN textSize = sizeof(knownLz4Text) - 1;
+   UINT8 out[textSize]  = {};
+   UINTN outSize        = 0;
+   EXPECT(IsLz4Frame(knownLz4Frame, sizeof(knownLz4Frame)));
+   EXPECT(Lz4DecompressFrame(knownLz4Frame, sizeof(knownLz4Frame), out, textSize, &outSize));
+   EXPECT(outSize == textSize && memcmp(out, knownLz4Text, textSize) == 0);
+
+   // One byte short of room, a frame without its EndMark, and something that is not a frame at all.
+   EXPECT(!Lz4DecompressFrame(knownLz4Frame, sizeof(knownLz4Frame), out, textSize - 1, &outSize));
+   EXPECT(!Lz4DecompressFrame(knownLz4Frame, sizeof(knownLz4Frame) - 4, out, textSize, &outSize));
+   EXPECT(!IsLz4Frame((const UINT8 *)knownLz4Text, textSize));
+   EXPECT(!Lz4DecompressFrame((const UINT8 *)knownLz4Text, textSize, out, textSize, &outSize));
+   // A match reaching back past the start of the output.
+   std::vector<UINT8> badOffset(knownLz4Frame, knownLz4Frame + sizeof(knownLz4Frame));
+   badOffset[30] = 0x20;
+   EXPECT(!Lz4DecompressFrame(badOffset.data(), badOffset.size(), out, textSize, &outSize));
+}
+
+static void TestLz4RoundTrip() {
+   // Noise that will not compress, then repetitive text, then a long run of one byte.
+   std::vector<UINT8> data;
+   UINT32 noise = 12345;
+   for (UINTN i = 0; i < 70000; i++) {
+      noise = noise * 1103515245 + 12345;
+      data.push_back((UINT8)(noise >> 16));
+   }
+   for (UINT32 i = 0; data.size() < 270000; i++) {
+      char line[64];
+      int length = snprintf(line, sizeof(line), "segment %u at 0x%x holds %u bytes\n", i % 97, i * 0x40, i);
+      data.insert(data.end(), line, line + length);
+   }
+   data.insert(data.end(), 100000, 0xCC);
+
+   // Full blocks only, then a short stored block in the noise, then a short compressed block in the text.
+   // Independent blocks are split between processors, which must cope with a block that comes up short.
+   HostSetProcessorCount(4);
+   for (UINTN flushOffset : {0, 30000, 150000}) {
+      for (bool independentBlocks : {false, true}) {
+         std::vector<UINT8> frame = BuildLz4Frame(data, 4, independentBlocks, flushOffset);
+         EXPECT(frame.size() < data.size());
+         std::vector<UINT8> out(data.size());
+         UINTN outSize = 0;
+         EXPECT(Lz4DecompressFrame(frame.data(), frame.size(), out.data(), out.size(), &outSize));
+         EXPECT(outSize == data.size() && out == data);
+         std::fill(out.begin(), out.end(), 0);
+         EXPECT(Lz4DecompressFrameParallel(frame.data(), frame.size(), out.data(), out.size(), &outSize));
+         EXPECT(outSize == data.size() && out == data);
+         EXPECT(!Lz4DecompressFrame(frame.data(), frame.size(), out.data(), out.size() - 1, &outSize));
+         EXPECT(
+            !Lz4DecompressFrameParallel(frame.data(), frame.size(), out.data(), out.size() - 1, &outSize));
+      }
+   }
+   HostSetProcessorCount(1);
+}
+
+static void TestCrc32cKnownAnswer() {
+   // The check value of CRC32C, and the two all-equal vectors from RFC 3720 B.4.
+   std::vector<UINT8> zeroes(32, 0x00);
+   std::vector<UINT8> ones(32, 0xFF);
+   EXPECT(Crc32c("123456789", 9) == 0xE3069283);
+   EXPECT(Crc32c(zeroes.data(), zeroes.size()) == 0x8A9136AA);
+   EXPECT(Crc32c(ones.data(), ones.size()) == 0x62A8AB43);
+   EXPECT(Crc32c(nullptr, 0) == 0);
+
+   BuildCrc32cTable();
+   EXPECT(~Crc32cSoftware(0xFFFFFFFF, (const UINT8 *)"123456789", 9) == 0xE3069283);
+   EXPECT(~Crc32cSoftware(0xFFFFFFFF, ones.data(), ones.size()) == 0x62A8AB43);
+}
+
+static void TestCrc32cHardwareMatchesSoftware() {
+   if (!cpuHasSse42) {
+      printf("    No SSE4.2 on this CPU, only the table is in use.\n");
+      return;
+   }
+   BuildCrc32cTable();
+   std::vector<UINT8> data(0x10000 + 64);
+   UINT32 noise = 1;
+   for (UINT8 &byte : data) {
+      noise = noise * 1103515245 + 12345;
+      byte  = (UINT8)(noise >> 16);
+   }
+   // Every start alignment and every tail length the 8 byte loop can leave behind, and one large buffer.
+   bool match = true;
+   for (UINTN start = 0; start < 8; start++) {
+      for (UINTN size = 0; size < 40; size++) {
+         match &= Crc32cHardware(0xFFFFFFFF, &data[start], size) ==
+                  Crc32cSoftware(0xFFFFFFFF, &data[start], size);
+      }
+   }
+   match &= Crc32cHardware(0xFFFFFFFF, &data[3], 0x10000) == Crc32cSoftware(0xFFFFFFFF, &data[3], 0x10000);
+   EXPECT(match);
+}
+
+static bool Char16Equals(const CHAR16 *text, const char *expected) {
+   for (; *expected != 0; text++, expected++) {
+      if (*text != (CHAR16)*expected) {
+         return false;
+      }
+   }
+   return *text == 0;
+}
+
+static UINTN ParseConfigText(const char *text, LoaderConfig *OUTconfig) {
+   GetDefaultLoaderConfig(OUTconfig);
+   return ParseLoaderConfig(text, strlen(text), OUTconfig);
+}
+
+static void TestParseLoaderConfig() {
+   const char *text = "# BhavaLoader settings\r\n"
+                      "output = quiet\r\n"
+                      "\ttimeout=3   # seconds\n"
+                      "\n"
+                      "resolution = 1024x768\n"
+                      "kernel = /boot/LanternOS\n"
+                      "unknown = ignored\n"
+                      "earlyheap = 0\n"
+                      "bootplan = on";
+   LoaderConfig config;
+   EXPECT(ParseConfigText(text, &config) == 0);
+   EXPECT(config.quiet && config.autobootTimeout == 3);
+   EXPECT(config.resolutionX == 1024 && config.resolutionY == 768);
+   EXPECT(Char16Equals(config.kernelPath, "boot\\LanternOS"));
+   EXPECT(Char16Equals(config.fontPath, "font.psf"));
+   EXPECT(config.earlyHeapMiB == 0 && config.bootPlan);
+}
+
+static void TestParseMalformedLoaderConfig() {
+   struct MalformedConfig {
+      const char *text;
+      UINTN badLine;
+   };
+   std::string longPath = "kernel = " + std::string(CONFIG_MAX_PATH, 'a');
+   const MalformedConfig cases[] = {
+      {"timeout = soon", 1},
+      {"timeout = 12345678901", 1},
+      {"output = quiet\n\nkernel\n", 3},
+      {"resolution = 1024", 1},
+      {"resolution = 1024x", 1},
+      {"resolution = x768", 1},
+      {"fbbudget = 0", 1},
+      {"fbbudget = -4", 1},
+      {"earlyheap = 2048", 1},
+      {"bootplan = yes", 1},
+      {"rawio = 1", 1},
+      {"kernel = ", 1},
+      {"font = //", 1},
+      {longPath.c_str(), 1},
+      {"output = loud\ntimeout = never\nbootplan = maybe\n", 1},
+   };
+   for (const MalformedConfig &test : cases) {
+      LoaderConfig config;
+      UINTN badLine = ParseConfigText(test.text, &config);
+      if (badLine != test.badLine) {
+         printf("    \"%s\" reported line %zu\n", test.text, (size_t)badLine);
+      }
+      EXPECT(badLine == test.badLine);
+   }
+
+   // Bad lines are skipped and leave the setting alone, every other line still applies.
+   LoaderConfig config;
+   EXPECT(ParseConfigText("kernel = \ntimeout = 5\nresolution = 800\n", &config) == 1);
+   EXPECT(Char16Equals(config.kernelPath, "LanternOS"));
+   EXPECT(config.autobootTimeout == 5);
+   EXPECT(config.resolutionX == 0 && config.resolutionY == 0);
+}
+
+static std::vector<UINT8> BuildManifest(UINT32 magic, UINT32 version, UINT32 entryCount,
+                                        const std::vector<ManifestEntry> &entries) {
+   ManifestHeader header = {magic, version, entryCount, 0};
+   std::vector<UINT8> manifest(sizeof(ManifestHeader) + entries.size() * sizeof(ManifestEntry));
+   memcpy(manifest.data(), &header, sizeof(header));
+   if (!entries.empty()) {
+      memcpy(manifest.data() + sizeof(header), entries.data(), entries.size() * sizeof(ManifestEntry));
+   }
+   return manifest;
+}
+
+static void TestParseChecksumManifest() {
+   std::vector<ManifestEntry> entries(3);
+   snprintf(entries[0].name, MANIFEST_NAME_LENGTH, "LanternOS");
+   entries[0].segment = 0;
+   entries[0].crc     = 0x11111111;
+   snprintf(entries[1].name, MANIFEST_NAME_LENGTH, "LanternOS");
+   entries[1].segment = MANIFEST_WHOLE_FILE;
+   entries[1].crc     = 0x22222222;
+   snprintf(entries[2].name, MANIFEST_NAME_LENGTH, "boot/font.psf");
+   entries[2].segment = MANIFEST_WHOLE_FILE;
+   entries[2].crc     = 0x33333333;
+
+   std::vector<UINT8> data = BuildManifest(MANIFEST_MAGIC, MANIFEST_VERSION, 3, entries);
+   ChecksumManifest manifest {};
+   EXPECT(ParseChecksumManifest(data.data(), data.size(), &manifest));
+   EXPECT(manifest.entryCount == 3);
+
+   const CHAR16 kernelPath[] = {'L', 'A', 'N', 'T', 'E', 'R', 'N', 'O', 'S', 0};
+   const CHAR16 fontPath[]   = {'\\', 'B', 'o', 'o', 't', '\\', 'F', 'o', 'n', 't', '.', 'p', 's', 'f', 0};
+   const CHAR16 fontPrefix[] = {'b', 'o', 'o', 't', 0};
+
+   const ManifestEntry *segment = FindManifestEntry(&manifest, kernelPath, 0);
+   const ManifestEntry *font    = FindManifestEntry(&manifest, fontPath, MANIFEST_WHOLE_FILE);
+   EXPECT(segment && segment->crc == 0x11111111);
+   EXPECT(font && font->crc == 0x33333333);
+   EXPECT(FindManifestEntry(&manifest, kernelPath, 1) == nullptr);
+   EXPECT(FindManifestEntry(&manifest, fontPrefix, MANIFEST_WHOLE_FILE) == nullptr);
+
+   // Too short for a header, the wrong magic or version, and more entries than the file holds.
+   EXPECT(!ParseChecksumManifest(data.data(), sizeof(ManifestHeader) - 1, &manifest));
+   std::vector<UINT8> badMagic = BuildManifest(MANIFEST_MAGIC + 1, MANIFEST_VERSION, 3, entries);
+   EXPECT(!ParseChecksumManifest(badMagic.data(), badMagic.size(), &manifest));
+   std::vector<UINT8> badVersion = BuildManifest(MANIFEST_MAGIC, MANIFEST_VERSION + 1, 3, entries);
+   EXPECT(!ParseChecksumManifest(badVersion.data(), badVersion.size(), &manifest));
+   EXPECT(!ParseChecksumManifest(data.data(), data.size() - 1, &manifest));
+   std::vector<UINT8> tooMany = BuildManifest(MANIFEST_MAGIC, MANIFEST_VERSION, 0xFFFFFFFF, entries);
+   EXPECT(!ParseChecksumManifest(tooMany.data(), tooMany.size(), &manifest));
+   std::vector<UINT8> empty = BuildManifest(MANIFEST_MAGIC, MANIFEST_VERSION, 0, {});
+   EXPECT(ParseChecksumManifest(empty.data(), empty.size(), &manifest) && manifest.entryCount == 0);
+}
+
+static UINT8 ShortNameChecksum(const char *shortName) {
+   UINT8 sum = 0;
+   for (UINTN i = 0; i < 11; i++) { sum = (UINT8)(((sum & 1) << 7) + (sum >> 1) + (UINT8)shortName[i]); }
+   return sum;
+}
+
+static void AppendShortEntry(std::vector<UINT8> &directory, const char *shortName, UINT32 firstCluster) {
+   UINT8 entry[32] = {};
+   memcpy(entry, shortName, 11);
+   entry[20] = (UINT8)(firstCluster >> 16);
+   entry[21] = (UINT8)(firstCluster >> 24);
+   entry[26] = (UINT8)firstCluster;
+   entry[27] = (UINT8)(firstCluster >> 8);
+   directory.insert(directory.end(), entry, entry + sizeof(entry));
+}
+
+/** Appends a long name entry holding up to 13 characters of the name, terminated and padded as FAT does. */
+static void AppendLongNameEntry(std::vector<UINT8> &directory, UINT8 ordinal, UINT8 checksum,
+                                const char *part) {
+   static const UINT8 charOffsets[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+   UINT8 entry[32] = {};
+   entry[0]        = ordinal;
+   entry[11]       = 0x0F;
+   entry[13]       = checksum;
+   UINTN length    = strlen(part);
+   for (UINTN i = 0; i < 13; i++) {
+      UINT16 c = i < length ? (UINT8)part[i] : (i == length ? 0 : 0xFFFF);
+      entry[charOffsets[i]]     = (UINT8)c;
+      entry[charOffsets[i] + 1] = (UINT8)(c >> 8);
+   }
+   directory.insert(directory.end(), entry, entry + sizeof(entry));
+}
+
+static std::vector<CHAR16> ToChar16(const char *text) {
+   return std::vector<CHAR16>(text, text + strlen(text));
+}
+
+static void TestFatSearchDirectory() {
+   // "LanternOS.kernel" is stored last part first, in two long name entries before its short entry.
+   std::vector<UINT8> directory;
+   UINT8 checksum = ShortNameChecksum("LANTER~1KER");
+   AppendLongNameEntry(directory, 0x42, checksum, "nel");
+   AppendLongNameEntry(directory, 0x01, checksum, "LanternOS.ker");
+   AppendShortEntry(directory, "LANTER~1KER", 7);
+   AppendShortEntry(directory, "FONT    PSF", 9);
+   directory.resize(512);
+
+   std::vector<CHAR16> longName  = ToChar16("lanternos.KERNEL");
+   std::vector<CHAR16> shortName = ToChar16("lanter~1.ker");
+   std::vector<CHAR16> fontName  = ToChar16("font.psf");
+   std::vector<CHAR16> missing   = ToChar16("LanternOS");
+   UINT32 cluster                = 0;
+   bool intact                   = false;
+   EXPECT(HostFatSearchCluster(directory.data(), directory.size(), longName.data(), longName.size(), &cluster,
+                               &intact) &&
+          cluster == 7 && intact);
+   EXPECT(HostFatSearchCluster(directory.data(), directory.size(), shortName.data(), shortName.size(),
+                               &cluster, &intact) &&
+          cluster == 7);
+   EXPECT(HostFatSearchCluster(directory.data(), directory.size(), fontName.data(), fontName.size(), &cluster,
+                               &intact) &&
+          cluster == 9);
+   EXPECT(!HostFatSearchCluster(directory.data(), directory.size(), missing.data(), missing.size(), &cluster,
+                                &intact));
+}
+
+static void TestFatSearchCorruptDirectory() {
+   // A complete long name followed by an entry claiming to continue it with sequence number 0, which would
+   // place its characters in front of the name buffer. A first byte of 0 would end the directory instead, so
+   // the entry sets one of the bits above the sequence number.
+   std::vector<UINT8> directory;
+   UINT8 checksum = ShortNameChecksum("BOOT       ");
+   AppendLongNameEntry(directory, 0x41, checksum, "Boot");
+   AppendLongNameEntry(directory, 0x20, checksum, "XXXXXXXXXXXXX");
+   AppendShortEntry(directory, "BOOT       ", 5);
+   // Sequence numbers that run past the end of the name buffer.
+   AppendLongNameEntry(directory, 0x5F, checksum, "XXXXXXXXXXXXX");
+   AppendLongNameEntry(directory, 0x1F, checksum, "XXXXXXXXXXXXX");
+   AppendShortEntry(directory, "BOOT       ", 5);
+   directory.resize(512);
+
+   std::vector<CHAR16> name = ToChar16("XXXXXXXXXXXXXBoot");
+   UINT32 cluster           = 0;
+   bool intact              = false;
+   EXPECT(!HostFatSearchCluster(directory.data(), directory.size(), name.data(), name.size(), &cluster,
+                                &intact));
+   EXPECT(intact);
+}
+
+struct LoaderTest {
+   const char *name;
+   void (*run)();
+};
+
+static const LoaderTest tests[] = {
+   {"GetFileSize", TestGetFileSize},
+   {"ReadFileSynchronously", TestReadFileSynchronously},
+   {"ReadFileAsynchronously", TestReadFileAsynchronously},
+   {"ReadEmptyFile", TestReadEmptyFile},
+   {"ParseELFHeader", TestParseELFHeader},
+   {"ParseELFHeaders", TestParseELFHeaders},
+   {"LoadKernelSegments", TestLoadKernelSegments},
+   {"ParseGlobalInitializers", TestParseGlobalInitializers},
+   {"ParsePSF2Header", TestParsePSF2Header},
+   {"Lz4KnownAnswer", TestLz4KnownAnswer},
+   {"Lz4RoundTrip", TestLz4RoundTrip},
+   {"Crc32cKnownAnswer", TestCrc32cKnownAnswer},
+   {"Crc32cHardwareMatchesSoftware", TestCrc32cHardwareMatchesSoftware},
+   {"ParseLoaderConfig", TestParseLoaderConfig},
+   {"ParseMalformedLoaderConfig", TestParseMalformedLoaderConfig},
+   {"ParseChecksumManifest", TestParseChecksumManifest},
+   {"FatSearchDirectory", TestFatSearchDirectory},
+   {"FatSearchCorruptDirectory", TestFatSearchCorruptDirectory},
+};
+
+int main() {
+   HostInitialize();
+   int failedTests = 0;
+   for (const LoaderTest &test : tests) {
+      HostResetCallCounts();
+      int failedBefore = failedChecks;
+      test.run();
+      HostFreeAllMemory();
+      bool passed = failedChecks == failedBefore;
+      failedTests += passed ? 0 : 1;
+      printf("[%s] %s\n", passed ? "  OK  " : " FAIL ", test.name);
+   }
+   printf("%d of %zu tests passed.\n", (int)(sizeof(tests) / sizeof(tests[0])) - failedTests,
+          sizeof(tests) / sizeof(tests[0]));
+   return failedTests == 0 ? 0 : 1;
+}
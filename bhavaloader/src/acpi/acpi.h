@@ -0,0 +1,166 @@
+#pragma once
+#include "../util/memcpy.h"
+#include "boot/acpi.h"
+
+/*
+ * Finds the ACPI tables through the RSDP the firmware publishes in the UEFI configuration table. See
+ * chapter 5 of the ACPI specification for the layout of the structures below.
+ */
+
+struct __attribute__((packed)) AcpiRsdp {
+   char signature[8];
+   UINT8 checksum;
+   char oemId[6];
+   UINT8 revision;
+   UINT32 rsdtAddress;
+   // Everything from here on only exists from revision 2 onwards.
+   UINT32 length;
+   UINT64 xsdtAddress;
+   UINT8 extendedChecksum;
+   UINT8 reserved[3];
+};
+
+struct __attribute__((packed)) AcpiSdtHeader {
+   char signature[4];
+   UINT32 length;
+   UINT8 revision;
+   UINT8 checksum;
+   char oemId[6];
+   char oemTableId[8];
+   UINT32 oemRevision;
+   UINT32 creatorId;
+   UINT32 creatorRevision;
+};
+
+/** The revision 1.0 RSDP ends before the length field. */
+#define ACPI_RSDP_V1_SIZE 20
+/** Offsets of the DSDT pointers in the FADT, which are the only route to the DSDT. */
+#define ACPI_FADT_DSDT_OFFSET   40
+#define ACPI_FADT_X_DSDT_OFFSET 140
+
+/** Why the ACPI tables could not be indexed, for reporting to the user. */
+enum class AcpiError {
+   None,
+   NoRsdp,
+   InvalidRsdp,
+   InvalidRootTable,
+};
+
+/**
+ * @brief Checks that the bytes of an ACPI structure sum to zero, as every ACPI checksum requires.
+ */
+bool IsAcpiChecksumValid(const void *data, UINTN length) {
+   UINT8 sum = 0;
+   for (UINTN i = 0; i < length; i++) { sum += ((const UINT8 *)data)[i]; }
+   return sum == 0;
+}
+
+bool HasAcpiSignature(const AcpiSdtHeader *header, const char *signature) {
+   return header->signature[0] == signature[0] && header->signature[1] == signature[1] &&
+          header->signature[2] == signature[2] && header->signature[3] == signature[3];
+}
+
+bool AreGuidsEqual(const EFI_GUID &a, const EFI_GUID &b) {
+   const UINT8 *left  = (const UINT8 *)&a;
+   const UINT8 *right = (const UINT8 *)&b;
+   for (UINTN i = 0; i < sizeof(EFI_GUID); i++) {
+      if (left[i] != right[i]) {
+         return false;
+      }
+   }
+   return true;
+}
+
+/**
+ * @brief Looks up the RSDP in the UEFI configuration table, preferring the ACPI 2.0 entry.
+ *
+ * @return The RSDP, or nullptr if the firmware does not publish one.
+ */
+const AcpiRsdp *FindAcpiRsdp() {
+   EFI_GUID acpi20GUID  = ACPI_20_TABLE_GUID;
+   EFI_GUID acpi10GUID  = ACPI_TABLE_GUID;
+   const AcpiRsdp *rsdp = nullptr;
+   for (UINTN i = 0; i < ST->NumberOfTableEntries; i++) {
+      const EFI_CONFIGURATION_TABLE &entry = ST->ConfigurationTable[i];
+      if (AreGuidsEqual(entry.VendorGuid, acpi20GUID)) {
+         return (const AcpiRsdp *)entry.VendorTable;
+      }
+      if (AreGuidsEqual(entry.VendorGuid, acpi10GUID)) {
+         rsdp = (const AcpiRsdp *)entry.VendorTable;
+      }
+   }
+   return rsdp;
+}
+
+/**
+ * @brief Adds a table to the index if its checksum is valid. Tables past ACPI_TABLE_INDEX_MAX are dropped.
+ * @param address: The physical address of the table header.
+ * @param index: The index to add to.
+ *
+ * @return The table header, or nullptr if the table was not added.
+ */
+const AcpiSdtHeader *AddAcpiTable(UINT64 address, AcpiTableIndex *index) {
+   const AcpiSdtHeader *header = (const AcpiSdtHeader *)address;
+   if (address == 0 || index->tableCount >= ACPI_TABLE_INDEX_MAX || header->length < sizeof(AcpiSdtHeader) ||
+       !IsAcpiChecksumValid(header, header->length)) {
+      return nullptr;
+   }
+   AcpiTableEntry *entry = &index->tables[index->tableCount++];
+   memcpy(entry->signature, header->signature, sizeof(entry->signature));
+   entry->length  = header->length;
+   entry->address = address;
+   return header;
+}
+
+/**
+ * @brief Validates the RSDP and the XSDT (or RSDT on ACPI 1.0 systems) and indexes every table they list,
+ * along with the DSDT referenced from the FADT. Tables with a bad checksum are left out.
+ * @param OUTindex: Filled with the table index.
+ *
+ * @return AcpiError::None on success, or why the tables could not be found.
+ */
+AcpiError BuildAcpiTableIndex(AcpiTableIndex *OUTindex) {
+   OUTindex->rsdpAddress  = 0;
+   OUTindex->rsdpRevision = 0;
+   OUTindex->tableCount   = 0;
+
+   const AcpiRsdp *rsdp = FindAcpiRsdp();
+   if (!rsdp) {
+      return AcpiError::NoRsdp;
+   }
+   if (!IsAcpiChecksumValid(rsdp, ACPI_RSDP_V1_SIZE) ||
+       (rsdp->revision >= 2 && !IsAcpiChecksumValid(rsdp, rsdp->length))) {
+      return AcpiError::InvalidRsdp;
+   }
+   OUTindex->rsdpAddress  = (UINT64)rsdp;
+   OUTindex->rsdpRevision = rsdp->revision;
+
+   // The XSDT holds 64 bit pointers and supersedes the RSDT whenever it exists.
+   bool useXsdt                   = rsdp->revision >= 2 && rsdp->xsdtAddress != 0;
+   UINTN entrySize                = useXsdt ? 8 : 4;
+   const AcpiSdtHeader *rootTable = AddAcpiTable(useXsdt ? rsdp->xsdtAddress : rsdp->rsdtAddress, OUTindex);
+   if (!rootTable) {
+      return AcpiError::InvalidRootTable;
+   }
+
+   const UINT8 *entries = (const UINT8 *)rootTable + sizeof(AcpiSdtHeader);
+   UINTN entryCount     = (rootTable->length - sizeof(AcpiSdtHeader)) / entrySize;
+   for (UINTN i = 0; i < entryCount; i++) {
+      // XSDT entries are only 4 byte aligned.
+      UINT64 address = 0;
+      memcpy(&address, entries + i * entrySize, entrySize);
+      const AcpiSdtHeader *table = AddAcpiTable(address, OUTindex);
+
+      if (table && HasAcpiSignature(table, "FACP")) {
+         UINT64 dsdtAddress = 0;
+         if (table->length >= ACPI_FADT_X_DSDT_OFFSET + 8) {
+            memcpy(&dsdtAddress, (const UINT8 *)table + ACPI_FADT_X_DSDT_OFFSET, 8);
+         }
+         if (dsdtAddress == 0 && table->length >= ACPI_FADT_DSDT_OFFSET + 4) {
+            memcpy(&dsdtAddress, (const UINT8 *)table + ACPI_FADT_DSDT_OFFSET, 4);
+         }
+         AddAcpiTable(dsdtAddress, OUTindex);
+      }
+   }
+   return AcpiError::None;
+}
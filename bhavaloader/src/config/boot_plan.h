@@ -0,0 +1,222 @@
+#pragma once
+#include "../fs/boot_volume.h"
+#include "../fs/file_read.h"
+#include "../util/crc32c.h"
+#include "../video/video_mode.h"
+#include "config.h"
+
+/*
+ * bhava.plan is a small binary file the loader keeps in the root of the boot volume. It records what earlier
+ * boots worked out about this machine and these images, so a boot onto the same images can skip finding it
+ * out again. Every section is keyed by what it was derived from and is only replayed if those inputs are
+ * unchanged. The file is only rewritten when something in it changes, so a machine that keeps booting the
+ * same images never writes to the disk.
+ *
+ * The video section records the mode picked for the configured resolution and budget, so the firmware only
+ * has to confirm that one mode instead of describing every mode it has. The kernel section is keyed by the
+ * size and CRC32C of the kernel file as read, and by the CRC32C of bhava.sum. If its loaded segments passed
+ * the manifest check before, the same file decompresses into the same segments, so they are not checked
+ * again. That only pays off for an LZ4 compressed kernel, whose file is smaller than its segments, so an
+ * uncompressed kernel leaves the key empty and has its segments checked every time.
+ */
+
+#define BOOT_PLAN_FILE_NAME L"bhava.plan"
+#define BOOT_PLAN_MAGIC     0x4E4C5042  // "BPLN"
+#define BOOT_PLAN_VERSION   1
+
+struct BootPlanVideo {
+   /** Key: the number of modes the firmware offered, and the configuration the mode was picked for. */
+   UINT32 maxMode;
+   UINT32 resolutionX;
+   UINT32 resolutionY;
+   UINT32 framebufferBudgetMiB;
+   /** The mode that was picked, exactly as QueryMode() described it. */
+   UINT32 mode;
+   UINT32 width;
+   UINT32 height;
+   UINT32 pixelsPerScanLine;
+   UINT32 pixelFormat;
+   UINT32 redMask;
+   UINT32 greenMask;
+   UINT32 blueMask;
+   UINT32 reservedMask;
+   UINT32 reserved;
+};
+
+struct BootPlanKernel {
+   /** Key: the kernel file as read from the disk, and the manifest it was checked against (0 if none). */
+   UINT64 fileSize;
+   UINT32 fileCrc;
+   UINT32 manifestCrc;
+   /** Where the kernel segments ended up, and the entry point in the kernel's own addresses. */
+   UINT64 layoutSize;
+   UINT64 vaddrBase;
+   UINT64 entry;
+   UINT64 relocationCount;
+   /** Non-zero if the loaded segments were checked against bhava.sum and passed. */
+   UINT32 segmentsVerified;
+   UINT32 reserved;
+};
+
+struct BootPlan {
+   UINT32 magic;
+   UINT32 version;
+   /** The CRC32C of the whole plan, computed with this field set to 0. */
+   UINT32 crc;
+   UINT32 reserved;
+   BootPlanVideo video;
+   BootPlanKernel kernel;
+};
+
+UINT32 ComputeBootPlanCrc(const BootPlan *plan) {
+   BootPlan copy = *plan;
+   copy.crc      = 0;
+   return Crc32c(&copy, sizeof(copy));
+}
+
+/**
+ * @brief Reads the boot plan recorded by an earlier boot.
+ * @param volume: The open boot volume.
+ * @param OUTplan: Filled with the plan, or zeroed if there is none, in which case no section will match.
+ *
+ * @return False if there is no plan this loader understands.
+ */
+bool LoadBootPlan(const BootVolume *volume, BootPlan *OUTplan) {
+   *OUTplan                    = {};
+   EFI_FILE_PROTOCOL *planFile = OpenBootVolumeFile(volume, (const CHAR16 *)BOOT_PLAN_FILE_NAME);
+   if (!planFile) {
+      return false;
+   }
+   UINTN planSize    = 0;
+   UINT8 *planBuffer = ReadFileToBuffer(planFile, &planSize);
+   planFile->Close(planFile);
+   if (!planBuffer) {
+      return false;
+   }
+   if (planSize == sizeof(BootPlan)) {
+      memcpy(OUTplan, planBuffer, sizeof(BootPlan));
+   }
+   ST->BootServices->FreePages((EFI_PHYSICAL_ADDRESS)planBuffer, GetDataPageSize(planSize));
+   if (OUTplan->magic != BOOT_PLAN_MAGIC || OUTplan->version != BOOT_PLAN_VERSION ||
+       OUTplan->crc != ComputeBootPlanCrc(OUTplan)) {
+      *OUTplan = {};
+      return false;
+   }
+   return true;
+}
+
+/**
+ * @brief Checks whether this boot found out anything different from what the plan it started with recorded.
+ */
+bool HasBootPlanChanged(const BootPlan *plan, const BootPlan *lastPlan) {
+   // The header is only filled in when a plan is saved, so only the sections are compared.
+   const UINT8 *a = (const UINT8 *)&plan->video;
+   const UINT8 *b = (const UINT8 *)&lastPlan->video;
+   for (UINTN i = 0; i < sizeof(BootPlan) - offsetof(BootPlan, video); i++) {
+      if (a[i] != b[i]) {
+         return true;
+      }
+   }
+   return false;
+}
+
+/**
+ * @brief Writes a boot plan to the root of the boot volume, replacing the one that is there.
+ * @param deviceHandle: The device handle that loaded this EFI image.
+ * @param imageHandle: The handle representing this EFI image.
+ * @param plan: The plan to write. Its header is filled in here.
+ *
+ * @return False if the volume could not be written to.
+ */
+bool SaveBootPlan(EFI_HANDLE deviceHandle, EFI_HANDLE imageHandle, BootPlan *plan) {
+   plan->magic   = BOOT_PLAN_MAGIC;
+   plan->version = BOOT_PLAN_VERSION;
+   plan->crc     = ComputeBootPlanCrc(plan);
+
+   BootVolume volume;
+   if (!OpenBootVolume(deviceHandle, imageHandle, &volume)) {
+      return false;
+   }
+   // An old plan may be longer than this one, and there is no simple way to truncate a file. Delete()
+   // closes the handle whether or not it succeeds.
+   EFI_FILE_PROTOCOL *planFile = nullptr;
+   if (volume.root->Open(volume.root, &planFile, (CHAR16 *)BOOT_PLAN_FILE_NAME,
+                         EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0) == EFI_SUCCESS) {
+      planFile->Delete(planFile);
+   }
+   bool saved = false;
+   if (volume.root->Open(volume.root, &planFile, (CHAR16 *)BOOT_PLAN_FILE_NAME,
+                         EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0) == EFI_SUCCESS) {
+      UINTN writeSize = sizeof(BootPlan);
+      saved           = planFile->Write(planFile, &writeSize, plan) == EFI_SUCCESS;
+      saved           = saved && writeSize == sizeof(BootPlan);
+      // Close() flushes the file, so it has the final say on whether the plan made it to the disk.
+      saved = planFile->Close(planFile) == EFI_SUCCESS && saved;
+   }
+   CloseBootVolume(&volume);
+   return saved;
+}
+
+/**
+ * @brief Sets up the video mode table from the video section of a plan, if it was recorded for the current
+ * configuration and the firmware still describes the recorded mode the same way.
+ * @param plan: The plan read by LoadBootPlan().
+ * @param config: The loader configuration.
+ * @param OUTtable: Filled with a table holding only the recorded mode. Release it with FreeVideoModeTable().
+ *
+ * @return False if the section can not be replayed, in which case the modes have to be enumerated.
+ */
+bool ReplayVideoPlan(const BootPlan *plan, const LoaderConfig *config, VideoModeTable *OUTtable) {
+   const BootPlanVideo &video = plan->video;
+   if (video.width == 0 || video.resolutionX != config->resolutionX ||
+       video.resolutionY != config->resolutionY ||
+       video.framebufferBudgetMiB != config->framebufferBudgetMiB) {
+      return false;
+   }
+   VideoMode expected = {video.mode,
+                         video.width,
+                         video.height,
+                         video.pixelsPerScanLine,
+                         (EFI_GRAPHICS_PIXEL_FORMAT)video.pixelFormat,
+                         {video.redMask, video.greenMask, video.blueMask, video.reservedMask}};
+   return LoadKnownVideoMode(expected, video.maxMode, OUTtable);
+}
+
+/**
+ * @brief Records the mode picked for the current configuration in the video section of a plan.
+ */
+void RecordVideoPlan(const VideoModeTable *table, const VideoMode *mode, const LoaderConfig *config,
+                     BootPlan *plan) {
+   const EFI_PIXEL_BITMASK &mask = mode->pixelInformation;
+   plan->video                   = {table->gop->Mode->MaxMode,
+                                    config->resolutionX,
+                                    config->resolutionY,
+                                    config->framebufferBudgetMiB,
+                                    mode->mode,
+                                    mode->width,
+                                    mode->height,
+                                    mode->pixelsPerScanLine,
+                                    (UINT32)mode->pixelFormat,
+                                    mask.RedMask,
+                                    mask.GreenMask,
+                                    mask.BlueMask,
+                                    mask.ReservedMask,
+                                    0};
+}
+
+/**
+ * @brief Checks whether the loaded kernel segments can be trusted on the strength of an earlier boot: the
+ * kernel file and the manifest must be unchanged, the segments must have passed the manifest check then, and
+ * they must have ended up with the same layout now.
+ * @param plan: The plan read by LoadBootPlan().
+ * @param kernel: The kernel section recorded for this boot so far. Only the key and layout are compared.
+ *
+ * @return True if the segments do not need to be checked again.
+ */
+bool ReplayKernelPlan(const BootPlan *plan, const BootPlanKernel *kernel) {
+   const BootPlanKernel &planned = plan->kernel;
+   return planned.segmentsVerified != 0 && planned.fileSize != 0 && planned.fileSize == kernel->fileSize &&
+          planned.fileCrc == kernel->fileCrc && planned.manifestCrc == kernel->manifestCrc &&
+          planned.layoutSize == kernel->layoutSize && planned.vaddrBase == kernel->vaddrBase &&
+          planned.entry == kernel->entry;
+}
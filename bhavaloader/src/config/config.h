@@ -0,0 +1,253 @@
+#pragma once
+#include "loader_config.h"
+
+/*
+ * bhava.cfg is an optional plain ASCII file in the root of the boot volume. Each line holds a single
+ * "key = value" pair, and everything after a '#' is a comment. Unknown keys are ignored. Supported keys:
+ *
+ *    output     = quiet | verbose    Quiet mode prints nothing unless something goes wrong.
+ *    timeout    = <seconds> | never  How long to wait for a key before booting. 0 boots immediately.
+ *    resolution = <width>x<height> | highest
+ *    fbbudget   = <MiB> | unlimited  Largest framebuffer to pick when no resolution is requested.
+ *    kernel     = <path>             Path to the kernel on the boot volume, '/' or '\' separated.
+ *    font       = <path>             Path to the PSF2 font on the boot volume.
+ *    initrd     = <path>             Optional initial ramdisk to hand to the kernel.
+ *    symbols    = <path>             Optional kernel symbol file to hand to the kernel.
+ *    rawio      = on | off           Read FAT volumes through Block IO instead of the firmware driver.
+ *    earlyheap  = <MiB>              Zeroed memory handed to the kernel to allocate from. 0 for none.
+ *    bootplan   = on | off           Remember what earlier boots found out in bhava.plan. Off by default.
+ */
+
+/**
+ * @brief Copies an ASCII path into a CHAR16 buffer, converting '/' separators into the '\' UEFI expects.
+ * @param path: The path to copy. Does not need to be null terminated.
+ * @param length: The number of characters in path.
+ * @param OUTpath: The buffer to fill. Must hold CONFIG_MAX_PATH characters.
+ *
+ * @return False if the path is empty or too long, in which case OUTpath is left untouched.
+ */
+bool CopyConfigPath(const char *path, UINTN length, CHAR16 *OUTpath) {
+   // Paths are always relative to the root of the volume.
+   while (length > 0 && (*path == '/' || *path == '\\')) {
+      path++;
+      length--;
+   }
+   if (length == 0 || length >= CONFIG_MAX_PATH) {
+      return false;
+   }
+   for (UINTN i = 0; i < length; i++) { OUTpath[i] = path[i] == '/' ? L'\\' : (CHAR16)path[i]; }
+   OUTpath[length] = 0;
+   return true;
+}
+
+/**
+ * @brief Parses an unsigned decimal number.
+ * @param text: The digits to parse. Does not need to be null terminated.
+ * @param length: The number of characters in text.
+ * @param OUTvalue: Filled with the parsed value.
+ *
+ * @return False if text is empty, contains anything but digits, or does not fit into 32 bits.
+ */
+bool ParseConfigNumber(const char *text, UINTN length, UINT32 *OUTvalue) {
+   if (length == 0 || length > 9) {
+      return false;
+   }
+   UINT32 value = 0;
+   for (UINTN i = 0; i < length; i++) {
+      if (text[i] < '0' || text[i] > '9') {
+         return false;
+      }
+      value = value * 10 + (text[i] - '0');
+   }
+   *OUTvalue = value;
+   return true;
+}
+
+/**
+ * @brief Compares a non null terminated string against a null terminated ASCII string.
+ */
+bool ConfigEquals(const char *text, UINTN length, const char *expected) {
+   UINTN i = 0;
+   for (; i < length; i++) {
+      if (expected[i] == 0 || expected[i] != text[i]) {
+         return false;
+      }
+   }
+   return expected[i] == 0;
+}
+
+/**
+ * @brief Gets the configuration used when bhava.cfg is missing or leaves a key out: verbose output, wait
+ * for a key, the best video mode whose framebuffer fits CONFIG_DEFAULT_FB_MIB, the kernel and font from the
+ * root of the volume read through the firmware, and a CONFIG_DEFAULT_HEAP_MIB early heap. The boot plan is
+ * off, so the loader never writes to the boot volume unless bhava.cfg asks it to.
+ * @param OUTconfig: Filled with the default configuration.
+ */
+void GetDefaultLoaderConfig(LoaderConfig *OUTconfig) {
+   OUTconfig->quiet           = false;
+   OUTconfig->autobootTimeout = CONFIG_TIMEOUT_NEVER;
+#ifdef CUSTOM_RESOLUTION
+   OUTconfig->resolutionX = CUSTOM_RESOLUTION_X;
+   OUTconfig->resolutionY = CUSTOM_RESOLUTION_Y;
+#else
+   OUTconfig->resolutionX = 0;
+   OUTconfig->resolutionY = 0;
+#endif
+   CopyConfigPath("LanternOS", 9, OUTconfig->kernelPath);
+   CopyConfigPath("font.psf", 8, OUTconfig->fontPath);
+   OUTconfig->initrdPath[0]        = 0;
+   OUTconfig->symbolsPath[0]       = 0;
+   OUTconfig->rawDiskReads         = false;
+   OUTconfig->framebufferBudgetMiB = CONFIG_DEFAULT_FB_MIB;
+   OUTconfig->earlyHeapMiB         = CONFIG_DEFAULT_HEAP_MIB;
+   OUTconfig->bootPlan             = false;
+}
+
+/**
+ * @brief Applies a single "key = value" pair to the configuration.
+ * @param key: The key, without surrounding whitespace.
+ * @param keyLength: The number of characters in key.
+ * @param value: The value, without surrounding whitespace.
+ * @param valueLength: The number of characters in value.
+ * @param config: The configuration to update.
+ *
+ * @return False if the key is known but the value could not be understood.
+ */
+bool ApplyConfigSetting(const char *key, UINTN keyLength, const char *value, UINTN valueLength,
+                        LoaderConfig *config) {
+   if (ConfigEquals(key, keyLength, "output")) {
+      if (ConfigEquals(value, valueLength, "quiet")) {
+         config->quiet = true;
+      } else if (ConfigEquals(value, valueLength, "verbose")) {
+         config->quiet = false;
+      } else {
+         return false;
+      }
+   } else if (ConfigEquals(key, keyLength, "timeout")) {
+      UINT32 seconds = 0;
+      if (ConfigEquals(value, valueLength, "never")) {
+         config->autobootTimeout = CONFIG_TIMEOUT_NEVER;
+      } else if (ParseConfigNumber(value, valueLength, &seconds)) {
+         config->autobootTimeout = seconds;
+      } else {
+         return false;
+      }
+   } else if (ConfigEquals(key, keyLength, "resolution")) {
+      if (ConfigEquals(value, valueLength, "highest")) {
+         config->resolutionX = 0;
+         config->resolutionY = 0;
+         return true;
+      }
+      UINTN separator = 0;
+      while (separator < valueLength && value[separator] != 'x') { separator++; }
+      UINT32 width  = 0;
+      UINT32 height = 0;
+      if (!ParseConfigNumber(value, separator, &width) ||
+          separator == valueLength ||
+          !ParseConfigNumber(value + separator + 1, valueLength - separator - 1, &height)) {
+         return false;
+      }
+      config->resolutionX = width;
+      config->resolutionY = height;
+   } else if (ConfigEquals(key, keyLength, "fbbudget")) {
+      UINT32 budget = 0;
+      if (ConfigEquals(value, valueLength, "unlimited")) {
+         config->framebufferBudgetMiB = 0;
+      } else if (ParseConfigNumber(value, valueLength, &budget) && budget != 0) {
+         config->framebufferBudgetMiB = budget;
+      } else {
+         return false;
+      }
+   } else if (ConfigEquals(key, keyLength, "kernel")) {
+      return CopyConfigPath(value, valueLength, config->kernelPath);
+   } else if (ConfigEquals(key, keyLength, "font")) {
+      return CopyConfigPath(value, valueLength, config->fontPath);
+   } else if (ConfigEquals(key, keyLength, "initrd")) {
+      return CopyConfigPath(value, valueLength, config->initrdPath);
+   } else if (ConfigEquals(key, keyLength, "symbols")) {
+      return CopyConfigPath(value, valueLength, config->symbolsPath);
+   } else if (ConfigEquals(key, keyLength, "rawio")) {
+      if (ConfigEquals(value, valueLength, "on")) {
+         config->rawDiskReads = true;
+      } else if (ConfigEquals(value, valueLength, "off")) {
+         config->rawDiskReads = false;
+      } else {
+         return false;
+      }
+   } else if (ConfigEquals(key, keyLength, "earlyheap")) {
+      // The heap is carved out of one contiguous run of memory, so keep it to something firmware can find.
+      UINT32 heapMiB = 0;
+      if (!ParseConfigNumber(value, valueLength, &heapMiB) || heapMiB > 1024) {
+         return false;
+      }
+      config->earlyHeapMiB = heapMiB;
+   } else if (ConfigEquals(key, keyLength, "bootplan")) {
+      if (ConfigEquals(value, valueLength, "on")) {
+         config->bootPlan = true;
+      } else if (ConfigEquals(value, valueLength, "off")) {
+         config->bootPlan = false;
+      } else {
+         return false;
+      }
+   }
+   return true;
+}
+
+bool IsConfigWhitespace(char c) {
+   return c == ' ' || c == '\t' || c == '\r';
+}
+
+/**
+ * @brief Parses the contents of bhava.cfg on top of an existing configuration.
+ * @param text: The contents of the file. Does not need to be null terminated.
+ * @param size: The size of the file in bytes.
+ * @param config: The configuration to update.
+ *
+ * @return The 1-based number of the first line that could not be understood, or 0 if every line was fine.
+ * Lines that could not be understood are skipped.
+ */
+UINTN ParseLoaderConfig(const char *text, UINTN size, LoaderConfig *config) {
+   UINTN firstBadLine = 0;
+   UINTN lineNumber   = 0;
+   UINTN position     = 0;
+   while (position < size) {
+      lineNumber++;
+      UINTN lineStart = position;
+      while (position < size && text[position] != '\n') { position++; }
+      UINTN lineEnd = position;
+      position++;
+
+      // Strip comments, then split around the '='.
+      for (UINTN i = lineStart; i < lineEnd; i++) {
+         if (text[i] == '#') {
+            lineEnd = i;
+            break;
+         }
+      }
+      UINTN separator = lineStart;
+      while (separator < lineEnd && text[separator] != '=') { separator++; }
+
+      UINTN keyStart   = lineStart;
+      UINTN keyEnd     = separator;
+      UINTN valueStart = separator + 1;
+      UINTN valueEnd   = lineEnd;
+      while (keyStart < keyEnd && IsConfigWhitespace(text[keyStart])) { keyStart++; }
+      while (keyEnd > keyStart && IsConfigWhitespace(text[keyEnd - 1])) { keyEnd--; }
+      if (separator == lineEnd) {
+         // Blank and comment-only lines are fine, anything else without a '=' is not.
+         if (keyStart != keyEnd && firstBadLine == 0) {
+            firstBadLine = lineNumber;
+         }
+         continue;
+      }
+      while (valueStart < valueEnd && IsConfigWhitespace(text[valueStart])) { valueStart++; }
+      while (valueEnd > valueStart && IsConfigWhitespace(text[valueEnd - 1])) { valueEnd--; }
+
+      if (!ApplyConfigSetting(text + keyStart, keyEnd - keyStart, text + valueStart, valueEnd - valueStart,
+                              config) &&
+          firstBadLine == 0) {
+         firstBadLine = lineNumber;
+      }
+   }
+   return firstBadLine;
+}
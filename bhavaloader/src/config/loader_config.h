@@ -0,0 +1,36 @@
+#pragma once
+
+/*
+ * The settings read from bhava.cfg, kept apart from the parser so they can be used without it. See config.h
+ * for the file format.
+ */
+
+#define CONFIG_FILE_NAME        L"bhava.cfg"
+#define CONFIG_MAX_PATH         128
+#define CONFIG_TIMEOUT_NEVER    -1
+/** Enough for 2560x1440 without padding. Anything bigger makes every scroll of the kernel console slow. */
+#define CONFIG_DEFAULT_FB_MIB   16
+#define CONFIG_DEFAULT_HEAP_MIB 16
+
+struct LoaderConfig {
+   bool quiet;
+   /** Seconds to wait for a key press before booting, or CONFIG_TIMEOUT_NEVER to wait indefinitely. */
+   INT32 autobootTimeout;
+   /** The requested resolution, or 0x0 to use the best mode within the framebuffer budget. */
+   UINT32 resolutionX;
+   UINT32 resolutionY;
+   /** The largest framebuffer, in MiB, to choose when no resolution is requested. 0 means no limit. */
+   UINT32 framebufferBudgetMiB;
+   CHAR16 kernelPath[CONFIG_MAX_PATH];
+   CHAR16 fontPath[CONFIG_MAX_PATH];
+   /** Empty if no initrd should be loaded. */
+   CHAR16 initrdPath[CONFIG_MAX_PATH];
+   /** Empty if no symbol file should be loaded. */
+   CHAR16 symbolsPath[CONFIG_MAX_PATH];
+   /** Read boot modules with the loader's own FAT reader where possible. */
+   bool rawDiskReads;
+   /** The size of the kernel's early heap in MiB. 0 hands over no heap. */
+   UINT32 earlyHeapMiB;
+   /** Read and write bhava.plan. */
+   bool bootPlan;
+};
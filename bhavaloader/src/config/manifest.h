@@ -0,0 +1,94 @@
+#pragma once
+#include "../util/crc32c.h"
+#include "../util/mp.h"
+#include "manifest_format.h"
+
+/**
+ * @brief Checks the header of a manifest and sets up access to its entries.
+ * @param data: The contents of bhava.sum.
+ * @param size: The size of the file, in bytes.
+ * @param OUTmanifest: Filled with the entries. Points into data.
+ *
+ * @return False if the file is not a manifest this loader understands.
+ */
+bool ParseChecksumManifest(const UINT8 *data, UINTN size, ChecksumManifest *OUTmanifest) {
+   if (size < sizeof(ManifestHeader)) {
+      return false;
+   }
+   const ManifestHeader *header = (const ManifestHeader *)data;
+   if (header->magic != MANIFEST_MAGIC || header->version != MANIFEST_VERSION ||
+       header->entryCount > (size - sizeof(ManifestHeader)) / sizeof(ManifestEntry)) {
+      return false;
+   }
+   *OUTmanifest = {(const ManifestEntry *)(data + sizeof(ManifestHeader)), header->entryCount};
+   return true;
+}
+
+/**
+ * @brief Compares a manifest name with a path on the boot volume. Like the FAT file system, case is
+ * ignored, '/' and '\' are treated alike, and leading separators do not count.
+ */
+bool ManifestNameMatches(const char *name, const CHAR16 *path) {
+   while (*path == L'/' || *path == L'\\') { path++; }
+   UINTN i = 0;
+   for (; i < MANIFEST_NAME_LENGTH && name[i] != 0; i++) {
+      CHAR16 a = (CHAR16)(UINT8)name[i];
+      CHAR16 b = path[i];
+      a        = a == L'\\' ? L'/' : (a >= L'a' && a <= L'z' ? a - L'a' + L'A' : a);
+      b        = b == L'\\' ? L'/' : (b >= L'a' && b <= L'z' ? b - L'a' + L'A' : b);
+      if (a != b) {
+         return false;
+      }
+   }
+   return i < MANIFEST_NAME_LENGTH && path[i] == 0;
+}
+
+/**
+ * @brief Finds the manifest entry for a file, or for one segment of the kernel.
+ * @param manifest: The parsed manifest.
+ * @param path: The path of the file on the boot volume.
+ * @param segment: The kernel program header index, or MANIFEST_WHOLE_FILE.
+ *
+ * @return The entry, or nullptr if the manifest has none for it.
+ */
+const ManifestEntry *FindManifestEntry(const ChecksumManifest *manifest, const CHAR16 *path, UINT32 segment) {
+   for (UINTN i = 0; i < manifest->entryCount; i++) {
+      const ManifestEntry *entry = &manifest->entries[i];
+      if (entry->segment == segment && ManifestNameMatches(entry->name, path)) {
+         return entry;
+      }
+   }
+   return nullptr;
+}
+
+/** One region of memory to check against its manifest entry. */
+struct ChecksumCheck {
+   const UINT8 *data;
+   UINTN size;
+   const ManifestEntry *entry;
+   bool passed;
+};
+
+void RunChecksumCheck(UINTN index, void *context) {
+   ChecksumCheck &check = ((ChecksumCheck *)context)[index];
+   check.passed = check.size == check.entry->size && Crc32c(check.data, check.size) == check.entry->crc;
+}
+
+/**
+ * @brief Checks a batch of regions against their manifest entries, spread across all processors.
+ * @param checks: The regions to check. Each has its passed member set.
+ * @param count: The number of regions.
+ *
+ * @return The index of the first region that failed, or count if all of them passed.
+ */
+UINTN RunChecksumChecks(ChecksumCheck *checks, UINTN count) {
+   UINTN totalSize = 0;
+   for (UINTN i = 0; i < count; i++) { totalSize += checks[i].size; }
+   ParallelFor(count, totalSize, RunChecksumCheck, checks);
+   for (UINTN i = 0; i < count; i++) {
+      if (!checks[i].passed) {
+         return i;
+      }
+   }
+   return count;
+}
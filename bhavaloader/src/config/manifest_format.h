@@ -0,0 +1,43 @@
+#pragma once
+
+/*
+ * bhava.sum is an optional binary file in the root of the boot volume, written by build.py. It holds the
+ * CRC32C of every loadable segment of the kernel and of every other boot module, so corruption on the way
+ * from the disk is caught before anything runs. All fields are little endian:
+ *
+ *    ManifestHeader, then entryCount ManifestEntry records.
+ *
+ * Kernel segments are checksummed over their file contents (p_filesz bytes) as they are in the
+ * uncompressed kernel, so a compressed kernel is checked after decompression. Any file without an entry is
+ * loaded unchecked.
+ *
+ * Only the format is described here. manifest.h reads and checks it.
+ */
+
+#define MANIFEST_FILE_NAME   L"bhava.sum"
+#define MANIFEST_MAGIC       0x4D555342  // "BSUM"
+#define MANIFEST_VERSION     1
+/** The segment value of an entry that covers a whole file rather than one kernel segment. */
+#define MANIFEST_WHOLE_FILE  0xFFFFFFFF
+#define MANIFEST_NAME_LENGTH 32
+
+struct ManifestHeader {
+   UINT32 magic;
+   UINT32 version;
+   UINT32 entryCount;
+   UINT32 reserved;
+};
+
+struct ManifestEntry {
+   /** The path of the file from the root of the volume, as null terminated ASCII. */
+   char name[MANIFEST_NAME_LENGTH];
+   /** The index of the kernel program header this entry covers, or MANIFEST_WHOLE_FILE. */
+   UINT32 segment;
+   UINT32 crc;
+   UINT64 size;
+};
+
+struct ChecksumManifest {
+   const ManifestEntry *entries;
+   UINTN entryCount;
+};
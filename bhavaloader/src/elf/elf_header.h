@@ -2,13 +2,18 @@
 #define EI_NIDENT 16
 #include "stdint.h"
 
-#define PT_LOAD 1
+#define PT_LOAD    1
+#define PT_DYNAMIC 2
+
+#define ET_EXEC 2
+#define ET_DYN  3
 
 typedef uint16_t Elf64_Half;
 typedef uint32_t Elf64_Word;
 typedef uint64_t Elf64_Addr;
 typedef uint64_t Elf64_Off;
 typedef uint64_t Elf64_Xword;
+typedef int64_t Elf64_Sxword;
 
 struct Elf64_Ehdr {
    unsigned char e_ident[EI_NIDENT];
@@ -51,5 +56,62 @@ typedef struct {
    Elf64_Xword sh_entsize;
 } Elf64_Shdr;
 
+#define SHT_SYMTAB     2
+#define SHT_STRTAB     3
 #define SHT_INIT_ARRAY 14
 #define SHT_FINI_ARRAY 15
+
+
+struct Elf64_Dyn {
+   Elf64_Sxword d_tag;
+   Elf64_Xword d_val;
+};
+
+#define DT_NULL         0
+#define DT_PLTRELSZ     2
+#define DT_SYMTAB       6
+#define DT_RELA         7
+#define DT_RELASZ       8
+#define DT_RELAENT      9
+#define DT_SYMENT       11
+#define DT_PLTREL       20
+#define DT_TEXTREL      22
+#define DT_JMPREL       23
+#define DT_INIT_ARRAY   25
+#define DT_FINI_ARRAY   26
+#define DT_INIT_ARRAYSZ 27
+#define DT_FINI_ARRAYSZ 28
+#define DT_RELRSZ       35
+#define DT_RELR         36
+#define DT_RELRENT      37
+
+struct Elf64_Rela {
+   Elf64_Addr r_offset;
+   Elf64_Xword r_info;
+   Elf64_Sxword r_addend;
+};
+
+#define ELF64_R_SYM(info)  ((info) >> 32)
+#define ELF64_R_TYPE(info) ((info)&0xFFFFFFFF)
+
+#define R_X86_64_NONE      0
+#define R_X86_64_64        1
+#define R_X86_64_GLOB_DAT  6
+#define R_X86_64_JUMP_SLOT 7
+#define R_X86_64_RELATIVE  8
+#define R_X86_64_IRELATIVE 37
+
+struct Elf64_Sym {
+   Elf64_Word st_name;
+   unsigned char st_info;
+   unsigned char st_other;
+   Elf64_Half st_shndx;
+   Elf64_Addr st_value;
+   Elf64_Xword st_size;
+};
+
+#define ELF64_ST_TYPE(info) ((info)&0xF)
+
+#define STT_FUNC 2
+
+#define SHN_UNDEF 0
\ No newline at end of file
@@ -0,0 +1,270 @@
+#pragma once
+#include "../mem/pages.h"
+#include "../util/print.h"
+#include "boot/bootinfo.h"
+#include "elf_header.h"
+
+/**
+ * @brief Translates a virtual kernel address in the kernel file to an actual address in UEFI memory.
+ *
+ * The kernel ELF file expects to be loaded at 0x400000, but we can not expect UEFI to have any specific
+ * address free for us, and the kernel is mapped into the higher half anyway. Instead we must calculate the
+ * actual offset in memory where the requested data is stored.
+ *
+ * @param kernelAddr: The address the start of the kernel image is mapped at.
+ * @param untranslatedAddr: The Address the ELF binary expects some data to be loaded at.
+ * @param vaddr: The base address the ELF binary expects to be loaded at (usually 0x400000).
+ *
+ * @return: The translated memory address where the data actually resides in memory on the system.
+ */
+EFI_PHYSICAL_ADDRESS TranslateKernelAddress(EFI_PHYSICAL_ADDRESS kernelAddr,
+                                            EFI_PHYSICAL_ADDRESS untranslatedAddr,
+                                            EFI_PHYSICAL_ADDRESS vaddr) {
+   return kernelAddr + untranslatedAddr - vaddr;
+}
+
+/**
+ * @brief Verify that a loaded file is a proper ELF64 executable file.
+ * @param The ELF header for the file you are verifying.
+ *
+ * @return True if the file header is correct, false otherwise.
+ */
+bool VerifyELFFile(Elf64_Ehdr header) {
+   if (header.e_ident[0] != 127 || header.e_ident[1] != 'E' || header.e_ident[2] != 'L' ||
+       header.e_ident[3] != 'F') {
+      println(
+         L"Loaded kernel file does not appear to be in the ELF format! This loader only supports ELF file "
+         L"format.");
+      return false;
+   }
+   if (header.e_ident[4] != 2) {
+      println(L"Loaded kernel file is not 64 bit. This loader only supports 64 bit kernels.");
+      return false;
+   }
+
+   return true;
+}
+
+/**
+ * @brief Gets a view of the ELF header of a kernel file that has been read into memory.
+ * @param kernelImage: Pointer to the beginning of the kernel file in memory.
+ * @param imageSize: The size of the kernel file, in bytes.
+ *
+ * @return A pointer to the ELF header inside kernelImage, or nullptr if the file is not a valid ELF64 file.
+ */
+Elf64_Ehdr *ParseELFHeader(UINT8 *kernelImage, UINTN imageSize) {
+   if (imageSize < sizeof(Elf64_Ehdr)) {
+      println(L"Loaded kernel file is too small to contain an ELF header.");
+      return nullptr;
+   }
+
+   Elf64_Ehdr *header = (Elf64_Ehdr *)kernelImage;
+   if (!VerifyELFFile(*header)) {
+      return nullptr;
+   }
+   return header;
+}
+
+/**
+ * @brief Gets a view of the program headers of a kernel file that has been read into memory.
+ * @param elfHeader: The header struct for the given kernel file.
+ * @param kernelImage: Pointer to the beginning of the kernel file in memory.
+ * @param imageSize: The size of the kernel file, in bytes.
+ *
+ * @return A pointer to the first element of an array of Program Headers, or null if the headers do not fit
+ * inside the file.
+ */
+Elf64_Phdr *ParseELFPHeader(const Elf64_Ehdr *elfHeader, UINT8 *kernelImage, UINTN imageSize) {
+   UINTN phsize = (UINTN)elfHeader->e_phentsize * elfHeader->e_phnum;
+   if (elfHeader->e_phentsize != sizeof(Elf64_Phdr) || elfHeader->e_phoff > imageSize ||
+       phsize > imageSize - elfHeader->e_phoff) {
+      println(L"Kernel program headers are malformed.");
+      return nullptr;
+   }
+   return (Elf64_Phdr *)(kernelImage + elfHeader->e_phoff);
+}
+
+/**
+ * @brief Gets a view of the section headers, if they exist, of a kernel file that has been read into memory.
+ * @param elfHeader: The header struct for the given kernel file.
+ * @param kernelImage: Pointer to the beginning of the kernel file in memory.
+ * @param imageSize: The size of the kernel file, in bytes.
+ *
+ * @return A pointer to the first element of an array of Section Headers, or null if there are no section
+ * headers.
+ */
+Elf64_Shdr *ParseELFSHeader(const Elf64_Ehdr *elfHeader, UINT8 *kernelImage, UINTN imageSize) {
+   if (elfHeader->e_shoff == 0) {
+      return nullptr;
+   }
+
+   UINTN shsize = (UINTN)elfHeader->e_shentsize * elfHeader->e_shnum;
+   if (elfHeader->e_shentsize != sizeof(Elf64_Shdr) || elfHeader->e_shoff > imageSize ||
+       shsize > imageSize - elfHeader->e_shoff) {
+      println(L"Kernel section headers are malformed.");
+      return nullptr;
+   }
+   return (Elf64_Shdr *)(kernelImage + elfHeader->e_shoff);
+}
+
+/**
+ * @brief Copies every PT_LOAD segment of a kernel file into a single 2MiB aligned physical reservation.
+ *
+ * Each segment is placed at the same offset from the start of the reservation as its virtual address is
+ * from the (2MiB rounded down) lowest segment address, so the whole image can later be mapped with large
+ * pages. The part of each segment past p_filesz (.bss) is zeroed here, so the kernel never sees whatever the
+ * firmware previously left in that memory.
+ * @param elfHeader: The header struct for the given kernel file.
+ * @param programHeaders: A pointer to the first element of the kernel's program header array.
+ * @param kernelImage: Pointer to the beginning of the kernel file in memory.
+ * @param imageSize: The size of the kernel file, in bytes.
+ * @param OUTlayout: Filled with the location of the loaded image.
+ *
+ * @return True if every segment was loaded, false otherwise.
+ */
+bool LoadKernelSegments(const Elf64_Ehdr *elfHeader, const Elf64_Phdr *programHeaders, UINT8 *kernelImage,
+                        UINTN imageSize, KernelImageLayout *OUTlayout) {
+   Elf64_Addr lowestAddr  = ~(Elf64_Addr)0;
+   Elf64_Addr highestAddr = 0;
+   for (int i = 0; i < elfHeader->e_phnum; i++) {
+      const Elf64_Phdr &segment = programHeaders[i];
+      if (segment.p_type != PT_LOAD) {
+         continue;
+      }
+      if (segment.p_offset > imageSize || segment.p_filesz > imageSize - segment.p_offset ||
+          segment.p_filesz > segment.p_memsz) {
+         println(L"Error: Kernel segment %d extends past the end of the kernel file!", i);
+         return false;
+      }
+      if (segment.p_vaddr < lowestAddr) {
+         lowestAddr = segment.p_vaddr;
+      }
+      if (segment.p_vaddr + segment.p_memsz > highestAddr) {
+         highestAddr = segment.p_vaddr + segment.p_memsz;
+      }
+   }
+   if (highestAddr == 0) {
+      println(L"Error: Kernel file has no loadable segments!");
+      return false;
+   }
+
+   Elf64_Addr vaddrBase = lowestAddr & ~(Elf64_Addr)(LARGE_PAGE_SIZE - 1);
+   UINTN reservedSize   = (highestAddr - vaddrBase + LARGE_PAGE_SIZE - 1) & ~(UINTN)(LARGE_PAGE_SIZE - 1);
+   EFI_PHYSICAL_ADDRESS physicalBase = AllocateAlignedPages(reservedSize / PAGE_SIZE, LARGE_PAGE_SIZE,
+                                                          LOADER_KERNEL_MEMORY);
+   if (physicalBase == 0) {
+      println(L"Error: Could not reserve %lu bytes of 2MiB aligned memory for the kernel!", reservedSize);
+      return false;
+   }
+
+   for (int i = 0; i < elfHeader->e_phnum; i++) {
+      const Elf64_Phdr &segment = programHeaders[i];
+      if (segment.p_type != PT_LOAD) {
+         continue;
+      }
+      UINT8 *destination = (UINT8 *)(physicalBase + (segment.p_vaddr - vaddrBase));
+      memcpy(destination, kernelImage + segment.p_offset, segment.p_filesz);
+      if (segment.p_memsz > segment.p_filesz) {
+         memset(destination + segment.p_filesz, 0, segment.p_memsz - segment.p_filesz);
+      }
+   }
+
+   *OUTlayout = {physicalBase, vaddrBase, reservedSize};
+   return true;
+}
+
+/**
+ * @brief Takes in an array of 8 little-endian bytes stored in a file and converts it to a 64-bit memory
+ * address.
+ * @param data: An array of 8 bytes to convert. Array is expected to be 8 bytes.
+ *
+ * @return A 64-bit address that was encoded in the bytes.
+ */
+EFI_PHYSICAL_ADDRESS ConvertLittleEndianBytesToAddr(UINT8 *data) {
+   return ((UINTN)(data[0] << 0) + ((UINTN)data[1] << 8) + ((UINTN)data[2] << 16) + ((UINTN)data[3] << 24) +
+           ((UINTN)data[4] << 32) + ((UINTN)data[5] << 40) + ((UINTN)data[6] << 48) + ((UINTN)data[7] << 56));
+}
+
+/**
+ * @brief Reads an array of kernel addresses (.init_array or .fini_array) from the kernel file and translates
+ * every entry to where the kernel was loaded.
+ * @param section: The section header of the array.
+ * @param kernelImage: Pointer to the beginning of the kernel file in memory.
+ * @param imageSize: The size of the kernel file, in bytes.
+ * @param kernelData: Pointer to the beginning of the loaded kernel in memory.
+ * @param vaddr: The base Address that the Elf File expects to be loaded at, for address conversion.
+ * @param OUTaddresses: Filled with the translated addresses, allocated from pool memory.
+ * @param OUTcount: Filled with the number of addresses.
+ *
+ * @return False if the array lies outside the kernel file or could not be allocated.
+ */
+bool ParseKernelAddressArray(const Elf64_Shdr &section, UINT8 *kernelImage, UINTN imageSize,
+                             UINT8 *kernelData, Elf64_Addr vaddr, EFI_PHYSICAL_ADDRESS **OUTaddresses,
+                             int *OUTcount) {
+   UINTN offset     = section.sh_offset;
+   UINTN bufferSize = section.sh_size;
+   if (offset > imageSize || bufferSize > imageSize - offset) {
+      println(L"Kernel section %s lies outside the kernel file.",
+              section.sh_type == SHT_INIT_ARRAY ? L".init_array" : L".fini_array");
+      return false;
+   }
+   EFI_PHYSICAL_ADDRESS *addresses = nullptr;
+   EFI_STATUS status = ST->BootServices->AllocatePool(LOADER_HANDOFF_MEMORY, bufferSize, (void **)&addresses);
+   if (status != EFI_SUCCESS) {
+      println(L"Error: Could not allocate %lu bytes for the kernel's global initializers.", bufferSize);
+      return false;
+   }
+   int count = bufferSize / 8;
+   for (int i = 0; i < count; i++) {
+      EFI_PHYSICAL_ADDRESS address = ConvertLittleEndianBytesToAddr(kernelImage + offset + 8 * i);
+      addresses[i]                 = TranslateKernelAddress((EFI_PHYSICAL_ADDRESS)kernelData, address, vaddr);
+   }
+   *OUTaddresses = addresses;
+   *OUTcount     = count;
+   return true;
+}
+
+/**
+ * @brief Parses the addresses of the global constructors and destructors needed for using global objects
+ * in a c++ kernel.
+ *
+ * @param headerArray: A pointer to the first element of an array of section headers.
+ * @param headerCount: The length of the header array.
+ * @param kernelImage: Pointer to the beginning of the kernel file in memory, used to read the arrays.
+ * @param imageSize: The size of the kernel file, in bytes.
+ * @param kernelData: Pointer to the beginning of the loaded kernel in memory.
+ * @param vaddr: The base Address that the Elf File expects to be loaded at, for address conversion.
+ *
+ * @return A GlobalInitializers Struct filled with addresses for constructors and destructors. Empty if an
+ * array lies outside the kernel file or could not be allocated.
+ */
+GlobalInitializers ParseGlobalInitializers(Elf64_Shdr *headerArray, int headerCount, UINT8 *kernelImage,
+                                           UINTN imageSize, UINT8 *kernelData, Elf64_Addr vaddr) {
+   EFI_PHYSICAL_ADDRESS *initArrayStart = nullptr;
+   EFI_PHYSICAL_ADDRESS *finiArrayStart = nullptr;
+   GlobalInitializers initializers {};
+   bool valid = true;
+   for (int i = 0; i < headerCount && valid; i++) {
+      // Only the first array of each kind counts, as the linker merges them into one.
+      if (headerArray[i].sh_type == SHT_INIT_ARRAY && !initArrayStart) {
+         valid = ParseKernelAddressArray(headerArray[i], kernelImage, imageSize, kernelData, vaddr,
+                                         &initArrayStart, &initializers.ctorCount);
+      }
+      if (headerArray[i].sh_type == SHT_FINI_ARRAY && !finiArrayStart) {
+         valid = ParseKernelAddressArray(headerArray[i], kernelImage, imageSize, kernelData, vaddr,
+                                         &finiArrayStart, &initializers.dtorCount);
+      }
+   }
+   if (!valid) {
+      if (initArrayStart) {
+         ST->BootServices->FreePool(initArrayStart);
+      }
+      if (finiArrayStart) {
+         ST->BootServices->FreePool(finiArrayStart);
+      }
+      return {};
+   }
+   initializers.ctorAddresses = initArrayStart;
+   initializers.dtorAddresses = finiArrayStart;
+   return initializers;
+}
@@ -0,0 +1,282 @@
+#pragma once
+#include "../mem/paging.h"
+#include "../util/mp.h"
+#include "elf_header.h"
+
+/** Everything the relocation engine needs from the kernel's dynamic section. Addresses are link-time. */
+struct KernelDynamicInfo {
+   Elf64_Addr rela;
+   UINTN relaSize;
+   UINTN relaEntrySize;
+   Elf64_Addr pltRela;
+   UINTN pltRelaSize;
+   Elf64_Addr relr;
+   UINTN relrSize;
+   Elf64_Addr symbolTable;
+   UINTN symbolEntrySize;
+   Elf64_Addr initArray;
+   UINTN initArraySize;
+   Elf64_Addr finiArray;
+   UINTN finiArraySize;
+};
+
+/** Why relocation processing stopped, for reporting to the user. */
+enum class RelocationError {
+   None,
+   MalformedDynamic,
+   OutOfBounds,
+   UnsupportedType,
+};
+
+/**
+ * @brief Gets a pointer to where a link-time kernel address ended up in the loaded image.
+ * @param layout: Where the kernel segments were loaded.
+ * @param vaddr: The link-time virtual address.
+ * @param size: The number of bytes that must be accessible starting at vaddr.
+ *
+ * @return A pointer into the loaded image, or nullptr if the range is not part of it.
+ */
+UINT8 *GetLoadedKernelPointer(const KernelImageLayout &layout, Elf64_Addr vaddr, UINTN size) {
+   if (vaddr < layout.vaddrBase || vaddr - layout.vaddrBase > layout.size ||
+       size > layout.size - (vaddr - layout.vaddrBase)) {
+      return nullptr;
+   }
+   return (UINT8 *)(layout.physicalBase + (vaddr - layout.vaddrBase));
+}
+
+/**
+ * @brief Reads the kernel's PT_DYNAMIC segment out of the loaded image.
+ * @param elfHeader: The header struct for the given kernel file.
+ * @param programHeaders: A pointer to the first element of the kernel's program header array.
+ * @param layout: Where the kernel segments were loaded.
+ * @param OUTinfo: Filled with the relocation tables and initializer arrays.
+ *
+ * @return False if the kernel has no dynamic segment, or it is malformed.
+ */
+bool ParseKernelDynamic(const Elf64_Ehdr *elfHeader, const Elf64_Phdr *programHeaders,
+                        const KernelImageLayout &layout, KernelDynamicInfo *OUTinfo) {
+   *OUTinfo = {};
+   for (int i = 0; i < elfHeader->e_phnum; i++) {
+      if (programHeaders[i].p_type != PT_DYNAMIC) {
+         continue;
+      }
+      Elf64_Dyn *dynamic =
+         (Elf64_Dyn *)GetLoadedKernelPointer(layout, programHeaders[i].p_vaddr, programHeaders[i].p_memsz);
+      if (!dynamic) {
+         return false;
+      }
+      UINTN count = programHeaders[i].p_memsz / sizeof(Elf64_Dyn);
+      for (UINTN j = 0; j < count && dynamic[j].d_tag != DT_NULL; j++) {
+         Elf64_Xword value = dynamic[j].d_val;
+         switch (dynamic[j].d_tag) {
+         case DT_RELA: OUTinfo->rela = value; break;
+         case DT_RELASZ: OUTinfo->relaSize = value; break;
+         case DT_RELAENT: OUTinfo->relaEntrySize = value; break;
+         case DT_JMPREL: OUTinfo->pltRela = value; break;
+         case DT_PLTRELSZ: OUTinfo->pltRelaSize = value; break;
+         case DT_RELR: OUTinfo->relr = value; break;
+         case DT_RELRSZ: OUTinfo->relrSize = value; break;
+         case DT_SYMTAB: OUTinfo->symbolTable = value; break;
+         case DT_SYMENT: OUTinfo->symbolEntrySize = value; break;
+         case DT_INIT_ARRAY: OUTinfo->initArray = value; break;
+         case DT_INIT_ARRAYSZ: OUTinfo->initArraySize = value; break;
+         case DT_FINI_ARRAY: OUTinfo->finiArray = value; break;
+         case DT_FINI_ARRAYSZ: OUTinfo->finiArraySize = value; break;
+         // Only RELA style relocations exist on x86_64.
+         case DT_PLTREL:
+            if (value != DT_RELA) {
+               return false;
+            }
+            break;
+         }
+      }
+      if (OUTinfo->relaEntrySize == 0) {
+         OUTinfo->relaEntrySize = sizeof(Elf64_Rela);
+      }
+      if (OUTinfo->symbolEntrySize == 0) {
+         OUTinfo->symbolEntrySize = sizeof(Elf64_Sym);
+      }
+      return OUTinfo->relaEntrySize == sizeof(Elf64_Rela) && OUTinfo->symbolEntrySize == sizeof(Elf64_Sym);
+   }
+   return false;
+}
+
+/**
+ * @brief Applies a run of RELA relocations.
+ * @param info: The kernel's dynamic information.
+ * @param layout: Where the kernel segments were loaded.
+ * @param loadBias: The difference between the address the kernel will run at and its link-time address.
+ * @param entries: The first relocation to apply.
+ * @param count: The number of relocations to apply.
+ * @param OUTcount: Incremented by the number of relocations applied.
+ *
+ * @return The reason processing stopped, RelocationError::None on success.
+ */
+RelocationError ApplyRelaEntries(const KernelDynamicInfo &info, const KernelImageLayout &layout,
+                                 UINT64 loadBias, const Elf64_Rela *entries, UINTN count, UINTN *OUTcount) {
+   for (UINTN i = 0; i < count; i++) {
+      const Elf64_Rela &rela = entries[i];
+      UINT32 type            = ELF64_R_TYPE(rela.r_info);
+      if (type == R_X86_64_NONE) {
+         continue;
+      }
+      UINT64 *target = (UINT64 *)GetLoadedKernelPointer(layout, rela.r_offset, sizeof(UINT64));
+      if (!target) {
+         return RelocationError::OutOfBounds;
+      }
+
+      // RELATIVE relocations make up nearly the entire table of a static PIE, so check for them first.
+      if (type == R_X86_64_RELATIVE) {
+         *target = loadBias + rela.r_addend;
+      } else if (type == R_X86_64_64 || type == R_X86_64_GLOB_DAT || type == R_X86_64_JUMP_SLOT) {
+         UINT64 symbolIndex   = ELF64_R_SYM(rela.r_info);
+         const Elf64_Sym *sym = (const Elf64_Sym *)GetLoadedKernelPointer(
+            layout, info.symbolTable + symbolIndex * sizeof(Elf64_Sym), sizeof(Elf64_Sym));
+         if (!sym) {
+            return RelocationError::OutOfBounds;
+         }
+         // There is nothing to link against, so an undefined symbol can only be an unresolved weak one.
+         UINT64 symbolValue = sym->st_shndx == SHN_UNDEF ? 0 : loadBias + sym->st_value;
+         *target            = symbolValue + (type == R_X86_64_64 ? rela.r_addend : 0);
+      } else {
+         // IRELATIVE would need us to run kernel code before the kernel is mapped.
+         return RelocationError::UnsupportedType;
+      }
+      (*OUTcount)++;
+   }
+   return RelocationError::None;
+}
+
+/** The number of RELA entries one processor applies at a time. */
+#define RELA_CHUNK_ENTRIES 0x1000
+
+/** Shared by every processor working on one RELA table. */
+struct RelaTableJob {
+   const KernelDynamicInfo *info;
+   const KernelImageLayout *layout;
+   UINT64 loadBias;
+   const Elf64_Rela *table;
+   UINTN count;
+   /** Both of these are updated atomically, since chunks finish on different processors. */
+   UINTN applied;
+   RelocationError error;
+};
+
+void ApplyRelaChunk(UINTN chunk, void *context) {
+   RelaTableJob *job     = (RelaTableJob *)context;
+   UINTN first           = chunk * RELA_CHUNK_ENTRIES;
+   UINTN count           = job->count - first < RELA_CHUNK_ENTRIES ? job->count - first : RELA_CHUNK_ENTRIES;
+   UINTN applied         = 0;
+   RelocationError error =
+      ApplyRelaEntries(*job->info, *job->layout, job->loadBias, job->table + first, count, &applied);
+   __atomic_fetch_add(&job->applied, applied, __ATOMIC_RELAXED);
+   if (error != RelocationError::None) {
+      RelocationError none = RelocationError::None;
+      __atomic_compare_exchange_n(&job->error, &none, error, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+   }
+}
+
+/**
+ * @brief Applies a table of RELA relocations. Every entry patches a different word, so the table is split
+ * into chunks that are applied on all processors at once.
+ * @param info: The kernel's dynamic information.
+ * @param layout: Where the kernel segments were loaded.
+ * @param loadBias: The difference between the address the kernel will run at and its link-time address.
+ * @param tableAddr: The link-time address of the relocation table.
+ * @param tableSize: The size of the relocation table in bytes.
+ * @param OUTcount: Incremented by the number of relocations applied.
+ *
+ * @return The reason processing stopped, RelocationError::None on success.
+ */
+RelocationError ApplyRelaTable(const KernelDynamicInfo &info, const KernelImageLayout &layout,
+                               UINT64 loadBias, Elf64_Addr tableAddr, UINTN tableSize, UINTN *OUTcount) {
+   if (tableSize == 0) {
+      return RelocationError::None;
+   }
+   const Elf64_Rela *table = (const Elf64_Rela *)GetLoadedKernelPointer(layout, tableAddr, tableSize);
+   if (!table) {
+      return RelocationError::MalformedDynamic;
+   }
+
+   RelaTableJob job = {&info, &layout, loadBias, table, tableSize / sizeof(Elf64_Rela), 0,
+                       RelocationError::None};
+   ParallelFor((job.count + RELA_CHUNK_ENTRIES - 1) / RELA_CHUNK_ENTRIES, tableSize, ApplyRelaChunk, &job);
+   *OUTcount += job.applied;
+   return job.error;
+}
+
+/**
+ * @brief Applies a table of packed RELR relative relocations (-z pack-relative-relocs). Bitmap entries
+ * continue from the address entry before them, so the table is walked sequentially.
+ * @param layout: Where the kernel segments were loaded.
+ * @param loadBias: The difference between the address the kernel will run at and its link-time address.
+ * @param tableAddr: The link-time address of the relocation table.
+ * @param tableSize: The size of the relocation table in bytes.
+ * @param OUTcount: Incremented by the number of relocations applied.
+ *
+ * @return The reason processing stopped, RelocationError::None on success.
+ */
+RelocationError ApplyRelrTable(const KernelImageLayout &layout, UINT64 loadBias, Elf64_Addr tableAddr,
+                               UINTN tableSize, UINTN *OUTcount) {
+   if (tableSize == 0) {
+      return RelocationError::None;
+   }
+   const UINT64 *table = (const UINT64 *)GetLoadedKernelPointer(layout, tableAddr, tableSize);
+   if (!table) {
+      return RelocationError::MalformedDynamic;
+   }
+
+   Elf64_Addr where = 0;
+   UINTN count      = tableSize / sizeof(UINT64);
+   for (UINTN i = 0; i < count; i++) {
+      UINT64 entry = table[i];
+      if ((entry & 1) == 0) {
+         // An address entry relocates one word and starts a new run.
+         UINT64 *target = (UINT64 *)GetLoadedKernelPointer(layout, entry, sizeof(UINT64));
+         if (!target) {
+            return RelocationError::OutOfBounds;
+         }
+         *target += loadBias;
+         (*OUTcount)++;
+         where = entry + sizeof(UINT64);
+      } else {
+         // A bitmap entry relocates up to 63 of the words following the previous run.
+         for (UINTN bit = 0; (entry >>= 1) != 0; bit++) {
+            if ((entry & 1) == 0) {
+               continue;
+            }
+            UINT64 *target =
+               (UINT64 *)GetLoadedKernelPointer(layout, where + bit * sizeof(UINT64), sizeof(UINT64));
+            if (!target) {
+               return RelocationError::OutOfBounds;
+            }
+            *target += loadBias;
+            (*OUTcount)++;
+         }
+         where += 63 * sizeof(UINT64);
+      }
+   }
+   return RelocationError::None;
+}
+
+/**
+ * @brief Relocates a loaded position independent kernel so it can run at a new address.
+ * @param info: The kernel's dynamic information.
+ * @param layout: Where the kernel segments were loaded.
+ * @param loadBias: The difference between the address the kernel will run at and its link-time address.
+ * @param OUTcount: Filled with the number of relocations applied.
+ *
+ * @return The reason processing stopped, RelocationError::None on success.
+ */
+RelocationError RelocateKernel(const KernelDynamicInfo &info, const KernelImageLayout &layout,
+                               UINT64 loadBias, UINTN *OUTcount) {
+   *OUTcount             = 0;
+   RelocationError error = ApplyRelrTable(layout, loadBias, info.relr, info.relrSize, OUTcount);
+   if (error == RelocationError::None) {
+      error = ApplyRelaTable(info, layout, loadBias, info.rela, info.relaSize, OUTcount);
+   }
+   if (error == RelocationError::None) {
+      error = ApplyRelaTable(info, layout, loadBias, info.pltRela, info.pltRelaSize, OUTcount);
+   }
+   return error;
+}
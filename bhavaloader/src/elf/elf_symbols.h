@@ -0,0 +1,174 @@
+#pragma once
+#include "../mem/paging.h"
+#include "boot/symbols.h"
+#include "elf_header.h"
+
+/**
+ * @brief Finds the symbol table of an ELF file and the string table its names are stored in.
+ * @param image: Pointer to the beginning of the ELF file in memory.
+ * @param imageSize: The size of the ELF file, in bytes.
+ * @param OUTsymbols: Filled with the first symbol.
+ * @param OUTsymbolCount: Filled with the number of symbols.
+ * @param OUTstrings: Filled with the start of the string table.
+ * @param OUTstringsSize: Filled with the size of the string table, in bytes.
+ *
+ * @return False if the file has no symbol table, or its section headers or symbol table are malformed.
+ */
+bool FindElfSymbolTable(const UINT8 *image, UINTN imageSize, const Elf64_Sym **OUTsymbols,
+                        UINTN *OUTsymbolCount, const char **OUTstrings, UINTN *OUTstringsSize) {
+   if (imageSize < sizeof(Elf64_Ehdr)) {
+      return false;
+   }
+   const Elf64_Ehdr *header = (const Elf64_Ehdr *)image;
+   UINTN sectionsSize       = (UINTN)header->e_shentsize * header->e_shnum;
+   if (header->e_shoff == 0 || header->e_shentsize != sizeof(Elf64_Shdr) || header->e_shoff > imageSize ||
+       sectionsSize > imageSize - header->e_shoff) {
+      return false;
+   }
+
+   const Elf64_Shdr *sections = (const Elf64_Shdr *)(image + header->e_shoff);
+   for (UINTN i = 0; i < header->e_shnum; i++) {
+      const Elf64_Shdr &symtab = sections[i];
+      if (symtab.sh_type != SHT_SYMTAB) {
+         continue;
+      }
+      if (symtab.sh_entsize != sizeof(Elf64_Sym) || symtab.sh_link >= header->e_shnum ||
+          symtab.sh_offset > imageSize || symtab.sh_size > imageSize - symtab.sh_offset) {
+         return false;
+      }
+      const Elf64_Shdr &strtab = sections[symtab.sh_link];
+      if (strtab.sh_type != SHT_STRTAB || strtab.sh_offset > imageSize ||
+          strtab.sh_size > imageSize - strtab.sh_offset || strtab.sh_size == 0) {
+         return false;
+      }
+      *OUTsymbols     = (const Elf64_Sym *)(image + symtab.sh_offset);
+      *OUTsymbolCount = symtab.sh_size / sizeof(Elf64_Sym);
+      *OUTstrings     = (const char *)(image + strtab.sh_offset);
+      *OUTstringsSize = strtab.sh_size;
+      return true;
+   }
+   return false;
+}
+
+/**
+ * @brief Checks whether a symbol names a function defined in the image, with a name that is properly null
+ * terminated inside the string table.
+ * @param OUTnameLength: Filled with the length of the name, without the null terminator.
+ */
+bool IsIndexableFunction(const Elf64_Sym &symbol, const char *strings, UINTN stringsSize,
+                         UINTN *OUTnameLength) {
+   if (ELF64_ST_TYPE(symbol.st_info) != STT_FUNC || symbol.st_shndx == SHN_UNDEF || symbol.st_value == 0 ||
+       symbol.st_name == 0 || symbol.st_name >= stringsSize) {
+      return false;
+   }
+   UINTN length = 0;
+   while (symbol.st_name + length < stringsSize && strings[symbol.st_name + length] != 0) { length++; }
+   if (symbol.st_name + length == stringsSize) {
+      return false;
+   }
+   *OUTnameLength = length;
+   return true;
+}
+
+/**
+ * @brief Restores the heap property for the subtree rooted at index start. Part of SortKernelSymbols().
+ */
+void SiftDownKernelSymbol(KernelSymbol *symbols, UINTN start, UINTN count) {
+   UINTN root = start;
+   while (2 * root + 1 < count) {
+      UINTN child = 2 * root + 1;
+      if (child + 1 < count && symbols[child + 1].address > symbols[child].address) {
+         child++;
+      }
+      if (symbols[root].address >= symbols[child].address) {
+         return;
+      }
+      KernelSymbol swap = symbols[root];
+      symbols[root]     = symbols[child];
+      symbols[child]    = swap;
+      root              = child;
+   }
+}
+
+/**
+ * @brief Sorts symbols by address. A heap sort, since it needs no extra memory and the symbol table order
+ * gives no useful presorting to exploit.
+ */
+void SortKernelSymbols(KernelSymbol *symbols, UINTN count) {
+   if (count < 2) {
+      return;
+   }
+   for (UINTN start = count / 2; start-- > 0;) { SiftDownKernelSymbol(symbols, start, count); }
+   for (UINTN end = count - 1; end > 0; end--) {
+      KernelSymbol swap = symbols[0];
+      symbols[0]        = symbols[end];
+      symbols[end]      = swap;
+      SiftDownKernelSymbol(symbols, 0, end);
+   }
+}
+
+/**
+ * @brief Builds the kernel symbol index from the symbol table of an ELF file.
+ *
+ * Only defined function symbols are kept. The index and the string pool share one allocation of handoff
+ * pages, with the pool directly after the sorted symbol array.
+ * @param image: Pointer to the beginning of the ELF file in memory. Either the kernel itself, or a symbol
+ * file such as the one objcopy --only-keep-debug produces, which has the same link-time addresses.
+ * @param imageSize: The size of the ELF file, in bytes.
+ * @param loadBias: Added to every link-time address to get the run-time address.
+ * @param OUTtable: Filled with the symbol index.
+ *
+ * @return False if the file has no usable symbol table or the index could not be allocated.
+ */
+bool BuildKernelSymbolTable(const UINT8 *image, UINTN imageSize, UINT64 loadBias,
+                            KernelSymbolTable *OUTtable) {
+   const Elf64_Sym *elfSymbols = nullptr;
+   UINTN elfSymbolCount        = 0;
+   const char *strings         = nullptr;
+   UINTN stringsSize           = 0;
+   if (!FindElfSymbolTable(image, imageSize, &elfSymbols, &elfSymbolCount, &strings, &stringsSize)) {
+      return false;
+   }
+
+   // Size everything up first, so the whole index fits into a single allocation.
+   UINTN functionCount = 0;
+   UINTN poolSize      = 0;
+   for (UINTN i = 0; i < elfSymbolCount; i++) {
+      UINTN nameLength = 0;
+      if (IsIndexableFunction(elfSymbols[i], strings, stringsSize, &nameLength)) {
+         functionCount++;
+         poolSize += nameLength + 1;
+      }
+   }
+   if (functionCount == 0 || poolSize > 0xFFFFFFFF) {
+      return false;
+   }
+
+   UINTN indexPages = (functionCount * sizeof(KernelSymbol) + poolSize + PAGE_SIZE - 1) / PAGE_SIZE;
+   EFI_PHYSICAL_ADDRESS indexAddress;
+   if (ST->BootServices->AllocatePages(AllocateAnyPages, LOADER_HANDOFF_MEMORY, indexPages, &indexAddress) !=
+       EFI_SUCCESS) {
+      return false;
+   }
+   KernelSymbol *symbols = (KernelSymbol *)indexAddress;
+   char *pool            = (char *)(symbols + functionCount);
+
+   UINTN symbolIndex = 0;
+   UINTN poolOffset  = 0;
+   for (UINTN i = 0; i < elfSymbolCount; i++) {
+      UINTN nameLength = 0;
+      if (!IsIndexableFunction(elfSymbols[i], strings, stringsSize, &nameLength)) {
+         continue;
+      }
+      KernelSymbol &symbol = symbols[symbolIndex++];
+      symbol.address       = elfSymbols[i].st_value + loadBias;
+      symbol.size          = elfSymbols[i].st_size > 0xFFFFFFFF ? 0 : (UINT32)elfSymbols[i].st_size;
+      symbol.nameOffset    = (UINT32)poolOffset;
+      memcpy(pool + poolOffset, strings + elfSymbols[i].st_name, nameLength + 1);
+      poolOffset += nameLength + 1;
+   }
+   SortKernelSymbols(symbols, functionCount);
+
+   *OUTtable = {symbols, functionCount, pool, poolSize};
+   return true;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include "../util/memcpy.h"
+#include "../util/mp.h"
+#include "psf.h"
+
+/**
+ * @brief Gets the number of masks a single glyph row occupies in the atlas. Rows are padded to a multiple
+ * of four masks so every row starts 16 byte aligned.
+ * @param glyphWidth: The width of a glyph in pixels.
+ *
+ * @return The row stride in masks.
+ */
+UINT32 GetGlyphAtlasRowStride(UINT32 glyphWidth) {
+   return (glyphWidth + 3) & ~3u;
+}
+
+/**
+ * @brief Gets the size of the glyph atlas for a font, in bytes.
+ * @param header: The PSF2 header of the font.
+ *
+ * @return The number of bytes BuildGlyphAtlas() will write.
+ */
+UINTN GetGlyphAtlasSize(const psf2_header *header) {
+   return (UINTN)header->length * header->height * GetGlyphAtlasRowStride(header->width) * sizeof(UINT32);
+}
+
+/** The number of glyphs one processor expands at a time. */
+#define GLYPH_ATLAS_CHUNK 64
+
+/**
+ * @brief Expands a range of PSF2 glyph bitmaps into their part of the atlas.
+ *
+ * PSF2 rows are stored as whole bytes, most significant bit first, so each row is (width + 7) / 8 bytes.
+ * Most pixels of a glyph are background, so the range is cleared in one go and only set pixels are written.
+ * @param header: The PSF2 header of the font.
+ * @param glyphData: The first glyph bitmap of the font.
+ * @param atlas: The start of the whole atlas.
+ * @param firstGlyph: The first glyph to expand.
+ * @param glyphCount: The number of glyphs to expand.
+ */
+void BuildGlyphAtlasRange(const psf2_header *header, const UINT8 *glyphData, UINT32 *atlas, UINT32 firstGlyph,
+                          UINT32 glyphCount) {
+   UINT32 rowStride    = GetGlyphAtlasRowStride(header->width);
+   UINT32 bytesPerRow  = (header->width + 7) / 8;
+   UINTN glyphStride   = (UINTN)header->height * rowStride;
+   UINT32 *glyphMasks  = atlas + firstGlyph * glyphStride;
+   const UINT8 *bitmap = glyphData + (UINTN)firstGlyph * header->charSize;
+   memset(glyphMasks, 0, glyphCount * glyphStride * sizeof(UINT32));
+   for (UINT32 glyph = 0; glyph < glyphCount; glyph++) {
+      UINT32 *rowMasks = glyphMasks;
+      for (UINT32 y = 0; y < header->height; y++) {
+         const UINT8 *row = bitmap + y * bytesPerRow;
+         for (UINT32 x = 0; x < header->width; x++) {
+            if (row[x / 8] & (0x80 >> (x % 8))) {
+               rowMasks[x] = 0xFFFFFFFF;
+            }
+         }
+         rowMasks += rowStride;
+      }
+      glyphMasks = rowMasks;
+      bitmap += header->charSize;
+   }
+}
+
+/** Shared by every processor building one glyph atlas. */
+struct GlyphAtlasJob {
+   const psf2_header *header;
+   const UINT8 *glyphData;
+   UINT32 *atlas;
+};
+
+void BuildGlyphAtlasChunk(UINTN chunk, void *context) {
+   GlyphAtlasJob *job = (GlyphAtlasJob *)context;
+   UINT32 firstGlyph  = (UINT32)chunk * GLYPH_ATLAS_CHUNK;
+   UINT32 remaining   = job->header->length - firstGlyph;
+   BuildGlyphAtlasRange(job->header, job->glyphData, job->atlas, firstGlyph,
+                        remaining < GLYPH_ATLAS_CHUNK ? remaining : GLYPH_ATLAS_CHUNK);
+}
+
+/**
+ * @brief Expands PSF2 glyph bitmaps into a render-ready atlas with one 32 bit mask per pixel. Glyphs are
+ * independent of each other, so chunks of them are expanded on all processors at once.
+ * @param header: The PSF2 header of the font.
+ * @param glyphData: The first glyph bitmap.
+ * @param atlas: The buffer to fill. Must be at least GetGlyphAtlasSize() bytes.
+ */
+void BuildGlyphAtlas(const psf2_header *header, const UINT8 *glyphData, UINT32 *atlas) {
+   GlyphAtlasJob job = {header, glyphData, atlas};
+   ParallelFor((header->length + GLYPH_ATLAS_CHUNK - 1) / GLYPH_ATLAS_CHUNK, GetGlyphAtlasSize(header),
+               BuildGlyphAtlasChunk, &job);
+}
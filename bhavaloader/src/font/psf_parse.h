@@ -0,0 +1,30 @@
+#pragma once
+#include "psf.h"
+
+/**
+ * @brief Gets a view of the header of a PSF2 file that has been read into memory.
+ * @param fontImage: Pointer to the beginning of the font file in memory.
+ * @param imageSize: The size of the font file, in bytes.
+ *
+ * @return A pointer to the PSF2 header inside fontImage, or nullptr if the file is too small to hold one.
+ */
+psf2_header *ParsePSF2Header(UINT8 *fontImage, UINTN imageSize) {
+   if (imageSize < sizeof(psf2_header)) {
+      return nullptr;
+   }
+   return (psf2_header *)fontImage;
+}
+
+/**
+ * @brief Verify that a loaded file is a PC Screen Font file of the right version.
+ * @param The PSF2 Header for the file you are verifying.
+ *
+ * @return True if the file header is correct.
+ */
+bool VerifyPSF2File(psf2_header header) {
+   if (header.magic[0] != 0x72 || header.magic[1] != 0xb5 || header.magic[2] != 0x4a ||
+       header.magic[3] != 0x86) {
+      return false;
+   }
+   return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+/** The longest single path component OpenBootVolumeFile() accepts, including the null terminator. */
+#define BOOT_VOLUME_MAX_COMPONENT 256
+
+/**
+ * An open session on the volume this loader was started from. The file system protocol and the volume root
+ * are opened once, and every file the loader needs is opened relative to that root.
+ */
+struct BootVolume {
+   EFI_HANDLE deviceHandle;
+   EFI_HANDLE imageHandle;
+   EFI_FILE_PROTOCOL *root;
+};
+
+/**
+ * @brief Opens the root directory of a volume.
+ * @param deviceHandle: The device handle that loaded this EFI image.
+ * @param imageHandle: The handle representing this EFI image.
+ * @param OUTvolume: Filled with the open session. Must be closed with CloseBootVolume().
+ *
+ * @return False if the device does not support the Simple File System protocol or its root could not be
+ * opened.
+ */
+bool OpenBootVolume(EFI_HANDLE deviceHandle, EFI_HANDLE imageHandle, BootVolume *OUTvolume) {
+   EFI_GUID simpleFileSystemProtocolGUID      = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_GUID;
+   EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *fileSystem = nullptr;
+   EFI_STATUS status = ST->BootServices->OpenProtocol(deviceHandle, &simpleFileSystemProtocolGUID,
+                                                      (void **)&fileSystem, imageHandle, nullptr, 0x00000001);
+   if (status != EFI_SUCCESS) {
+      return false;
+   }
+   EFI_FILE_PROTOCOL *root = nullptr;
+   if (fileSystem->OpenVolume(fileSystem, &root) != EFI_SUCCESS) {
+      ST->BootServices->CloseProtocol(deviceHandle, &simpleFileSystemProtocolGUID, imageHandle, nullptr);
+      return false;
+   }
+   *OUTvolume = {deviceHandle, imageHandle, root};
+   return true;
+}
+
+/**
+ * @brief Closes a session opened with OpenBootVolume(). Files opened through it stay open.
+ */
+void CloseBootVolume(BootVolume *volume) {
+   EFI_GUID simpleFileSystemProtocolGUID = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_GUID;
+   volume->root->Close(volume->root);
+   ST->BootServices->CloseProtocol(volume->deviceHandle, &simpleFileSystemProtocolGUID, volume->imageHandle,
+                                   nullptr);
+   volume->root = nullptr;
+}
+
+/**
+ * @brief Opens a file for reading by its path from the root of the volume.
+ *
+ * The path is walked one directory at a time rather than handed to the firmware whole, since not every file
+ * system driver resolves multi-component paths. Both '/' and '\' are accepted as separators, and leading,
+ * trailing or repeated separators are ignored.
+ * @param volume: The open volume.
+ * @param path: The null terminated path of the file.
+ *
+ * @return A handle to the file, or nullptr if any part of the path could not be opened.
+ */
+EFI_FILE_PROTOCOL *OpenBootVolumeFile(const BootVolume *volume, const CHAR16 *path) {
+   EFI_FILE_PROTOCOL *directory = volume->root;
+   EFI_FILE_PROTOCOL *file      = nullptr;
+   while (*path != 0) {
+      while (*path == L'/' || *path == L'\\') { path++; }
+      if (*path == 0) {
+         break;
+      }
+
+      CHAR16 component[BOOT_VOLUME_MAX_COMPONENT];
+      UINTN length = 0;
+      while (*path != 0 && *path != L'/' && *path != L'\\') {
+         if (length == BOOT_VOLUME_MAX_COMPONENT - 1) {
+            if (directory != volume->root) {
+               directory->Close(directory);
+            }
+            return nullptr;
+         }
+         component[length++] = *path++;
+      }
+      component[length] = 0;
+
+      file              = nullptr;
+      EFI_STATUS status = directory->Open(directory, &file, component, EFI_FILE_MODE_READ, 0);
+      // Intermediate directories are only needed until the next component is open.
+      if (directory != volume->root) {
+         directory->Close(directory);
+      }
+      if (status != EFI_SUCCESS) {
+         return nullptr;
+      }
+      directory = file;
+   }
+   if (file) {
+      file->SetPosition(file, 0);
+   }
+   return file;
+}
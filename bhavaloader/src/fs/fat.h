@@ -0,0 +1,555 @@
+#pragma once
+#include "../mem/memory_types.h"
+#include "../util/memcpy.h"
+#include "boot_volume.h"
+
+/*
+ * A read-only FAT12/16/32 reader that goes around the firmware file system driver. Files are resolved to
+ * their cluster runs once, and each run is then read with a single Block IO call straight into the
+ * destination buffer. The firmware driver reads through small internal buffers a cluster at a time, which
+ * is far slower for files of several megabytes.
+ *
+ * Only lookups and reads are supported. Anything unexpected makes the lookup or the read fail, so callers
+ * can fall back to the firmware driver.
+ */
+
+/** Files split into more pieces than this are left to the firmware driver. */
+#define FAT_MAX_RUNS       64
+/** The size of the window of the allocation table kept in memory while following cluster chains. */
+#define FAT_CACHE_SIZE     0x4000
+#define FAT_DIR_ENTRY_SIZE 32
+
+#define FAT_ATTR_VOLUME_ID  0x08
+#define FAT_ATTR_DIRECTORY  0x10
+#define FAT_ATTR_LONG_NAME  0x0F
+#define FAT_LAST_LONG_ENTRY 0x40
+#define FAT_DELETED_ENTRY   0xE5
+/** The number of name characters in a single long name entry. */
+#define FAT_LONG_NAME_CHARS 13
+
+enum class FatType {
+   Fat12,
+   Fat16,
+   Fat32,
+};
+
+/** A mounted FAT volume. All offsets are in bytes from the start of the partition. */
+struct FatVolume {
+   EFI_HANDLE deviceHandle;
+   EFI_HANDLE imageHandle;
+   EFI_BLOCK_IO_PROTOCOL *blockIo;
+   EFI_DISK_IO_PROTOCOL *diskIo;
+   UINT32 mediaId;
+   FatType type;
+   UINT32 clusterSize;
+   /** The number of the highest valid cluster. Cluster numbers start at 2. */
+   UINT32 maxCluster;
+   UINT64 fatOffset;
+   /** The offset of cluster 2. */
+   UINT64 dataOffset;
+   /** The first cluster of the root directory on FAT32, 0 on FAT12/16 where it has a fixed region instead. */
+   UINT32 rootCluster;
+   UINT64 rootDirOffset;
+   UINT32 rootDirSize;
+   /** Holds one cluster of a directory while it is searched. */
+   UINT8 *clusterBuffer;
+   /** Holds FAT_CACHE_SIZE bytes of the allocation table, starting at fatCacheOffset. */
+   UINT8 *fatCache;
+   UINT64 fatCacheOffset;
+   bool fatCacheValid;
+};
+
+/** A physically contiguous piece of a file. */
+struct FatRun {
+   UINT64 offset;
+   UINT64 size;
+};
+
+/** A file resolved to where its data is on the disk. The runs cover exactly size bytes. */
+struct FatFile {
+   UINT32 size;
+   UINTN runCount;
+   FatRun runs[FAT_MAX_RUNS];
+};
+
+/** What a directory search found. */
+struct FatDirEntry {
+   UINT32 firstCluster;
+   UINT32 size;
+   bool isDirectory;
+};
+
+UINT16 FatReadLE16(const UINT8 *data) {
+   return (UINT16)(data[0] | (data[1] << 8));
+}
+
+UINT32 FatReadLE32(const UINT8 *data) {
+   return (UINT32)data[0] | ((UINT32)data[1] << 8) | ((UINT32)data[2] << 16) | ((UINT32)data[3] << 24);
+}
+
+bool FatReadBytes(const FatVolume *volume, UINT64 offset, UINTN size, void *buffer) {
+   return volume->diskIo->ReadDisk(volume->diskIo, volume->mediaId, offset, size, buffer) == EFI_SUCCESS;
+}
+
+/**
+ * @brief Releases everything MountFatVolume() set up.
+ */
+void UnmountFatVolume(FatVolume *volume) {
+   EFI_GUID blockIoProtocolGUID = EFI_BLOCK_IO_PROTOCOL_GUID;
+   EFI_GUID diskIoProtocolGUID  = EFI_DISK_IO_PROTOCOL_GUID;
+   if (volume->clusterBuffer) {
+      ST->BootServices->FreePool(volume->clusterBuffer);
+   }
+   if (volume->fatCache) {
+      ST->BootServices->FreePool(volume->fatCache);
+   }
+   ST->BootServices->CloseProtocol(volume->deviceHandle, &blockIoProtocolGUID, volume->imageHandle, nullptr);
+   ST->BootServices->CloseProtocol(volume->deviceHandle, &diskIoProtocolGUID, volume->imageHandle, nullptr);
+   *volume = {};
+}
+
+/**
+ * @brief Reads the boot sector of a partition and, if it holds a FAT file system, prepares it for reading.
+ * @param deviceHandle: The partition, usually the device handle that loaded this EFI image.
+ * @param imageHandle: The handle representing this EFI image.
+ * @param OUTvolume: Filled with the mounted volume. Must be released with UnmountFatVolume().
+ *
+ * @return False if the partition has no Block IO or Disk IO protocol, or is not formatted as FAT.
+ */
+bool MountFatVolume(EFI_HANDLE deviceHandle, EFI_HANDLE imageHandle, FatVolume *OUTvolume) {
+   EFI_GUID blockIoProtocolGUID = EFI_BLOCK_IO_PROTOCOL_GUID;
+   EFI_GUID diskIoProtocolGUID  = EFI_DISK_IO_PROTOCOL_GUID;
+   *OUTvolume                   = {};
+   OUTvolume->deviceHandle      = deviceHandle;
+   OUTvolume->imageHandle       = imageHandle;
+   if (ST->BootServices->OpenProtocol(deviceHandle, &blockIoProtocolGUID, (void **)&OUTvolume->blockIo,
+                                      imageHandle, nullptr, 0x00000001) != EFI_SUCCESS ||
+       ST->BootServices->OpenProtocol(deviceHandle, &diskIoProtocolGUID, (void **)&OUTvolume->diskIo,
+                                      imageHandle, nullptr, 0x00000001) != EFI_SUCCESS ||
+       !OUTvolume->blockIo->Media->MediaPresent) {
+      UnmountFatVolume(OUTvolume);
+      return false;
+   }
+   OUTvolume->mediaId = OUTvolume->blockIo->Media->MediaId;
+
+   UINT8 bootSector[512];
+   if (!FatReadBytes(OUTvolume, 0, sizeof(bootSector), bootSector) || bootSector[510] != 0x55 ||
+       bootSector[511] != 0xAA) {
+      UnmountFatVolume(OUTvolume);
+      return false;
+   }
+   UINT32 bytesPerSector    = FatReadLE16(bootSector + 11);
+   UINT32 sectorsPerCluster = bootSector[13];
+   UINT32 reservedSectors   = FatReadLE16(bootSector + 14);
+   UINT32 fatCount          = bootSector[16];
+   UINT32 rootEntryCount    = FatReadLE16(bootSector + 17);
+   UINT32 totalSectors      = FatReadLE16(bootSector + 19);
+   UINT32 fatSectors        = FatReadLE16(bootSector + 22);
+   if (totalSectors == 0) {
+      totalSectors = FatReadLE32(bootSector + 32);
+   }
+   if (fatSectors == 0) {
+      fatSectors = FatReadLE32(bootSector + 36);
+   }
+   // Both sizes are powers of two, and a cluster is at most 64KiB.
+   if (bytesPerSector < 512 || bytesPerSector > 4096 || (bytesPerSector & (bytesPerSector - 1)) != 0 ||
+       sectorsPerCluster == 0 || (sectorsPerCluster & (sectorsPerCluster - 1)) != 0 ||
+       bytesPerSector * sectorsPerCluster > 0x10000 || reservedSectors == 0 || fatCount == 0 ||
+       fatSectors == 0) {
+      UnmountFatVolume(OUTvolume);
+      return false;
+   }
+
+   UINT32 rootDirSectors = (rootEntryCount * FAT_DIR_ENTRY_SIZE + bytesPerSector - 1) / bytesPerSector;
+   UINT64 metaSectors    = reservedSectors + (UINT64)fatCount * fatSectors + rootDirSectors;
+   if (metaSectors >= totalSectors) {
+      UnmountFatVolume(OUTvolume);
+      return false;
+   }
+   UINT32 clusterCount = (UINT32)((totalSectors - metaSectors) / sectorsPerCluster);
+
+   // The FAT type follows from the cluster count alone, no matter what the label in the boot sector says.
+   OUTvolume->type        = clusterCount < 4085 ? FatType::Fat12
+                            : clusterCount < 65525 ? FatType::Fat16
+                                                   : FatType::Fat32;
+   OUTvolume->clusterSize = bytesPerSector * sectorsPerCluster;
+   OUTvolume->maxCluster  = clusterCount + 1;
+   OUTvolume->fatOffset   = (UINT64)reservedSectors * bytesPerSector;
+   OUTvolume->dataOffset  = metaSectors * bytesPerSector;
+   if (OUTvolume->type == FatType::Fat32) {
+      OUTvolume->rootCluster = FatReadLE32(bootSector + 44);
+   } else {
+      OUTvolume->rootDirOffset = OUTvolume->fatOffset + (UINT64)fatCount * fatSectors * bytesPerSector;
+      OUTvolume->rootDirSize   = rootEntryCount * FAT_DIR_ENTRY_SIZE;
+   }
+
+   if (ST->BootServices->AllocatePool(LOADER_SCRATCH_MEMORY, OUTvolume->clusterSize,
+                                      (void **)&OUTvolume->clusterBuffer) != EFI_SUCCESS ||
+       ST->BootServices->AllocatePool(LOADER_SCRATCH_MEMORY, FAT_CACHE_SIZE,
+                                      (void **)&OUTvolume->fatCache) != EFI_SUCCESS) {
+      UnmountFatVolume(OUTvolume);
+      return false;
+   }
+   return true;
+}
+
+/**
+ * @brief Reads a single byte of the allocation table through the cache.
+ */
+bool FatReadTableByte(FatVolume *volume, UINT64 index, UINT8 *OUTbyte) {
+   if (!volume->fatCacheValid || index < volume->fatCacheOffset ||
+       index - volume->fatCacheOffset >= FAT_CACHE_SIZE) {
+      volume->fatCacheOffset = index & ~(UINT64)(FAT_CACHE_SIZE - 1);
+      volume->fatCacheValid  = FatReadBytes(volume, volume->fatOffset + volume->fatCacheOffset,
+                                            FAT_CACHE_SIZE, volume->fatCache);
+      if (!volume->fatCacheValid) {
+         return false;
+      }
+   }
+   *OUTbyte = volume->fatCache[index - volume->fatCacheOffset];
+   return true;
+}
+
+/**
+ * @brief Looks up the cluster following another in its chain.
+ * @param volume: The mounted volume.
+ * @param cluster: A valid cluster number.
+ * @param OUTnext: Filled with the next cluster, or 0 if cluster is the last of its chain.
+ *
+ * @return False if the table could not be read or the chain leads somewhere invalid.
+ */
+bool FatGetNextCluster(FatVolume *volume, UINT32 cluster, UINT32 *OUTnext) {
+   UINT64 index = 0;
+   UINTN width  = 0;
+   switch (volume->type) {
+   case FatType::Fat12:
+      index = cluster + cluster / 2;
+      width = 2;
+      break;
+   case FatType::Fat16:
+      index = (UINT64)cluster * 2;
+      width = 2;
+      break;
+   case FatType::Fat32:
+      index = (UINT64)cluster * 4;
+      width = 4;
+      break;
+   }
+   // Entries are read a byte at a time, since FAT12 entries may straddle the edge of the cache window.
+   UINT32 entry = 0;
+   for (UINTN i = 0; i < width; i++) {
+      UINT8 byte;
+      if (!FatReadTableByte(volume, index + i, &byte)) {
+         return false;
+      }
+      entry |= (UINT32)byte << (8 * i);
+   }
+
+   UINT32 endOfChain = 0;
+   switch (volume->type) {
+   case FatType::Fat12:
+      entry      = (cluster & 1) ? entry >> 4 : entry & 0xFFF;
+      endOfChain = 0xFF8;
+      break;
+   case FatType::Fat16: endOfChain = 0xFFF8; break;
+   case FatType::Fat32:
+      entry &= 0x0FFFFFFF;
+      endOfChain = 0x0FFFFFF8;
+      break;
+   }
+   if (entry >= endOfChain) {
+      *OUTnext = 0;
+      return true;
+   }
+   if (entry < 2 || entry > volume->maxCluster) {
+      return false;
+   }
+   *OUTnext = entry;
+   return true;
+}
+
+UINT64 FatGetClusterOffset(const FatVolume *volume, UINT32 cluster) {
+   return volume->dataOffset + (UINT64)(cluster - 2) * volume->clusterSize;
+}
+
+CHAR16 FatFoldCase(CHAR16 c) {
+   return c >= L'a' && c <= L'z' ? (CHAR16)(c - L'a' + L'A') : c;
+}
+
+/**
+ * @brief Compares a name from a directory entry to a path component, ignoring ASCII case like FAT does.
+ */
+bool FatNamesEqual(const CHAR16 *name, UINTN nameLength, const CHAR16 *component, UINTN componentLength) {
+   if (nameLength != componentLength) {
+      return false;
+   }
+   for (UINTN i = 0; i < nameLength; i++) {
+      if (FatFoldCase(name[i]) != FatFoldCase(component[i])) {
+         return false;
+      }
+   }
+   return true;
+}
+
+/**
+ * @brief Turns the padded 8.3 name of a directory entry into its usual NAME.EXT form.
+ * @param entry: The directory entry.
+ * @param OUTname: Filled with the name. Must hold at least 12 characters.
+ *
+ * @return The length of the name.
+ */
+UINTN FatGetShortName(const UINT8 *entry, CHAR16 *OUTname) {
+   UINTN length = 0;
+   for (UINTN i = 0; i < 8 && entry[i] != ' '; i++) {
+      // 0x05 stands in for a real 0xE5 as the first character, since that marks deleted entries.
+      OUTname[length++] = (i == 0 && entry[i] == 0x05) ? 0xE5 : entry[i];
+   }
+   if (entry[8] != ' ') {
+      OUTname[length++] = L'.';
+      for (UINTN i = 8; i < 11 && entry[i] != ' '; i++) { OUTname[length++] = entry[i]; }
+   }
+   return length;
+}
+
+/**
+ * @brief Computes the checksum of an 8.3 name that ties long name entries to their short entry.
+ */
+UINT8 FatShortNameChecksum(const UINT8 *entry) {
+   UINT8 sum = 0;
+   for (UINTN i = 0; i < 11; i++) { sum = (UINT8)(((sum & 1) << 7) + (sum >> 1) + entry[i]); }
+   return sum;
+}
+
+/** Gathers a long name from the entries before the short entry it belongs to. */
+struct FatLongName {
+   CHAR16 name[BOOT_VOLUME_MAX_COMPONENT];
+   UINTN length;
+   UINT8 checksum;
+   /** The sequence number the next entry must have for the name to stay intact, 0 once complete. */
+   UINT8 expected;
+   bool valid;
+};
+
+/**
+ * @brief Feeds a long name entry into a long name being gathered. Long name entries are stored last part
+ * first, directly before the short entry.
+ */
+void FatAddLongNameEntry(FatLongName *longName, const UINT8 *entry) {
+   static const UINT8 charOffsets[FAT_LONG_NAME_CHARS] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+   UINT8 sequence                                      = entry[0] & 0x1F;
+   if (entry[0] & FAT_LAST_LONG_ENTRY) {
+      longName->valid    = sequence != 0 && sequence * FAT_LONG_NAME_CHARS < BOOT_VOLUME_MAX_COMPONENT;
+      longName->length   = 0;
+      longName->checksum = entry[13];
+   } else if (!longName->valid || sequence == 0 || sequence != longName->expected ||
+              entry[13] != longName->checksum) {
+      longName->valid = false;
+   }
+   if (!longName->valid) {
+      return;
+   }
+   longName->expected = sequence - 1;
+
+   UINTN position = (UINTN)(sequence - 1) * FAT_LONG_NAME_CHARS;
+   for (UINTN i = 0; i < FAT_LONG_NAME_CHARS; i++) {
+      CHAR16 c = FatReadLE16(entry + charOffsets[i]);
+      if (c == 0 || c == 0xFFFF) {
+         break;
+      }
+      longName->name[position + i] = c;
+      if (position + i + 1 > longName->length) {
+         longName->length = position + i + 1;
+      }
+   }
+}
+
+/**
+ * @brief Searches a run of directory entries for a name.
+ * @param entries: The directory entries.
+ * @param size: The size of the run in bytes.
+ * @param longName: The long name gathered so far. Long names may continue across clusters.
+ * @param OUTentry: Filled with the entry if it is found.
+ * @param OUTend: Set to true if the end of the directory was reached.
+ *
+ * @return True if the entry was found.
+ */
+bool FatSearchEntries(const UINT8 *entries, UINTN size, const CHAR16 *component, UINTN componentLength,
+                      FatLongName *longName, FatDirEntry *OUTentry, bool *OUTend) {
+   for (UINTN offset = 0; offset + FAT_DIR_ENTRY_SIZE <= size; offset += FAT_DIR_ENTRY_SIZE) {
+      const UINT8 *entry = entries + offset;
+      UINT8 attributes   = entry[11];
+      if (entry[0] == 0) {
+         *OUTend = true;
+         return false;
+      }
+      if (entry[0] == FAT_DELETED_ENTRY) {
+         longName->valid = false;
+         continue;
+      }
+      if ((attributes & FAT_ATTR_LONG_NAME) == FAT_ATTR_LONG_NAME) {
+         FatAddLongNameEntry(longName, entry);
+         continue;
+      }
+
+      bool hasLongName = longName->valid && longName->expected == 0 &&
+                         longName->checksum == FatShortNameChecksum(entry);
+      longName->valid  = false;
+      if (attributes & FAT_ATTR_VOLUME_ID) {
+         continue;
+      }
+      CHAR16 shortName[12];
+      UINTN shortLength = FatGetShortName(entry, shortName);
+      if ((hasLongName && FatNamesEqual(longName->name, longName->length, component, componentLength)) ||
+          FatNamesEqual(shortName, shortLength, component, componentLength)) {
+         OUTentry->firstCluster = ((UINT32)FatReadLE16(entry + 20) << 16) | FatReadLE16(entry + 26);
+         OUTentry->size         = FatReadLE32(entry + 28);
+         OUTentry->isDirectory  = (attributes & FAT_ATTR_DIRECTORY) != 0;
+         return true;
+      }
+   }
+   return false;
+}
+
+/**
+ * @brief Finds an entry in a directory by name.
+ * @param volume: The mounted volume.
+ * @param directoryCluster: The first cluster of the directory, or 0 for the FAT12/16 root directory.
+ * @param component: The name to look for. Not null terminated.
+ * @param componentLength: The length of the name.
+ * @param OUTentry: Filled with the entry.
+ *
+ * @return False if there is no such entry or the directory could not be read.
+ */
+bool FatFindEntry(FatVolume *volume, UINT32 directoryCluster, const CHAR16 *component, UINTN componentLength,
+                  FatDirEntry *OUTentry) {
+   FatLongName longName;
+   longName.valid = false;
+   bool end       = false;
+   if (directoryCluster == 0) {
+      // The fixed root directory is small, so it is searched in cluster sized pieces like any other.
+      for (UINT32 offset = 0; offset < volume->rootDirSize && !end; offset += volume->clusterSize) {
+         UINT32 size = volume->rootDirSize - offset;
+         size        = size < volume->clusterSize ? size : volume->clusterSize;
+         if (!FatReadBytes(volume, volume->rootDirOffset + offset, size, volume->clusterBuffer)) {
+            return false;
+         }
+         if (FatSearchEntries(volume->clusterBuffer, size, component, componentLength, &longName, OUTentry,
+                              &end)) {
+            return true;
+         }
+      }
+      return false;
+   }
+
+   // Directories can only loop back on themselves if the volume is corrupt, but that must not hang the boot.
+   UINT32 cluster = directoryCluster;
+   for (UINT32 visited = 0; cluster != 0 && !end && visited <= volume->maxCluster; visited++) {
+      if (cluster < 2 || cluster > volume->maxCluster ||
+          !FatReadBytes(volume, FatGetClusterOffset(volume, cluster), volume->clusterSize,
+                        volume->clusterBuffer)) {
+         return false;
+      }
+      if (FatSearchEntries(volume->clusterBuffer, volume->clusterSize, component, componentLength, &longName,
+                           OUTentry, &end)) {
+         return true;
+      }
+      if (!FatGetNextCluster(volume, cluster, &cluster)) {
+         return false;
+      }
+   }
+   return false;
+}
+
+/**
+ * @brief Resolves a file to the runs of clusters its data is stored in.
+ *
+ * The path is walked the same way OpenBootVolumeFile() walks it, so both paths accept the same names.
+ * @param volume: The mounted volume.
+ * @param path: The null terminated path of the file.
+ * @param OUTfile: Filled with the size and runs of the file.
+ *
+ * @return False if the file does not exist, is empty, or is split into more than FAT_MAX_RUNS runs.
+ */
+bool FatOpenFile(FatVolume *volume, const CHAR16 *path, FatFile *OUTfile) {
+   FatDirEntry entry = {volume->rootCluster, 0, true};
+   while (*path != 0) {
+      while (*path == L'/' || *path == L'\\') { path++; }
+      if (*path == 0) {
+         break;
+      }
+      const CHAR16 *component = path;
+      while (*path != 0 && *path != L'/' && *path != L'\\') { path++; }
+      if (!entry.isDirectory ||
+          !FatFindEntry(volume, entry.firstCluster, component, path - component, &entry)) {
+         return false;
+      }
+      // ".." entries leading back to the root record cluster 0, even on FAT32.
+      if (entry.isDirectory && entry.firstCluster == 0) {
+         entry.firstCluster = volume->rootCluster;
+      }
+   }
+   if (entry.isDirectory || entry.size == 0) {
+      return false;
+   }
+
+   OUTfile->size     = entry.size;
+   OUTfile->runCount = 0;
+   UINT64 remaining  = entry.size;
+   UINT32 cluster    = entry.firstCluster;
+   while (remaining > 0) {
+      if (cluster < 2 || cluster > volume->maxCluster) {
+         return false;
+      }
+      UINT64 offset = FatGetClusterOffset(volume, cluster);
+      UINT64 size   = remaining < volume->clusterSize ? remaining : volume->clusterSize;
+      FatRun *last  = OUTfile->runCount > 0 ? &OUTfile->runs[OUTfile->runCount - 1] : nullptr;
+      if (last && last->offset + last->size == offset) {
+         last->size += size;
+      } else if (OUTfile->runCount < FAT_MAX_RUNS) {
+         OUTfile->runs[OUTfile->runCount++] = {offset, size};
+      } else {
+         return false;
+      }
+      remaining -= size;
+      if (remaining > 0 && (!FatGetNextCluster(volume, cluster, &cluster) || cluster == 0)) {
+         return false;
+      }
+   }
+   return true;
+}
+
+/**
+ * @brief Reads a resolved file into a buffer.
+ *
+ * Wherever the disk and the buffer allow, each run goes out as one Block IO read straight into the buffer.
+ * Disk IO picks up whatever does not line up with the device blocks.
+ * @param volume: The mounted volume.
+ * @param file: The file, as resolved by FatOpenFile().
+ * @param buffer: The buffer to read into. Must hold at least file->size bytes.
+ *
+ * @return False if any part of the file could not be read. The buffer may then hold part of the file, and
+ * the caller can read it again through the firmware driver.
+ */
+bool FatReadFile(const FatVolume *volume, const FatFile *file, UINT8 *buffer) {
+   UINT32 blockSize = volume->blockIo->Media->BlockSize;
+   UINT32 ioAlign   = volume->blockIo->Media->IoAlign;
+   for (UINTN i = 0; i < file->runCount; i++) {
+      UINT64 offset = file->runs[i].offset;
+      UINT64 size   = file->runs[i].size;
+      UINT64 blocks = 0;
+      if (blockSize != 0 && offset % blockSize == 0 && (ioAlign <= 1 || (UINTN)buffer % ioAlign == 0)) {
+         blocks = size / blockSize * blockSize;
+      }
+      if (blocks > 0) {
+         if (volume->blockIo->ReadBlocks(volume->blockIo, volume->mediaId, offset / blockSize, blocks,
+                                         buffer) != EFI_SUCCESS) {
+            return false;
+         }
+      }
+      if (size > blocks && !FatReadBytes(volume, offset + blocks, size - blocks, buffer + blocks)) {
+         return false;
+      }
+      buffer += size;
+   }
+   return true;
+}
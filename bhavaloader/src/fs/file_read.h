@@ -0,0 +1,127 @@
+#pragma once
+#include "../mem/pages.h"
+#include "../util/print.h"
+
+/** @brief Gets the size of a file specified by a given file handle, in bytes.
+ * @param fileHandle: The file to query.
+ *
+ * @return The size of the file in bytes. Returns 0 if the filesize could not be determined.
+ */
+UINTN GetFileSize(EFI_FILE_PROTOCOL *fileHandle) {
+   UINTN fileSize = 0;
+   // We first allocate a pool of 1 byte so that GetInfo() can return us the correct size in bytes the buffer
+   // needs to be.
+   UINTN bufferSize     = 1;
+   EFI_MEMORY_TYPE type = LOADER_SCRATCH_MEMORY;
+   void *buffer         = nullptr;
+   ST->BootServices->AllocatePool(type, bufferSize, &buffer);
+   EFI_GUID fileInfoGUID = EFI_FILE_INFO_ID;
+   fileHandle->GetInfo(fileHandle, &fileInfoGUID, &bufferSize, (void **)buffer);
+
+   // Now that we know the correct number of bytes we have to allocate, we can get the file information.
+   ST->BootServices->FreePool(buffer);
+   ST->BootServices->AllocatePool(type, bufferSize, &buffer);
+   EFI_STATUS st = fileHandle->GetInfo(fileHandle, &fileInfoGUID, &bufferSize, (void **)buffer);
+   if (st != EFI_SUCCESS) {
+      println(L"Error! Could not allocate memory for GetInfo()!");
+      ST->BootServices->FreePool(buffer);
+      return 0;
+   }
+   fileSize = ((EFI_FILE_INFO *)buffer)->FileSize;
+   ST->BootServices->FreePool(buffer);
+   return fileSize;
+}
+
+/** The state of a whole-file read that may still be in flight. */
+struct FileRead {
+   EFI_FILE_PROTOCOL *fileHandle;
+   UINT8 *buffer;
+   UINTN fileSize;
+   /** Only used if the read was issued through ReadEx(). */
+   EFI_FILE_IO_TOKEN token;
+   bool isAsync;
+   bool failed;
+};
+
+/**
+ * @brief Starts reading an entire file into a buffer with a single firmware read call.
+ *
+ * Every call into the firmware file system driver is expensive, so rather than seeking back and forth to
+ * pick out individual headers, we pull the whole file into memory once and parse it from there. If the file
+ * protocol is revision 2 or later, the read is issued through ReadEx() so the caller can get other work done
+ * while the firmware completes it. Otherwise, the file is read synchronously before returning.
+ * @param fileHandle: Handle to the opened file. Must stay open until FinishFileRead() is called.
+ * @param buffer: The buffer to read into. Must hold at least fileSize bytes.
+ * @param fileSize: The size of the file in bytes, as returned by GetFileSize().
+ * @param OUTread: Filled with the state of the read, to be passed to FinishFileRead().
+ */
+void BeginFileRead(EFI_FILE_PROTOCOL *fileHandle, UINT8 *buffer, UINTN fileSize, FileRead *OUTread) {
+   *OUTread = {fileHandle, buffer, fileSize, {}, false, false};
+   fileHandle->SetPosition(fileHandle, 0);
+
+   if (fileHandle->Revision >= EFI_FILE_PROTOCOL_REVISION2 &&
+       ST->BootServices->CreateEvent(0, 0, nullptr, nullptr, &OUTread->token.Event) == EFI_SUCCESS) {
+      OUTread->token.BufferSize = fileSize;
+      OUTread->token.Buffer     = buffer;
+      if (fileHandle->ReadEx(fileHandle, &OUTread->token) == EFI_SUCCESS) {
+         OUTread->isAsync = true;
+         return;
+      }
+      // Some drivers report revision 2 but do not implement the asynchronous calls.
+      ST->BootServices->CloseEvent(OUTread->token.Event);
+   }
+
+   UINTN readSize    = fileSize;
+   EFI_STATUS status = fileHandle->Read(fileHandle, &readSize, buffer);
+   OUTread->failed   = status != EFI_SUCCESS || readSize != fileSize;
+   if (OUTread->failed) {
+      println(L"Error! Read only %lu of %lu bytes from file.", readSize, fileSize);
+   }
+}
+
+/**
+ * @brief Waits for a read started by BeginFileRead() to complete.
+ * @param read: The state of the read.
+ *
+ * @return True if the whole file was read into the buffer.
+ */
+bool FinishFileRead(FileRead *read) {
+   if (read->isAsync) {
+      UINTN eventIndex = 0;
+      ST->BootServices->WaitForEvent(1, &read->token.Event, &eventIndex);
+      ST->BootServices->CloseEvent(read->token.Event);
+      read->isAsync = false;
+      read->failed  = read->token.Status != EFI_SUCCESS || read->token.BufferSize != read->fileSize;
+      if (read->failed) {
+         println(L"Error! Read only %lu of %lu bytes from file.", read->token.BufferSize, read->fileSize);
+      }
+   }
+   return !read->failed;
+}
+
+/**
+ * @brief Reads an entire file into freshly allocated scratch pages, waiting for the read to complete.
+ * @param fileHandle: Handle to the opened file.
+ * @param OUTfileSize: Filled with the size of the file in bytes.
+ *
+ * @return A pointer to the page-aligned buffer containing the file, or nullptr on failure.
+ */
+UINT8 *ReadFileToBuffer(EFI_FILE_PROTOCOL *fileHandle, UINTN *OUTfileSize) {
+   UINTN fileSize = GetFileSize(fileHandle);
+   if (fileSize == 0) {
+      return nullptr;
+   }
+   UINT8 *buffer = (UINT8 *)AllocatePagesForData(fileSize, LOADER_SCRATCH_MEMORY);
+   if (!buffer) {
+      println(L"Error! Could not allocate %lu bytes to read file into.", fileSize);
+      return nullptr;
+   }
+   FileRead read;
+   BeginFileRead(fileHandle, buffer, fileSize, &read);
+   if (!FinishFileRead(&read)) {
+      ST->BootServices->FreePages((EFI_PHYSICAL_ADDRESS)buffer, GetDataPageSize(fileSize));
+      return nullptr;
+   }
+   *OUTfileSize = fileSize;
+   return buffer;
+}
@@ -1,439 +1,520 @@
 #include "efi.h"
 #include "efiprot.h"
+#include "boot/bootinfo.h"
+#include "boot/timeline.h"
 
 EFI_SYSTEM_TABLE *ST;
 
+#include "acpi/acpi.h"
+#include "config/boot_plan.h"
+#include "config/config.h"
+#include "config/manifest.h"
 #include "elf/elf_header.h"
+#include "elf/elf_parse.h"
+#include "elf/elf_relocate.h"
+#include "elf/elf_symbols.h"
+#include "fs/boot_volume.h"
+#include "fs/fat.h"
+#include "fs/file_read.h"
+#include "font/glyph_atlas.h"
 #include "font/psf.h"
+#include "font/psf_parse.h"
+#include "mem/early_heap.h"
+#include "mem/kernel_stack.h"
+#include "mem/memory_map.h"
+#include "mem/pages.h"
+#include "mem/paging.h"
+#include "util/cpu.h"
+#include "util/crc32c.h"
+#include "util/lz4.h"
 #include "util/memcpy.h"
+#include "util/mp.h"
 #include "util/print.h"
+#include "video/video_mode.h"
 
-struct GlobalInitializers {
-   EFI_PHYSICAL_ADDRESS *ctorAddresses;
-   int ctorCount;
-   EFI_PHYSICAL_ADDRESS *dtorAddresses;
-   int dtorCount;
-};
-
-struct Framebuffer {
-   void *frameBufferAddress;
-   uint32_t pixelsPerScanLine;
-   uint32_t horizontalResolution;
-   uint32_t verticalResolution;
-};
-
-struct FontFormat {
-   void *FontBufferAddress;
-   uint32_t numGlyphs;
-   uint32_t glyphSizeInBytes;
-   uint32_t glyphHeight;
-   uint32_t glyphWidth;
-};
-
-struct MemoryMap {
-   EFI_MEMORY_DESCRIPTOR *memoryDescriptorArray;
-   UINTN memoryDescriptorArraySize;
-   UINTN descriptorSize;
-};
-
-typedef int(__attribute__((sysv_abi)) * KernelEntry)(Framebuffer, FontFormat, GlobalInitializers);
+typedef int(__attribute__((sysv_abi)) * KernelEntry)(BootInfo *);
 
 /**
  * @brief Pauses execution until input is recieved from the user.
  * @param msg: A message you wish to display to the user.
  */
 void WaitForKey(const wchar_t *msg) {
+   // Anything that needs the user to press a key needs them to see why, even during a quiet boot. Quiet boots
+   // have not printed anything yet, so this shows the whole log leading up to the problem.
+   loaderLog.quiet = false;
    // Clear input queue.
    ST->ConIn->Reset(ST->ConIn, false);
    println(msg);
+   LogFlush();
    // Listen for a keystroke.
    EFI_INPUT_KEY key {0};
    while (key.UnicodeChar == 0 && key.ScanCode == 0) { ST->ConIn->ReadKeyStroke(ST->ConIn, &key); }
 }
 
-/** @brief Gets the size of a file specified by a given file handle, in bytes.
- * @param fileHandle: The file to query.
- *
- * @return The size of the file in bytes. Returns 0 if the filesize could not be determined.
- */
-UINTN GetFileSize(EFI_FILE_PROTOCOL *fileHandle) {
-   UINTN fileSize = 0;
-   // We first allocate a pool of 1 byte so that GetInfo() can return us the correct size in bytes the buffer
-   // needs to be.
-   UINTN bufferSize     = 1;
-   EFI_MEMORY_TYPE type = EFI_MEMORY_TYPE::EfiLoaderData;
-   void *buffer         = nullptr;
-   ST->BootServices->AllocatePool(type, bufferSize, &buffer);
-   EFI_GUID fileInfoGUID = EFI_FILE_INFO_ID;
-   fileHandle->GetInfo(fileHandle, &fileInfoGUID, &bufferSize, (void **)buffer);
-
-   // Now that we know the correct number of bytes we have to allocate, we can get the file information.
-   ST->BootServices->FreePool(buffer);
-   ST->BootServices->AllocatePool(type, bufferSize, &buffer);
-   EFI_STATUS st = fileHandle->GetInfo(fileHandle, &fileInfoGUID, &bufferSize, (void **)buffer);
-   if (st != EFI_SUCCESS) {
-      println(L"Error! Could not allocate memory for GetInfo()!");
-      ST->BootServices->FreePool(buffer);
-      return 0;
-   }
-   fileSize = ((EFI_FILE_INFO *)buffer)->FileSize;
-   ST->BootServices->FreePool(buffer);
-   return fileSize;
-}
+/** A file to load as a boot module, and the state of its read. */
+struct ModuleLoad {
+   BootModuleType type;
+   /** The path of the file on the boot volume. Modules with an empty path are skipped. */
+   const CHAR16 *path;
+   FileRead read;
+   /** Set if the file is read with the loader's own FAT reader rather than through read.fileHandle. */
+   bool isRaw;
+   FatFile rawFile;
+};
 
-/** @brief Gets the number of pages needed to store data of a given size. Will round up to the nearest
- * whole number of pages.
- * @param dataSize: The size of the data, in bytes.
- *
- * @return The number of 4KiB UEFI pages that need to be allocated to store this data.
+/**
+ * @brief Copies as much of a path as fits into a boot module name, replacing anything that is not ASCII.
  */
-UINTN GetDataPageSize(UINTN dataSize) {
-   if (dataSize / (1024 * 4) == 0) {
-      return 1;
-   } else {
-      return (UINTN(dataSize / (1024 * 4))) + 1;
+void CopyModuleName(const CHAR16 *path, char *OUTname) {
+   UINTN i = 0;
+   for (; path[i] != 0 && i < BOOT_MODULE_NAME_LENGTH - 1; i++) {
+      OUTname[i] = path[i] < 0x80 ? (char)path[i] : '?';
    }
+   OUTname[i] = 0;
 }
 
 /**
- * @brief Allocates the necessary number of pages at any address as EfiLoaderData.
- * @param dataSize: The size of the data, in bytes.
+ * @brief Starts reading a module through the firmware file system driver after the loader's own FAT reader
+ * failed on it, in the same way a raw volume that fails to mount falls back to the firmware.
+ * @param volume: The open boot volume.
+ * @param load: The module whose raw read failed. Its buffer and size are kept.
  *
- * @return: The address of the beginning of the newly allocated pages, or nullptr on failure.
+ * @return False if the file could not be opened through the firmware or its size differs, in which case the
+ * module is left failed.
  */
-void *AllocatePagesForData(int dataSize) {
-   EFI_PHYSICAL_ADDRESS addr;
-   UINTN numPages    = GetDataPageSize(dataSize);
-   EFI_STATUS status = ST->BootServices->AllocatePages(AllocateAnyPages, EfiLoaderData, numPages, &addr);
-
-   if (status != 0) {
-      ST->BootServices->FreePages(addr, numPages);
-      return nullptr;
-   } else {
-      return (void *)addr;
+bool RetryModuleReadThroughFirmware(const BootVolume *volume, ModuleLoad *load) {
+   EFI_FILE_PROTOCOL *fileHandle = OpenBootVolumeFile(volume, load->path);
+   if (!fileHandle) {
+      return false;
+   }
+   if (GetFileSize(fileHandle) != load->read.fileSize) {
+      fileHandle->Close(fileHandle);
+      return false;
    }
+   load->isRaw = false;
+   BeginFileRead(fileHandle, load->read.buffer, load->read.fileSize, &load->read);
+   return true;
 }
 
 /**
- * @brief Translates a virtual kernel address in the kernel file to an actual address in UEFI memory.
+ * @brief Opens every boot module and starts reading them back to back into a single contiguous region.
  *
- * The kernel ELF file expects to be loaded at 0x400000, but we can not expect UEFI to have any specific
- * address free for us. Instead we must calculate the actual offset in memory where the requested data is
- * stored.
+ * All files are opened and sized first, so that one allocation can hold every module with each starting on
+ * a page boundary. The reads are then issued in order. With ReadEx() the firmware works through them while
+ * the caller gets other things done; without it they have all completed by the time this returns.
  *
- * @param kernelAddr: The address where UEFI chose to load the kernel into memory.
- * @param untranslatedAddr: The Address the ELF binary expects some data to be loaded at.
- * @param vaddr: The base address the ELF binary expects to be loaded at (usually 0x400000).
+ * If a raw volume is given, every module it can resolve is read straight from the disk instead, before this
+ * returns. The rest still go through the firmware file system driver, as does any module whose raw read
+ * fails.
+ * @param volume: The open boot volume.
+ * @param rawVolume: The boot volume mounted for raw reads, or nullptr to only use the firmware driver.
+ * @param loads: The modules to load. No more than BOOT_MODULE_MAX.
+ * @param loadCount: The number of entries in loads.
+ * @param OUTtable: Filled with the layout of the region. The modules in it are only valid once
+ * FinishBootModules() succeeds.
  *
- * @return: The translated memory address where the data actually resides in memory on the system.
+ * @return False if a module could not be opened or the region could not be allocated. Nothing is left open.
  */
-EFI_PHYSICAL_ADDRESS TranslateKernelAddress(EFI_PHYSICAL_ADDRESS kernelAddr,
-                                            EFI_PHYSICAL_ADDRESS untranslatedAddr,
-                                            EFI_PHYSICAL_ADDRESS vaddr) {
-   return kernelAddr + untranslatedAddr - vaddr;
-}
+bool BeginBootModules(const BootVolume *volume, FatVolume *rawVolume, ModuleLoad *loads, UINTN loadCount,
+                      BootModuleTable *OUTtable) {
+   UINTN regionSize = 0;
+   for (UINTN i = 0; i < loadCount; i++) {
+      loads[i].read.fileHandle = nullptr;
+      loads[i].read.fileSize   = 0;
+      loads[i].isRaw           = false;
+      if (loads[i].path[0] == 0) {
+         continue;
+      }
+      if (rawVolume && FatOpenFile(rawVolume, loads[i].path, &loads[i].rawFile)) {
+         loads[i].isRaw         = true;
+         loads[i].read.fileSize = loads[i].rawFile.size;
+         regionSize += (loads[i].read.fileSize + PAGE_SIZE - 1) & ~(UINTN)(PAGE_SIZE - 1);
+         continue;
+      }
+      EFI_FILE_PROTOCOL *fileHandle = OpenBootVolumeFile(volume, loads[i].path);
+      UINTN fileSize                = fileHandle ? GetFileSize(fileHandle) : 0;
+      if (fileSize == 0) {
+         println(L"Error: Could not open %s, or it is empty.", loads[i].path);
+         if (fileHandle) {
+            fileHandle->Close(fileHandle);
+         }
+         for (UINTN j = 0; j < i; j++) {
+            if (loads[j].read.fileHandle) {
+               loads[j].read.fileHandle->Close(loads[j].read.fileHandle);
+            }
+         }
+         return false;
+      }
+      loads[i].read.fileHandle = fileHandle;
+      loads[i].read.fileSize   = fileSize;
+      regionSize += (fileSize + PAGE_SIZE - 1) & ~(UINTN)(PAGE_SIZE - 1);
+   }
 
-/**
- * @brief Loads a file from the ROOT of the Boot partition only. Cannot (yet) load files in subdirectories.
- * @param deviceHandle: The device handle that loaded this EFI image.
- * @param ImageHandle: The handle representing this EFI image.
- * @param fileName: The full name of the file to open.
- *
- * @return A pointer to EFI_FILE_PROTOCOL for the requested file, or null if file could not be opened.
- */
-EFI_FILE_PROTOCOL *LoadRootDirFile(EFI_HANDLE deviceHandle, EFI_HANDLE ImageHandle, const wchar_t *fileName) {
-   // Get SimpleFileSystem Protocol.
-   EFI_GUID simpleFileSystemProtocolGUID         = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_GUID;
-   EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *SFSInterface = nullptr;
-   EFI_STATUS status                             = ST->BootServices->OpenProtocol(
-      deviceHandle, &simpleFileSystemProtocolGUID, (void **)&SFSInterface, ImageHandle, nullptr, 0x00000001);
+   EFI_PHYSICAL_ADDRESS regionBase = 0;
+   EFI_STATUS status = ST->BootServices->AllocatePages(AllocateAnyPages, LOADER_MODULE_MEMORY,
+                                                       regionSize / PAGE_SIZE, &regionBase);
    if (status != EFI_SUCCESS) {
-      println(L"Error! SimpleFileSystemProtocol not supported!");
-      return nullptr;
+      println(L"Error: Could not allocate %lu bytes for the boot modules.", regionSize);
+      for (UINTN i = 0; i < loadCount; i++) {
+         if (loads[i].read.fileHandle) {
+            loads[i].read.fileHandle->Close(loads[i].read.fileHandle);
+         }
+      }
+      return false;
    }
 
-   // Open Volume root file handle.
-   EFI_FILE_PROTOCOL *rootHandle = nullptr;
-   SFSInterface->OpenVolume(SFSInterface, &rootHandle);
-
-   // Open file handle for desired file.
-   EFI_FILE_PROTOCOL *fileHandle = nullptr;
-   status = rootHandle->Open(rootHandle, &fileHandle, (CHAR16 *)fileName, EFI_FILE_MODE_READ, 0);
-   if (status != EFI_SUCCESS) {
-      println(L"Error! Could not get a file handle to the kernel.");
-      return nullptr;
+   OUTtable->regionBase  = regionBase;
+   OUTtable->regionSize  = regionSize;
+   OUTtable->moduleCount = 0;
+   UINTN offset          = 0;
+   for (UINTN i = 0; i < loadCount; i++) {
+      FileRead *read = &loads[i].read;
+      if (read->fileSize == 0) {
+         continue;
+      }
+      BootModule *module = &OUTtable->modules[OUTtable->moduleCount++];
+      module->type       = loads[i].type;
+      module->base       = regionBase + offset;
+      module->size       = read->fileSize;
+      CopyModuleName(loads[i].path, module->name);
+      if (loads[i].isRaw) {
+         read->buffer = (UINT8 *)module->base;
+         read->failed = !FatReadFile(rawVolume, &loads[i].rawFile, read->buffer);
+         if (read->failed) {
+            println(L"Warning: Could not read %s straight from the disk, retrying through the firmware.",
+                    loads[i].path);
+            RetryModuleReadThroughFirmware(volume, &loads[i]);
+         }
+      } else {
+         BeginFileRead(read->fileHandle, (UINT8 *)module->base, read->fileSize, read);
+      }
+      offset += (read->fileSize + PAGE_SIZE - 1) & ~(UINTN)(PAGE_SIZE - 1);
    }
-   rootHandle->Close(rootHandle);
-   fileHandle->SetPosition(fileHandle, 0);
-   ST->BootServices->CloseProtocol(deviceHandle, &simpleFileSystemProtocolGUID, ImageHandle, nullptr);
-   return fileHandle;
+   return true;
 }
 
 /**
- * @brief Verify that a loaded file is a proper ELF64 executable file.
- * @param The ELF header for the file you are verifying.
+ * @brief Waits for every read started by BeginBootModules() and closes the module files.
+ * @param loads: The modules passed to BeginBootModules().
+ * @param loadCount: The number of entries in loads.
  *
- * @return True if the file header is correct, false otherwise.
+ * @return True if every module was read completely.
  */
-bool VerifyELFFile(Elf64_Ehdr header) {
-   if (header.e_ident[0] != 127 || header.e_ident[1] != 'E' || header.e_ident[2] != 'L' ||
-       header.e_ident[3] != 'F') {
-      println(
-         L"Loaded kernel file does not appear to be in the ELF format! This loader only supports ELF file "
-         L"format.");
-      return false;
-   }
-   if (header.e_ident[4] != 2) {
-      println(L"Loaded kernel file is not 64 bit. This loader only supports 64 bit kernels.");
-      return false;
+bool FinishBootModules(ModuleLoad *loads, UINTN loadCount) {
+   bool success = true;
+   for (UINTN i = 0; i < loadCount; i++) {
+      FileRead *read = &loads[i].read;
+      if (read->fileSize == 0) {
+         continue;
+      }
+      // Raw reads are complete already. Every other read has to be waited for, even after a failure, as the
+      // firmware may still be writing.
+      if (loads[i].isRaw ? read->failed : !FinishFileRead(read)) {
+         println(L"Error: Could not read %s.", loads[i].path);
+         success = false;
+      }
+      if (read->fileHandle) {
+         read->fileHandle->Close(read->fileHandle);
+      }
    }
-
-   return true;
+   return success;
 }
 
 /**
- * @brief Read in the header for the given kernel file. Seek position of the file is set to zero after
- * function call.
- * @param kernelHandle: Handle to the opened kernel file.
+ * @brief Finds the first boot module of a given type.
  *
- * @return A struct containing the ELF header information.
+ * @return The module, or nullptr if no module of that type was loaded.
  */
-Elf64_Ehdr ParseELFHeader(EFI_FILE_PROTOCOL *kernelHandle) {
-   Elf64_Ehdr headerData {};
-   UINTN size = sizeof(Elf64_Ehdr);
-   kernelHandle->Read(kernelHandle, &size, &headerData);
-
-   if (!VerifyELFFile(headerData)) {
-      WaitForKey(L"");
+BootModule *FindBootModule(BootModuleTable *table, BootModuleType type) {
+   for (UINTN i = 0; i < table->moduleCount; i++) {
+      if (table->modules[i].type == type) {
+         return &table->modules[i];
+      }
    }
-
-   kernelHandle->SetPosition(kernelHandle, 0);
-   return headerData;
+   return nullptr;
 }
 
 /**
- * @brief Read in the program headers for the given kernel file. Seek position of the file is set to zero
- * after function call.
- * @param elfHeader: The header struct for the given kernel file.
- * @param kernelHandle: Handle to the opened kernel file.
+ * @brief Reads the checksum manifest bhava.sum from the root of the boot volume, if there is one.
+ * @param volume: The open boot volume.
+ * @param OUTmanifest: Filled with the manifest entries.
+ * @param OUTsize: Filled with the size of the returned buffer, in bytes.
  *
- * @return A pointer to the first element of an array of Program Headers.
+ * @return The page-aligned buffer holding the manifest, or nullptr if there is no usable manifest.
  */
-Elf64_Phdr *ParseELFPHeader(Elf64_Ehdr elfHeader, EFI_FILE_PROTOCOL *kernelHandle) {
-   Elf64_Phdr *programHeaders;
-   kernelHandle->SetPosition(kernelHandle, elfHeader.e_phoff);
-   UINTN phsize = elfHeader.e_phentsize * elfHeader.e_phnum;
-   kernelHandle->Read(kernelHandle, &phsize, (void **)programHeaders);
-
-   kernelHandle->SetPosition(kernelHandle, 0);
-   return programHeaders;
+UINT8 *LoadChecksumManifest(const BootVolume *volume, ChecksumManifest *OUTmanifest, UINTN *OUTsize) {
+   EFI_FILE_PROTOCOL *manifestHandle = OpenBootVolumeFile(volume, (const CHAR16 *)MANIFEST_FILE_NAME);
+   if (!manifestHandle) {
+      return nullptr;
+   }
+   UINTN manifestSize    = 0;
+   UINT8 *manifestBuffer = ReadFileToBuffer(manifestHandle, &manifestSize);
+   manifestHandle->Close(manifestHandle);
+   if (!manifestBuffer) {
+      return nullptr;
+   }
+   if (!ParseChecksumManifest(manifestBuffer, manifestSize, OUTmanifest)) {
+      println(L"Warning: bhava.sum is not a checksum manifest this loader understands.");
+      ST->BootServices->FreePages((EFI_PHYSICAL_ADDRESS)manifestBuffer, GetDataPageSize(manifestSize));
+      return nullptr;
+   }
+   *OUTsize = manifestSize;
+   return manifestBuffer;
 }
 
 /**
- * @brief Read in the section headers, if they exist, for the given kernel file. Seek position of the file is
- * set to zero after function call.
- * @param elfHeader: The header struct for the given kernel file.
- * @param kernelHandle: Handle to the opened kernel file.
+ * @brief Checks every boot module the manifest has a whole-file checksum for.
+ * @param manifest: The parsed manifest.
+ * @param loads: The modules passed to BeginBootModules().
+ * @param loadCount: The number of entries in loads.
+ * @param table: The boot modules as read by FinishBootModules().
+ * @param OUTcheckedCount: Filled with the number of modules that were checked.
  *
- * @return A pointer to the first element of an array of Program Headers, or null if there are no section
- * headers.
+ * @return False if a module does not match its checksum.
  */
-Elf64_Shdr *ParseELFSHeader(Elf64_Ehdr elfHeader, EFI_FILE_PROTOCOL *kernelHandle) {
-   if (elfHeader.e_shoff == 0) {
-      return nullptr;
+bool VerifyBootModules(const ChecksumManifest *manifest, const ModuleLoad *loads, UINTN loadCount,
+                       const BootModuleTable *table, UINTN *OUTcheckedCount) {
+   ChecksumCheck checks[BOOT_MODULE_MAX];
+   const CHAR16 *checkPaths[BOOT_MODULE_MAX];
+   UINTN checkCount  = 0;
+   UINTN moduleIndex = 0;
+   for (UINTN i = 0; i < loadCount; i++) {
+      // Modules are laid out in the order of their loads, with skipped loads left out.
+      if (loads[i].read.fileSize == 0) {
+         continue;
+      }
+      const BootModule *module   = &table->modules[moduleIndex++];
+      const ManifestEntry *entry = FindManifestEntry(manifest, loads[i].path, MANIFEST_WHOLE_FILE);
+      if (entry) {
+         checks[checkCount]       = {(const UINT8 *)module->base, module->size, entry, false};
+         checkPaths[checkCount++] = loads[i].path;
+      }
    }
-
-   Elf64_Shdr *sectionHeaders;
-   kernelHandle->SetPosition(kernelHandle, elfHeader.e_shoff);
-   UINTN shsize = elfHeader.e_shentsize * elfHeader.e_shnum;
-   kernelHandle->Read(kernelHandle, &shsize, (void **)sectionHeaders);
-   kernelHandle->SetPosition(kernelHandle, 0);
-   return sectionHeaders;
+   UINTN failed = RunChecksumChecks(checks, checkCount);
+   if (failed < checkCount) {
+      println(L"Error: %s does not match its checksum in bhava.sum.", checkPaths[failed]);
+      return false;
+   }
+   *OUTcheckedCount = checkCount;
+   return true;
 }
 
 /**
- * @brief Read in the header for the given PSF2 file. Seek position of the file is set to zero after function
- * call.
- * @param fontHandle: Handle to the opened font file.
+ * @brief Checks the loaded kernel segments against their checksums, right after they have been copied into
+ * place and before anything else touches them.
+ * @param manifest: The parsed manifest.
+ * @param kernelPath: The path the kernel was loaded from.
+ * @param elfHeader: The header struct for the given kernel file.
+ * @param programHeaders: A pointer to the first element of the kernel's program header array.
+ * @param layout: Where the kernel segments were loaded.
+ * @param OUTcheckedCount: Filled with the number of segments that were checked.
  *
- * @return A struct containing the PSF2 Header information..
+ * @return False if a segment does not match its checksum.
  */
-psf2_header ParsePSF2Header(EFI_FILE_PROTOCOL *fontHandle) {
-   psf2_header psf2Header {};
-   UINTN psf2size = sizeof(psf2_header);
-   fontHandle->Read(fontHandle, &psf2size, &psf2Header);
-
-   fontHandle->SetPosition(fontHandle, 0);
-   return psf2Header;
+bool VerifyKernelSegments(const ChecksumManifest *manifest, const CHAR16 *kernelPath,
+                          const Elf64_Ehdr *elfHeader, const Elf64_Phdr *programHeaders,
+                          const KernelImageLayout &layout, UINTN *OUTcheckedCount) {
+   *OUTcheckedCount      = 0;
+   ChecksumCheck *checks = nullptr;
+   if (ST->BootServices->AllocatePool(LOADER_SCRATCH_MEMORY, elfHeader->e_phnum * sizeof(ChecksumCheck),
+                                      (void **)&checks) != EFI_SUCCESS) {
+      println(L"Error: Could not allocate memory to check the kernel segments.");
+      return false;
+   }
+   UINTN checkCount = 0;
+   for (UINT32 i = 0; i < elfHeader->e_phnum; i++) {
+      const Elf64_Phdr &segment  = programHeaders[i];
+      const ManifestEntry *entry = FindManifestEntry(manifest, kernelPath, i);
+      if (segment.p_type == PT_LOAD && entry) {
+         const UINT8 *loaded  = (const UINT8 *)(layout.physicalBase + (segment.p_vaddr - layout.vaddrBase));
+         checks[checkCount++] = {loaded, segment.p_filesz, entry, false};
+      }
+   }
+   UINTN failed = RunChecksumChecks(checks, checkCount);
+   if (failed < checkCount) {
+      println(L"Error: Kernel segment %u does not match its checksum in bhava.sum.",
+              checks[failed].entry->segment);
+   }
+   ST->BootServices->FreePool(checks);
+   *OUTcheckedCount = checkCount;
+   return failed == checkCount;
 }
 
 /**
- * @brief Takes in an array of 8 little-endian bytes stored in a file and converts it to a 64-bit memory
- * address.
- * @param data: An array of 8 bytes to convert. Array is expected to be 8 bytes.
+ * @brief Reads the loader configuration from bhava.cfg in the root of the boot volume, if there is one.
+ * @param volume: The open boot volume.
+ * @param OUTconfig: Filled with the configuration. Anything bhava.cfg does not set keeps its default value.
  *
- * @return A 64-bit address that was encoded in the bytes.
+ * @return The number of the first line of bhava.cfg that could not be understood, or 0 if there was none.
  */
-EFI_PHYSICAL_ADDRESS ConvertLittleEndianBytesToAddr(UINT8 *data) {
-   return ((UINTN)(data[0] << 0) + ((UINTN)data[1] << 8) + ((UINTN)data[2] << 16) + ((UINTN)data[3] << 24) +
-           ((UINTN)data[4] << 32) + ((UINTN)data[5] << 40) + ((UINTN)data[6] << 48) + ((UINTN)data[7] << 56));
+UINTN LoadLoaderConfig(const BootVolume *volume, LoaderConfig *OUTconfig) {
+   GetDefaultLoaderConfig(OUTconfig);
+   EFI_FILE_PROTOCOL *configHandle = OpenBootVolumeFile(volume, (const CHAR16 *)CONFIG_FILE_NAME);
+   if (!configHandle) {
+      return 0;
+   }
+   UINTN configSize  = 0;
+   UINT8 *configText = ReadFileToBuffer(configHandle, &configSize);
+   configHandle->Close(configHandle);
+   if (!configText) {
+      return 0;
+   }
+   UINTN badLine = ParseLoaderConfig((const char *)configText, configSize, OUTconfig);
+   ST->BootServices->FreePages((EFI_PHYSICAL_ADDRESS)configText, GetDataPageSize(configSize));
+   return badLine;
 }
 
 /**
- * @brief Parses the addresses of the global constructors and destructors needed for using global objects
- * in a c++ kernel.
- *
- * @param headerArray: A pointer to the first element of an array of section headers.
- * @param headerCount: The length of the header array.
- * @param kernelData: Pointer to the beginning of the loaded kernel in memory.
- * @param vaddr: The base Address that the Elf File expects to be loaded at, for address conversion.
- *
- * @return A GlobalInitializers Struct filled with addresses for constructors and destructors.
+ * @brief Gives the user a chance to read the loader output before control is handed to the kernel.
+ * @param timeoutSeconds: How long to wait for a key press before booting anyway. 0 boots immediately, and
+ * CONFIG_TIMEOUT_NEVER waits until a key is pressed.
  */
-GlobalInitializers ParseGlobalInitializers(Elf64_Shdr *headerArray, int headerCount, UINT8 *kernelData,
-                                           Elf64_Addr vaddr) {
-   EFI_PHYSICAL_ADDRESS *initArrayStart = nullptr;
-   EFI_PHYSICAL_ADDRESS *finiArrayStart = nullptr;
-   GlobalInitializers initializers {0};
-   for (int i = 0; i < headerCount; i++) {
-      if (headerArray[i].sh_type == SHT_INIT_ARRAY) {
-         UINTN offset           = headerArray[i].sh_offset;
-         UINTN bufferSize       = headerArray[i].sh_size;
-         initializers.ctorCount = bufferSize / 8;
-         EFI_MEMORY_TYPE type   = EFI_MEMORY_TYPE::EfiLoaderData;
-         ST->BootServices->AllocatePool(type, bufferSize, (void **)&initArrayStart);
-         for (int i = 0; i < initializers.ctorCount; i++) {
-            EFI_PHYSICAL_ADDRESS ctorAddr =
-               ConvertLittleEndianBytesToAddr(kernelData + offset + sizeof(void *) * i);
-            ctorAddr          = TranslateKernelAddress((EFI_PHYSICAL_ADDRESS)kernelData, ctorAddr, vaddr);
-            initArrayStart[i] = ctorAddr;
-         }
-      }
-      if (headerArray[i].sh_type == SHT_FINI_ARRAY) {
-         UINTN offset           = headerArray[i].sh_offset;
-         UINTN bufferSize       = headerArray[i].sh_size;
-         initializers.dtorCount = bufferSize / 8;
-         EFI_MEMORY_TYPE type   = EFI_MEMORY_TYPE::EfiLoaderData;
-         ST->BootServices->AllocatePool(type, bufferSize, (void **)&finiArrayStart);
-         for (int i = 0; i < initializers.dtorCount; i++) {
-            EFI_PHYSICAL_ADDRESS dtorAddr =
-               ConvertLittleEndianBytesToAddr(kernelData + offset + sizeof(void *) * i);
-            dtorAddr          = TranslateKernelAddress((EFI_PHYSICAL_ADDRESS)kernelData, dtorAddr, vaddr);
-            finiArrayStart[i] = dtorAddr;
-         }
-      }
+void WaitBeforeBoot(INT32 timeoutSeconds) {
+   LogFlush();
+   if (timeoutSeconds == 0) {
+      return;
+   }
+   if (timeoutSeconds == CONFIG_TIMEOUT_NEVER) {
+      WaitForKey(L"Ready to transfer control to kernel. Press any key to continue...");
+      return;
+   }
+
+   EFI_EVENT events[2] = {ST->ConIn->WaitForKey, nullptr};
+   if (ST->BootServices->CreateEvent(EVT_TIMER, 0, nullptr, nullptr, &events[1]) != EFI_SUCCESS) {
+      return;
+   }
+   ST->ConIn->Reset(ST->ConIn, false);
+   println(L"Booting kernel in %d seconds. Press any key to boot now...", timeoutSeconds);
+   LogFlush();
+   // Timer periods are given in units of 100ns.
+   ST->BootServices->SetTimer(events[1], TimerRelative, (UINT64)timeoutSeconds * 10000000);
+   UINTN eventIndex = 0;
+   ST->BootServices->WaitForEvent(2, events, &eventIndex);
+   ST->BootServices->CloseEvent(events[1]);
+   if (eventIndex == 0) {
+      EFI_INPUT_KEY key;
+      ST->ConIn->ReadKeyStroke(ST->ConIn, &key);
    }
-   initializers.ctorAddresses = initArrayStart;
-   initializers.dtorAddresses = finiArrayStart;
-   return initializers;
 }
 
 /**
- * @brief Verify that a loaded file is a PC Screen Font file of the right version.
- * @param The PSF2 Header for the file you are verifying.
+ * @brief Decompresses a file image that was stored as an LZ4 frame into freshly allocated pages. The
+ * compressed image is left untouched.
+ * @param compressedImage: Pointer to the compressed file in memory.
+ * @param compressedSize: The size of the compressed file, in bytes.
+ * @param OUTimageSize: Filled with the size of the decompressed file in bytes.
  *
- * @return True if the file header is correct.
+ * @return A pointer to the page-aligned decompressed image, or nullptr on failure.
  */
-bool VerifyPSF2File(psf2_header header) {
-   if (header.magic[0] != 0x72 || header.magic[1] != 0xb5 || header.magic[2] != 0x4a ||
-       header.magic[3] != 0x86) {
-      return false;
+UINT8 *DecompressLz4Image(UINT8 *compressedImage, UINTN compressedSize, UINTN *OUTimageSize) {
+   Lz4FrameInfo frameInfo;
+   if (!ParseLz4FrameHeader(compressedImage, compressedSize, &frameInfo) || frameInfo.contentSize == 0) {
+      println(L"Error! Compressed image must be an LZ4 frame that records its content size.");
+      return nullptr;
    }
-   return true;
+   UINT8 *image = (UINT8 *)AllocatePagesForData(frameInfo.contentSize, LOADER_SCRATCH_MEMORY);
+   if (!image) {
+      println(L"Error! Could not allocate %lu bytes to decompress image into.", frameInfo.contentSize);
+      return nullptr;
+   }
+
+   UINTN imageSize = 0;
+   bool decompressed =
+      Lz4DecompressFrameParallel(compressedImage, compressedSize, image, frameInfo.contentSize, &imageSize);
+   if (!decompressed || imageSize != frameInfo.contentSize) {
+      println(L"Error! Compressed image is corrupt.");
+      ST->BootServices->FreePages((EFI_PHYSICAL_ADDRESS)image, GetDataPageSize(frameInfo.contentSize));
+      return nullptr;
+   }
+   *OUTimageSize = imageSize;
+   return image;
 }
 
-/** @brief Exits UEFI Boot services and provides a pointer to the memory map at the time of exit.
- * @param ImageHandle: The handle representing this EFI image.
- * @param OUTmapSize: Provides the size of the memory map. [OPTIONAL]
- * @return The memory map at the time of exiting Boot Services.
+/** @brief Finds the end of the highest physical range described by the UEFI memory map.
+ *
+ * @return The first physical address past the highest memory range, never less than 4GiB so that the
+ * low MMIO hole (local APIC, IOAPIC, HPET...) is always reachable. 4GiB if the map could not be read.
  */
-MemoryMap ExitBootServices(EFI_HANDLE ImageHandle, UINTN *OUTmapSize) {
-   // First allocate a buffer of 1 byte to get the actual size of the memory map.
-   void *buffer             = nullptr;
-   UINTN memoryMapSize      = 1;
+UINT64 GetPhysicalMemoryLimit() {
+   UINTN memoryMapSize      = 0;
    UINTN mapKey             = 0;
    UINTN descriptorSize     = 0;
    UINT32 descriptorVersion = 0;
-   EFI_MEMORY_TYPE type     = EFI_MEMORY_TYPE::EfiLoaderData;
-   ST->BootServices->AllocatePool(type, 1, &buffer);
-   ST->BootServices->GetMemoryMap(&memoryMapSize, (EFI_MEMORY_DESCRIPTOR *)buffer, &mapKey, &descriptorSize,
-                                  &descriptorVersion);
-
-   // Now we can actually allocate the map.
-   ST->BootServices->FreePool(buffer);
-   // We need to allocate a little extra memory because by allocating new memory weve changed the size
-   // of the memory map.
-   memoryMapSize += (2 * descriptorSize);
-   ST->BootServices->AllocatePool(type, memoryMapSize, &buffer);
-   EFI_STATUS garb = ST->BootServices->GetMemoryMap(&memoryMapSize, (EFI_MEMORY_DESCRIPTOR *)buffer, &mapKey,
-                                                    &descriptorSize, &descriptorVersion);
-   EFI_MEMORY_DESCRIPTOR *memoryMap = (EFI_MEMORY_DESCRIPTOR *)buffer;
-
-   // Finally we can exit boot services.
-   ST->BootServices->ExitBootServices(ImageHandle, mapKey);
-
-   MemoryMap map = {memoryMap, memoryMapSize, descriptorSize};
-
-   if (OUTmapSize != nullptr) {
-      *OUTmapSize = memoryMapSize;
+   void *buffer             = nullptr;
+   ST->BootServices->GetMemoryMap(&memoryMapSize, nullptr, &mapKey, &descriptorSize, &descriptorVersion);
+   memoryMapSize += 2 * descriptorSize;
+   UINT64 limit = 0x100000000ull;
+   if (ST->BootServices->AllocatePool(LOADER_SCRATCH_MEMORY, memoryMapSize, &buffer) != EFI_SUCCESS) {
+      return limit;
    }
-
-   return map;
-}
-
-/** @brief Finds the highest resolution video mode this device supports.
- *
- * @return The UEFI mode number for the selected video mode, or -1 if an adequate mode could not be found.
- */
-UINT32 GetVideoMode() {
-   EFI_GUID gopGUID                           = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
-   EFI_GRAPHICS_OUTPUT_PROTOCOL *gopInterface = nullptr;
-   ST->BootServices->LocateProtocol(&gopGUID, nullptr, (void **)&gopInterface);
-   EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *info = nullptr;
-   UINTN size                                 = 0;
-   int favoredMode                            = -1;
-#ifdef CUSTOM_RESOLUTION
-   for (int i = 0; i < gopInterface->Mode->MaxMode; i++) {
-      gopInterface->QueryMode(gopInterface, i, &size, &info);
-      if (info->HorizontalResolution == CUSTOM_RESOLUTION_X &&
-          info->VerticalResolution == CUSTOM_RESOLUTION_Y) {
-         favoredMode = i;
-      }
+   if (ST->BootServices->GetMemoryMap(&memoryMapSize, (EFI_MEMORY_DESCRIPTOR *)buffer, &mapKey,
+                                      &descriptorSize, &descriptorVersion) != EFI_SUCCESS) {
+      ST->BootServices->FreePool(buffer);
+      return limit;
    }
-#else
-   // Get video mode with highest resolution.
-   int currentHighestHorzRes = 0;
-   int currentHighestVertRes = 0;
-   for (int i = 0; i < gopInterface->Mode->MaxMode; i++) {
-      gopInterface->QueryMode(gopInterface, i, &size, &info);
-      if (info->HorizontalResolution > currentHighestHorzRes) {
-         if (info->VerticalResolution > currentHighestVertRes) {
-            favoredMode = i;
-         }
+   for (UINTN offset = 0; offset < memoryMapSize; offset += descriptorSize) {
+      EFI_MEMORY_DESCRIPTOR *descriptor = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)buffer + offset);
+      UINT64 end = descriptor->PhysicalStart + descriptor->NumberOfPages * PAGE_SIZE;
+      if (end > limit) {
+         limit = end;
       }
    }
-#endif
-   gopInterface->QueryMode(gopInterface, favoredMode, &size, &info);
-   println(L"Selected Kernel Video Mode Horz: %d px, Vert: %d px.", info->HorizontalResolution,
-           info->VerticalResolution);
-
-   return favoredMode;
+   ST->BootServices->FreePool(buffer);
+   return limit;
 }
 
-/** @brief Initializes a framebuffer object for use by the kernel.
- * @param videoMode: The UEFI video mode to use for this framebuffer.
- *
- * @returns: A Framebuffer struct.
+/** @brief Exits UEFI Boot services and hands back the memory map at the time of exit, converted into the
+ * kernel's region table.
+ * @param ImageHandle: The handle representing this EFI image.
+ * @param OUTregionTable: Filled with the sorted and coalesced memory region table.
+ * @return True if boot services were exited, false otherwise.
  */
-Framebuffer SetUpFramebuffer(UINTN videoMode) {
-   EFI_GUID gopGUID                           = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
-   EFI_GRAPHICS_OUTPUT_PROTOCOL *gopInterface = nullptr;
-   ST->BootServices->LocateProtocol(&gopGUID, nullptr, (void **)&gopInterface);
+bool ExitBootServices(EFI_HANDLE ImageHandle, MemoryRegionTable *OUTregionTable) {
+   void *buffer             = nullptr;
+   MemoryRegion *regions    = nullptr;
+   UINTN bufferSize         = 0;
+   UINTN mapKey             = 0;
+   UINTN descriptorSize     = 0;
+   UINT32 descriptorVersion = 0;
 
-   gopInterface->SetMode(gopInterface, videoMode);
+   // The map key goes stale whenever anything changes the memory map between fetching it and exiting boot
+   // services (including our own allocations, or firmware events firing), so keep trying until it sticks.
+   for (int attempt = 0; attempt < 8; attempt++) {
+      UINTN memoryMapSize = bufferSize;
+      EFI_STATUS status = ST->BootServices->GetMemoryMap(&memoryMapSize, (EFI_MEMORY_DESCRIPTOR *)buffer,
+                                                         &mapKey, &descriptorSize, &descriptorVersion);
+      if (status == EFI_BUFFER_TOO_SMALL) {
+         if (buffer) {
+            ST->BootServices->FreePool(buffer);
+            ST->BootServices->FreePool(regions);
+         }
+         // We need to allocate a little extra memory because by allocating new memory weve changed the size
+         // of the memory map.
+         bufferSize        = memoryMapSize + (8 * descriptorSize);
+         UINTN regionsSize = (bufferSize / descriptorSize) * sizeof(MemoryRegion);
+         // The raw map is only needed to build the region table, which the kernel keeps.
+         if (ST->BootServices->AllocatePool(LOADER_SCRATCH_MEMORY, bufferSize, &buffer) != EFI_SUCCESS) {
+            return false;
+         }
+         if (ST->BootServices->AllocatePool(LOADER_HANDOFF_MEMORY, regionsSize, (void **)&regions) !=
+             EFI_SUCCESS) {
+            ST->BootServices->FreePool(buffer);
+            return false;
+         }
+         continue;
+      }
+      if (status != EFI_SUCCESS) {
+         return false;
+      }
 
-   return {(void *)gopInterface->Mode->FrameBufferBase, gopInterface->Mode->Info->PixelsPerScanLine,
-           gopInterface->Mode->Info->HorizontalResolution, gopInterface->Mode->Info->VerticalResolution};
+      UINTN regionCount =
+         BuildMemoryRegionTable((EFI_MEMORY_DESCRIPTOR *)buffer, memoryMapSize, descriptorSize, regions);
+      if (ST->BootServices->ExitBootServices(ImageHandle, mapKey) == EFI_SUCCESS) {
+         *OUTregionTable = {regions, regionCount};
+         return true;
+      }
+   }
+   return false;
 }
 
 extern "C" {
@@ -444,109 +525,411 @@ efi_main(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *SystemTable) {
    int versionMinor = 3;
    int versionPatch = 0;
 
-   ST = SystemTable;
-
-   // Set initial screen state.
-   int colors = 0b00011111;
-   SystemTable->ConOut->SetAttribute(SystemTable->ConOut, colors);
-   SystemTable->ConOut->ClearScreen(SystemTable->ConOut);
+   UINT64 entryTsc = __builtin_ia32_rdtsc();
+   ST              = SystemTable;
+   InitMemoryPrimitives();
+   InitCrc32c();
+
+   // Everything the kernel needs to know about the machine is passed through a single structure. It is
+   // allocated first thing so that boot phases can be timed from the moment the firmware hands us control.
+   BootInfo *bootInfo = nullptr;
+   SystemTable->BootServices->AllocatePool(LOADER_HANDOFF_MEMORY, sizeof(BootInfo), (void **)&bootInfo);
+   if (!bootInfo) {
+      return EFI_OUT_OF_RESOURCES;
+   }
+   memset(bootInfo, 0, sizeof(BootInfo));
+   // The log is handed to the kernel too, so it needs memory that survives ExitBootServices().
+   char *logBuffer = (char *)AllocatePagesForData(LOG_BUFFER_SIZE, LOADER_HANDOFF_MEMORY);
+   if (logBuffer) {
+      LogMoveToBuffer(logBuffer, LOG_BUFFER_SIZE);
+   }
+   BootTimeline *timeline = &bootInfo->timeline;
+   // The TSC counts from reset, so the first entry records how long the firmware took to get to us.
+   MarkBootPhase(timeline, "firmware");
+   timeline->entries[0].tsc = entryTsc;
+   timeline->tscFrequency   = CalibrateTscFrequency();
+   MarkBootPhase(timeline, "TSC calibration");
+   UINTN processorCount = InitMpServices();
+   MarkBootPhase(timeline, "MP services");
 
    // Get interface for Loaded Image Protocol
    EFI_GUID loadedImageProtocolGUID                = EFI_LOADED_IMAGE_PROTOCOL_GUID;
    EFI_LOADED_IMAGE_PROTOCOL *loadedImageInterface = nullptr;
    SystemTable->BootServices->OpenProtocol(ImageHandle, &loadedImageProtocolGUID,
                                            (void **)&loadedImageInterface, ImageHandle, nullptr, 0x00000001);
+
+   // The boot volume stays open until every file the loader needs has been read.
+   BootVolume bootVolume;
+   bool bootVolumeOpen = OpenBootVolume(loadedImageInterface->DeviceHandle, ImageHandle, &bootVolume);
+
+   // The configuration decides whether we touch the console at all, so it has to be read first.
+   LoaderConfig config;
+   UINTN badConfigLine = 0;
+   if (bootVolumeOpen) {
+      badConfigLine = LoadLoaderConfig(&bootVolume, &config);
+   } else {
+      GetDefaultLoaderConfig(&config);
+   }
+   loaderLog.quiet = config.quiet;
+   if (!config.quiet) {
+      // Set initial screen state.
+      int colors = 0b00011111;
+      SystemTable->ConOut->SetAttribute(SystemTable->ConOut, colors);
+      SystemTable->ConOut->ClearScreen(SystemTable->ConOut);
+   }
+
    // Get the address this UEFI image was loaded at and print it for debugging purposes.
    UINT64 ImageBaseAddress = (UINT64)loadedImageInterface->ImageBase;
    println(L"Welcome to BhavaLoader v%d.%d.%d.", versionMajor, versionMinor, versionPatch);
-   println(L"Copyright (©) 2021. Licensed under the MIT License.");
-   println(L"This UEFI Image has been loaded at memory address: 0x%x", ImageBaseAddress);
-
-   // Load kernel handle.
-   EFI_FILE_PROTOCOL *kernelHandle =
-      LoadRootDirFile(loadedImageInterface->DeviceHandle, ImageHandle, L"LanternOS");
-   if (!kernelHandle) {
-      WaitForKey(L"Could not open ELF Kernel File..");
+   println(L"Copyright (c) 2021. Licensed under the MIT License.");
+   println(L"This UEFI Image has been loaded at memory address: 0x%lx", ImageBaseAddress);
+   if (badConfigLine != 0) {
+      println(L"Warning: Ignored invalid setting on line %lu of bhava.cfg.", badConfigLine);
+   }
+   if (processorCount > 1) {
+      println(L"Sharing loader work across %lu processors.", processorCount);
+   }
+   MarkBootPhase(timeline, "protocol open");
+
+   if (!bootVolumeOpen) {
+      WaitForKey(L"Error! SimpleFileSystemProtocol not supported!");
       return 1;
    }
+   // Whatever earlier boots onto these images found out does not need finding out again. plan collects what
+   // this boot finds out, and is written back if it differs.
+   BootPlan lastPlan {};
+   BootPlan plan {};
+   bool planLoaded = config.bootPlan && LoadBootPlan(&bootVolume, &lastPlan);
+
+   // With rawio enabled, modules the loader's own FAT reader can resolve bypass the firmware file system.
+   FatVolume rawVolume;
+   bool rawVolumeMounted = false;
+   if (config.rawDiskReads) {
+      rawVolumeMounted = MountFatVolume(loadedImageInterface->DeviceHandle, ImageHandle, &rawVolume);
+      if (!rawVolumeMounted) {
+         println(L"Warning: The boot volume is not FAT formatted, falling back to the firmware driver.");
+      }
+   }
 
-   Elf64_Ehdr elfHeaderData     = ParseELFHeader(kernelHandle);
-   Elf64_Phdr *elfProgramHeader = ParseELFPHeader(elfHeaderData, kernelHandle);
+   // Get every boot module read in flight at once. Where the firmware supports asynchronous file IO, we can
+   // get the video mode enumeration done while they complete.
+   ModuleLoad moduleLoads[] = {{BootModuleType::Kernel, config.kernelPath, {}, false, {}},
+                               {BootModuleType::Font, config.fontPath, {}, false, {}},
+                               {BootModuleType::Initrd, config.initrdPath, {}, false, {}},
+                               {BootModuleType::Symbols, config.symbolsPath, {}, false, {}}};
+   UINTN moduleLoadCount    = sizeof(moduleLoads) / sizeof(moduleLoads[0]);
+   if (!BeginBootModules(&bootVolume, rawVolumeMounted ? &rawVolume : nullptr, moduleLoads, moduleLoadCount,
+                         &bootInfo->modules)) {
+      WaitForKey(L"Error: Could not start reading the boot modules!");
+      return 1;
+   }
+   if (moduleLoads[0].isRaw) {
+      println(L"Read the kernel straight from the disk in %lu pieces.", moduleLoads[0].rawFile.runCount);
+   } else if (moduleLoads[0].read.isAsync) {
+      println(L"Loading %lu boot modules asynchronously.", bootInfo->modules.moduleCount);
+   }
+   MarkBootPhase(timeline, "module open");
+
+   // Get a suitable videomode. If the plan has one for this configuration, only that mode is queried.
+   VideoModeTable videoModes {};
+   bool videoReplayed = planLoaded && ReplayVideoPlan(&lastPlan, &config, &videoModes);
+   if (!videoReplayed && !LoadVideoModeTable(&videoModes)) {
+      WaitForKey(L"Could not find a graphics output device.");
+      return 1;
+   }
+   UINT64 framebufferBudget   = (UINT64)config.framebufferBudgetMiB << 20;
+   const VideoMode *videoMode = SelectVideoMode(&videoModes, config.resolutionX, config.resolutionY,
+                                                framebufferBudget);
+   if (!videoMode) {
+      WaitForKey(L"Could not find suitable video mode.");
+      return 1;
+   }
+   bool resolutionRequested = config.resolutionX != 0 && config.resolutionY != 0;
+   if (!resolutionRequested && framebufferBudget != 0 &&
+       GetVideoModeFootprint(*videoMode) > framebufferBudget) {
+      println(L"Warning: No video mode fits the %u MiB framebuffer budget, using the smallest one instead.",
+              config.framebufferBudgetMiB);
+   }
+   RecordVideoPlan(&videoModes, videoMode, &config, &plan);
+   println(L"Selected Kernel Video Mode Horz: %u px, Vert: %u px, %u px per scanline, pixel format %u%s.",
+           videoMode->width, videoMode->height, videoMode->pixelsPerScanLine, (UINT32)videoMode->pixelFormat,
+           videoReplayed ? L" (from bhava.plan)" : L"");
+   MarkBootPhase(timeline, videoReplayed ? "GOP plan replay" : "GOP enumeration");
+
+   bool modulesRead = FinishBootModules(moduleLoads, moduleLoadCount);
+   ChecksumManifest manifest {};
+   UINTN manifestSize    = 0;
+   UINT8 *manifestBuffer = LoadChecksumManifest(&bootVolume, &manifest, &manifestSize);
+   CloseBootVolume(&bootVolume);
+   if (rawVolumeMounted) {
+      UnmountFatVolume(&rawVolume);
+   }
+   if (!modulesRead) {
+      WaitForKey(L"Error: Could not read the boot modules into memory!");
+      return 1;
+   }
+   println(L"Loaded %lu boot modules into %lu bytes at 0x%lx.", bootInfo->modules.moduleCount,
+           bootInfo->modules.regionSize, bootInfo->modules.regionBase);
+   MarkBootPhase(timeline, "module read");
+
+   // Flaky storage should be caught here rather than show up later as mysterious faults.
+   UINTN checkedModules = 0;
+   if (!manifestBuffer) {
+      println(L"No bhava.sum found, boot modules will not be checked.");
+   } else if (!VerifyBootModules(&manifest, moduleLoads, moduleLoadCount, &bootInfo->modules,
+                                 &checkedModules)) {
+      WaitForKey(L"Error: A boot module is corrupt!");
+      return 1;
+   }
+   MarkBootPhase(timeline, "module verify");
+
+   // All headers are parsed as views into the module the kernel file was read into.
+   BootModule *kernelModule = FindBootModule(&bootInfo->modules, BootModuleType::Kernel);
+   UINT8 *kernelImage       = (UINT8 *)kernelModule->base;
+   UINTN kernelImageSize    = kernelModule->size;
+   // build.py can store the kernel as an LZ4 frame. Reading fewer bytes through the firmware file system
+   // driver is far slower than decompressing them again in memory.
+   if (IsLz4Frame(kernelImage, kernelImageSize)) {
+      // The compressed file is smaller than the segments it holds, so it is cheaper to recognise again.
+      if (config.bootPlan && manifestBuffer) {
+         plan.kernel.fileSize = kernelImageSize;
+         plan.kernel.fileCrc  = Crc32c(kernelImage, kernelImageSize);
+      }
+      UINTN compressedSize = kernelImageSize;
+      kernelImage          = DecompressLz4Image(kernelImage, compressedSize, &kernelImageSize);
+      if (!kernelImage) {
+         WaitForKey(L"Error: Could not decompress ELF Kernel File!");
+         return 1;
+      }
+      println(L"Decompressed kernel from %lu to %lu bytes.", compressedSize, kernelImageSize);
+      MarkBootPhase(timeline, "kernel decompress");
+   }
+
+   Elf64_Ehdr *elfHeaderData = ParseELFHeader(kernelImage, kernelImageSize);
+   if (!elfHeaderData) {
+      WaitForKey(L"");
+      return 1;
+   }
+   Elf64_Phdr *elfProgramHeader = ParseELFPHeader(elfHeaderData, kernelImage, kernelImageSize);
+   if (!elfProgramHeader) {
+      WaitForKey(L"");
+      return 1;
+   }
+
+   MarkBootPhase(timeline, "ELF parse");
 
    KernelEntry kmain;
-   GlobalInitializers globalObjCtorDtor;
-
-   // TODO: Handle multiple PT_LOAD headers. The kernel doesn't have any now but it could in the future.
-   for (int i = 0; i < elfHeaderData.e_phnum; i++) {
-      if (elfProgramHeader[i].p_type == PT_LOAD) {
-         void *kernelData = AllocatePagesForData(elfProgramHeader[i].p_memsz);
-         if (!kernelData) {
-            WaitForKey(L"Error: Could not allocate memory pages for kernel data!");
-            return 1;
-         }
-         // Read in filesz bytes instead of memsz bytes because memsz includes .bss section which isnt
-         // stored in the file on disk. If we used memsz we'd read in too much data (potentially).
-         UINTN kernelDiskSize = elfProgramHeader[i].p_filesz;
-         kernelHandle->SetPosition(kernelHandle, elfProgramHeader[i].p_offset);
-         kernelHandle->Read(kernelHandle, &kernelDiskSize, (void *)kernelData);
-
-         println(L"Kernel has been loaded into memory starting at address 0x%x.", kernelData);
-         kmain = (KernelEntry)TranslateKernelAddress((EFI_PHYSICAL_ADDRESS)kernelData, elfHeaderData.e_entry,
-                                                     elfProgramHeader[i].p_vaddr);
-         println(L"Kernel is stored in %d 4KiB pages and its exact size in bytes is %d.",
-                 GetDataPageSize(elfProgramHeader[i].p_memsz), elfProgramHeader[i].p_memsz);
-         println(L"Entry point kmain for kernel is loaded in memory at address 0x%x", kmain);
-
-         // Get section headers so we can retrieve our global constructors and destructors.
-         Elf64_Shdr *sectionHeaders = ParseELFSHeader(elfHeaderData, kernelHandle);
-         if (!sectionHeaders) {
-            break;
-         }
-         globalObjCtorDtor = ParseGlobalInitializers(sectionHeaders, elfHeaderData.e_shnum,
-                                                     (UINT8 *)kernelData, elfProgramHeader[i].p_vaddr);
+   GlobalInitializers globalObjCtorDtor {0};
+
+   KernelImageLayout kernelLayout {};
+   if (!LoadKernelSegments(elfHeaderData, elfProgramHeader, kernelImage, kernelImageSize, &kernelLayout)) {
+      WaitForKey(L"Error: Could not load kernel segments into memory!");
+      return 1;
+   }
+   MarkBootPhase(timeline, "segment load");
+   plan.kernel.layoutSize = kernelLayout.size;
+   plan.kernel.vaddrBase  = kernelLayout.vaddrBase;
+   plan.kernel.entry      = elfHeaderData->e_entry;
+   if (manifestBuffer) {
+      plan.kernel.manifestCrc = plan.kernel.fileSize != 0 ? Crc32c(manifestBuffer, manifestSize) : 0;
+      bool segmentsReplayed   = planLoaded && ReplayKernelPlan(&lastPlan, &plan.kernel);
+      UINTN checkedSegments   = 0;
+      bool segmentsValid      = segmentsReplayed || VerifyKernelSegments(&manifest, config.kernelPath,
+                                                                        elfHeaderData, elfProgramHeader,
+                                                                        kernelLayout, &checkedSegments);
+      ST->BootServices->FreePages((EFI_PHYSICAL_ADDRESS)manifestBuffer, GetDataPageSize(manifestSize));
+      if (!segmentsValid) {
+         WaitForKey(L"Error: The kernel is corrupt!");
+         return 1;
+      }
+      plan.kernel.segmentsVerified = 1;
+      if (segmentsReplayed) {
+         println(L"Checked %lu boot modules against bhava.sum (%s). bhava.plan has seen this kernel pass, so "
+                 L"its segments were not checked again.",
+                 checkedModules, cpuHasSse42 ? L"SSE4.2" : L"table");
+      } else {
+         println(L"Checked %lu boot modules and %lu kernel segments against bhava.sum (%s).", checkedModules,
+                 checkedSegments, cpuHasSse42 ? L"SSE4.2" : L"table");
       }
+      MarkBootPhase(timeline, "segment verify");
    }
+   // The kernel runs out of the higher half mapping we build for it, so all addresses we hand over are
+   // translated relative to KERNEL_VIRTUAL_BASE rather than to where the image sits physically.
+   kmain = (KernelEntry)TranslateKernelAddress(KERNEL_VIRTUAL_BASE, elfHeaderData->e_entry,
+                                               kernelLayout.vaddrBase);
+   println(L"Kernel has been loaded into memory starting at address 0x%lx.", kernelLayout.physicalBase);
+   println(L"Kernel is stored in %lu 4KiB pages and its exact size in bytes is %lu.",
+           kernelLayout.size / PAGE_SIZE, kernelLayout.size);
+   println(L"Entry point kmain for kernel will be mapped at virtual address %p", kmain);
+
+   if (elfHeaderData->e_type == ET_DYN) {
+      // A position independent kernel carries a relocation for every absolute address in its image, including
+      // its constructor and destructor tables, so once those are applied it can run at any address.
+      KernelDynamicInfo dynamicInfo;
+      if (!ParseKernelDynamic(elfHeaderData, elfProgramHeader, kernelLayout, &dynamicInfo)) {
+         WaitForKey(L"Error: Kernel dynamic section is missing or malformed!");
+         return 1;
+      }
+      UINT64 loadBias       = KERNEL_VIRTUAL_BASE - kernelLayout.vaddrBase;
+      UINTN relocationCount = 0;
+      RelocationError error = RelocateKernel(dynamicInfo, kernelLayout, loadBias, &relocationCount);
+      if (error != RelocationError::None) {
+         println(L"Error: Kernel relocation failed after %lu relocations (error %d).", relocationCount,
+                 (int)error);
+         WaitForKey(L"");
+         return 1;
+      }
+      println(L"Applied %lu relocations to the kernel.", relocationCount);
+      plan.kernel.relocationCount = relocationCount;
 
-   // Set up PC Screen Font.
-   EFI_FILE_PROTOCOL *fontHandle =
-      LoadRootDirFile(loadedImageInterface->DeviceHandle, ImageHandle, L"font.psf");
-   psf2_header psf2Header = ParsePSF2Header(fontHandle);
-   if (!VerifyPSF2File(psf2Header)) {
+      if (dynamicInfo.initArraySize != 0) {
+         globalObjCtorDtor.ctorAddresses = (uint64_t *)(dynamicInfo.initArray + loadBias);
+         globalObjCtorDtor.ctorCount     = dynamicInfo.initArraySize / sizeof(uint64_t);
+      }
+      if (dynamicInfo.finiArraySize != 0) {
+         globalObjCtorDtor.dtorAddresses = (uint64_t *)(dynamicInfo.finiArray + loadBias);
+         globalObjCtorDtor.dtorCount     = dynamicInfo.finiArraySize / sizeof(uint64_t);
+      }
+   } else {
+      // Kernels linked at a fixed address have no relocations, so the best we can do is patch up the
+      // constructor and destructor addresses by hand.
+      Elf64_Shdr *sectionHeaders = ParseELFSHeader(elfHeaderData, kernelImage, kernelImageSize);
+      if (sectionHeaders) {
+         globalObjCtorDtor = ParseGlobalInitializers(sectionHeaders, elfHeaderData->e_shnum, kernelImage,
+                                                     kernelImageSize, (UINT8 *)KERNEL_VIRTUAL_BASE,
+                                                     kernelLayout.vaddrBase);
+      }
+   }
+
+   // A separate symbol file is only worth loading if it has more symbols than the kernel, so prefer it when
+   // there is one. It has the same link-time addresses, so both use the same bias.
+   UINT64 symbolBias         = KERNEL_VIRTUAL_BASE - kernelLayout.vaddrBase;
+   BootModule *symbolsModule = FindBootModule(&bootInfo->modules, BootModuleType::Symbols);
+   if ((symbolsModule && BuildKernelSymbolTable((UINT8 *)symbolsModule->base, symbolsModule->size, symbolBias,
+                                                &bootInfo->symbols)) ||
+       BuildKernelSymbolTable(kernelImage, kernelImageSize, symbolBias, &bootInfo->symbols)) {
+      println(L"Indexed %lu kernel function symbols.", bootInfo->symbols.symbolCount);
+   } else {
+      println(L"Warning: The kernel has no symbol table, kernel addresses will not be symbolized.");
+   }
+   MarkBootPhase(timeline, "symbol index");
+
+   // Set up PC Screen Font. The glyphs are used directly out of the module the file was read into.
+   BootModule *fontModule = FindBootModule(&bootInfo->modules, BootModuleType::Font);
+   UINT8 *fontImage       = (UINT8 *)fontModule->base;
+   UINTN fontImageSize    = fontModule->size;
+   psf2_header *psf2Header = ParsePSF2Header(fontImage, fontImageSize);
+   if (!psf2Header || !VerifyPSF2File(*psf2Header)) {
       WaitForKey(L"Error: PC Screen Font file not recognized as PSF Version 2!");
       return 1;
    }
-   UINTN psf2fileSize = GetFileSize(fontHandle);
-   fontHandle->SetPosition(fontHandle, psf2Header.headerSize);
-   void *fontData = AllocatePagesForData(psf2Header.charSize * psf2Header.length);
-   if (!fontData) {
-      WaitForKey(L"Error: Could not allocate pages for PC Screen Font data!");
+   UINTN glyphDataSize = (UINTN)psf2Header->charSize * psf2Header->length;
+   if (psf2Header->headerSize > fontImageSize || glyphDataSize > fontImageSize - psf2Header->headerSize) {
+      WaitForKey(L"Error: PC Screen Font file is truncated!");
       return 1;
    }
-   fontHandle->Read(fontHandle, &psf2fileSize, (void **)fontData);
-   FontFormat fontFormat = {fontData, psf2Header.length, psf2Header.charSize, psf2Header.height,
-                            psf2Header.width};
+   void *fontData        = fontImage + psf2Header->headerSize;
+   // Expand the glyphs into per-pixel masks now, so the kernel never has to decode glyph bits itself.
+   UINT32 *glyphAtlas = (UINT32 *)AllocatePagesForData(GetGlyphAtlasSize(psf2Header), LOADER_HANDOFF_MEMORY);
+   if (!glyphAtlas) {
+      WaitForKey(L"Error: Could not allocate pages for the glyph atlas!");
+      return 1;
+   }
+   BuildGlyphAtlas(psf2Header, (UINT8 *)fontData, glyphAtlas);
+   UINT32 atlasRowStride = GetGlyphAtlasRowStride(psf2Header->width);
+   FontFormat fontFormat = {fontData,
+                            psf2Header->length,
+                            psf2Header->charSize,
+                            psf2Header->height,
+                            psf2Header->width,
+                            glyphAtlas,
+                            atlasRowStride * psf2Header->height,
+                            atlasRowStride};
+
+   println(L"Font has been loaded into memory starting at address %p.", fontData);
+   println(L"Font Data is stored in %lu 4KiB pages and its exact size in bytes is %lu.",
+           GetDataPageSize(fontImageSize), glyphDataSize);
+   println(L"Glyph atlas has been built at address %p, %lu bytes.", glyphAtlas,
+           GetGlyphAtlasSize(psf2Header));
+   MarkBootPhase(timeline, "font load");
+
+   // Only written when something changed, so booting the same images again and again never writes the disk.
+   if (config.bootPlan && HasBootPlanChanged(&plan, &lastPlan)) {
+      if (SaveBootPlan(loadedImageInterface->DeviceHandle, ImageHandle, &plan)) {
+         println(L"Recorded this boot in bhava.plan.");
+      } else {
+         println(L"Warning: Could not write bhava.plan, later boots will not be able to skip any work.");
+      }
+      MarkBootPhase(timeline, "boot plan write");
+   }
 
-   println(L"font.psf has been loaded into memory starting at address 0x%x.", fontData);
-   println(L"Font Data is stored in %d 4KiB pages and its exact size in bytes is %d.",
-           GetDataPageSize(psf2Header.charSize * psf2Header.length), psf2Header.charSize * psf2Header.length);
+   WaitBeforeBoot(config.autobootTimeout);
+   MarkBootPhase(timeline, "wait for key");
+   Framebuffer framebuffer {};
+   bool modeSet = SetVideoMode(&videoModes, videoMode, &framebuffer);
+   FreeVideoModeTable(&videoModes);
+   if (!modeSet) {
+      WaitForKey(L"Could not switch to the selected video mode.");
+      return 1;
+   }
+   MarkBootPhase(timeline, "SetMode");
 
-   // Get a suitable videomode.
-   UINT32 videoMode = GetVideoMode();
-   if (videoMode == -1) {
-      WaitForKey(L"Could not find suitable video mode.");
+   // The tables stay where the firmware put them, the kernel only gets told where they are.
+   AcpiError acpiError = BuildAcpiTableIndex(&bootInfo->acpi);
+   if (acpiError == AcpiError::None) {
+      println(L"Found %lu ACPI tables through the revision %lu RSDP at 0x%lx.", bootInfo->acpi.tableCount,
+              bootInfo->acpi.rsdpRevision, bootInfo->acpi.rsdpAddress);
+   } else {
+      println(L"Warning: Could not find the ACPI tables (error %d).", (int)acpiError);
+   }
+   MarkBootPhase(timeline, "ACPI");
+
+   // Build the kernel's address space while we can still allocate memory. The framebuffer is usually not
+   // described by the memory map, so make sure the identity and direct maps reach it as well.
+   UINT64 physicalLimit  = GetPhysicalMemoryLimit();
+   UINT64 framebufferEnd = (UINT64)framebuffer.frameBufferAddress + framebuffer.frameBufferSize;
+   if (framebufferEnd > physicalLimit) {
+      physicalLimit = framebufferEnd;
+   }
+   // kmain gets a stack of its own in the higher half, rather than whatever the firmware gave us.
+   if (!AllocateKernelStack(kernelLayout, processorCount, &bootInfo->stack, &bootInfo->perCpu)) {
+      WaitForKey(L"Error: Could not allocate the kernel stack!");
       return 1;
    }
+   if (!AllocateEarlyHeap(config.earlyHeapMiB, &bootInfo->earlyHeap)) {
+      WaitForKey(L"Error: Could not allocate the kernel's early heap! Try a smaller earlyheap setting.");
+      return 1;
+   }
+   println(L"Early heap of %lu KiB at physical address 0x%lx.", bootInfo->earlyHeap.size >> 10,
+           bootInfo->earlyHeap.physicalBase);
+   UINT64 *pml4 = AllocatePageTable();
+   if (!pml4 || !MapPhysicalMemory(pml4, physicalLimit, CpuSupportsGigabytePages()) ||
+       !MapKernelImage(pml4, kernelLayout) || !MapKernelStack(pml4, bootInfo->stack, bootInfo->perCpu)) {
+      WaitForKey(L"Error: Could not allocate the kernel page tables!");
+      return 1;
+   }
+   println(L"Kernel stack mapped at 0x%lx, guard page at 0x%lx.", bootInfo->stack.base,
+           bootInfo->stack.guardPage);
+   MarkBootPhase(timeline, "page tables");
+
+   bootInfo->framebuffer  = framebuffer;
+   bootInfo->font         = fontFormat;
+   bootInfo->initializers = globalObjCtorDtor;
 
-   WaitForKey(L"Ready to transfer control to kernel. Press any key to continue...");
-   Framebuffer framebuffer = SetUpFramebuffer(videoMode);
+   if (logBuffer) {
+      bootInfo->loaderLog = {loaderLog.buffer, loaderLog.capacity, loaderLog.written};
+   }
 
    // Cleanup
    SystemTable->BootServices->CloseProtocol(ImageHandle, &loadedImageProtocolGUID, ImageHandle, NULL);
-   MemoryMap uefiMemoryMap = ExitBootServices(ImageHandle, nullptr);
+   if (!ExitBootServices(ImageHandle, &bootInfo->memoryMap)) {
+      WaitForKey(L"Error: Could not exit boot services!");
+      return 1;
+   }
+   MarkBootPhase(timeline, "ExitBootServices");
+   LoadPageTables(pml4);
 
    // Execute kernel
-   int ret = kmain(framebuffer, fontFormat, globalObjCtorDtor);
-
-   return EFI_SUCCESS;
+   EnterKernel((void *)kmain, bootInfo, bootInfo->stack);
 }
 }
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+#include "boot/bootinfo.h"
+#include "pages.h"
+
+/*
+ * The early heap is a zeroed, physically contiguous block of memory the kernel can allocate from before it
+ * has a memory manager of its own. It is 2MiB aligned and a whole number of 2MiB pages long, so it lines up
+ * with the large pages of the direct map and the kernel can remap it with large pages without splitting any.
+ */
+
+/**
+ * @brief Allocates and zeroes the early heap.
+ * @param sizeMiB: The size of the heap in MiB. Rounded up to a multiple of 2MiB. 0 leaves the heap empty.
+ * @param OUTheap: Filled with the heap location, or zeroed if sizeMiB is 0.
+ *
+ * @return False if the memory could not be allocated.
+ */
+bool AllocateEarlyHeap(UINT32 sizeMiB, EarlyHeapRegion *OUTheap) {
+   *OUTheap = {};
+   if (sizeMiB == 0) {
+      return true;
+   }
+   UINT64 size = ((UINT64)sizeMiB * 0x100000 + LARGE_PAGE_SIZE - 1) & ~(UINT64)(LARGE_PAGE_SIZE - 1);
+   EFI_PHYSICAL_ADDRESS physicalBase =
+      AllocateAlignedPages(size / PAGE_SIZE, LARGE_PAGE_SIZE, LOADER_KERNEL_MEMORY);
+   if (physicalBase == 0) {
+      return false;
+   }
+   memset((void *)physicalBase, 0, size);
+   *OUTheap = {DIRECT_MAP_BASE + physicalBase, size, physicalBase};
+   return true;
+}
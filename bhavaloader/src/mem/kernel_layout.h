@@ -0,0 +1,12 @@
+#pragma once
+#include "../elf/elf_header.h"
+
+/** Describes where the loadable segments of the kernel ended up in physical memory. */
+struct KernelImageLayout {
+   /** 2MiB aligned physical address of the reservation holding every PT_LOAD segment. */
+   EFI_PHYSICAL_ADDRESS physicalBase;
+   /** The lowest segment virtual address rounded down to 2MiB. Maps to physicalBase. */
+   Elf64_Addr vaddrBase;
+   /** The size of the reservation in bytes. Always a multiple of 2MiB. */
+   UINTN size;
+};
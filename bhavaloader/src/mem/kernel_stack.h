@@ -0,0 +1,106 @@
+#pragma once
+#include "boot/bootinfo.h"
+#include "paging.h"
+
+/** The size of the stack kmain starts on. */
+#define KERNEL_STACK_SIZE 0x40000
+
+/*
+ * The kernel stack and the per-CPU areas share the 2MiB slot of virtual memory right after the kernel image.
+ * The image is mapped with 2MiB pages, so that slot is the first one free for 4KiB mappings:
+ *
+ *    guard page (unmapped) | stack (KERNEL_STACK_SIZE) | per-CPU areas (BOOT_MAX_CPUS * PER_CPU_AREA_SIZE)
+ */
+
+/**
+ * @brief Allocates the kernel stack and the per-CPU areas, and decides where they will be mapped.
+ * @param layout: Where the kernel segments were loaded.
+ * @param cpuCount: The number of enabled processors. Clamped to BOOT_MAX_CPUS.
+ * @param OUTstack: Filled with the stack layout.
+ * @param OUTperCpu: Filled with the per-CPU area layout. The areas are zeroed.
+ *
+ * @return False if the memory could not be allocated or the kernel image leaves no room for the slot.
+ */
+bool AllocateKernelStack(const KernelImageLayout &layout, UINTN cpuCount, KernelStack *OUTstack,
+                         PerCpuAreas *OUTperCpu) {
+   UINTN perCpuSize = BOOT_MAX_CPUS * PER_CPU_AREA_SIZE;
+   static_assert(PAGE_SIZE + KERNEL_STACK_SIZE + BOOT_MAX_CPUS * PER_CPU_AREA_SIZE <= LARGE_PAGE_SIZE,
+                 "The kernel stack and per-CPU areas must fit into a single 2MiB slot.");
+   // The image is mapped in the top 2GiB, and the slot has to fit in there after it.
+   if (layout.size > 0x80000000 - LARGE_PAGE_SIZE) {
+      return false;
+   }
+
+   EFI_PHYSICAL_ADDRESS stackAddress;
+   EFI_PHYSICAL_ADDRESS perCpuAddress;
+   if (ST->BootServices->AllocatePages(AllocateAnyPages, LOADER_KERNEL_MEMORY, KERNEL_STACK_SIZE / PAGE_SIZE,
+                                       &stackAddress) != EFI_SUCCESS) {
+      return false;
+   }
+   if (ST->BootServices->AllocatePages(AllocateAnyPages, LOADER_KERNEL_MEMORY, perCpuSize / PAGE_SIZE,
+                                       &perCpuAddress) != EFI_SUCCESS) {
+      ST->BootServices->FreePages(stackAddress, KERNEL_STACK_SIZE / PAGE_SIZE);
+      return false;
+   }
+   memset((void *)perCpuAddress, 0, perCpuSize);
+
+   UINT64 slotBase = KERNEL_VIRTUAL_BASE + layout.size;
+   *OUTstack       = {slotBase + PAGE_SIZE, KERNEL_STACK_SIZE, stackAddress, slotBase};
+   *OUTperCpu      = {slotBase + PAGE_SIZE + KERNEL_STACK_SIZE, PER_CPU_AREA_SIZE, BOOT_MAX_CPUS,
+                      cpuCount < BOOT_MAX_CPUS ? cpuCount : BOOT_MAX_CPUS, perCpuAddress};
+   return true;
+}
+
+/**
+ * @brief Maps a physically contiguous range with 4KiB pages.
+ * @param pml4: The root paging structure.
+ * @param virtualAddr: 4KiB aligned virtual address of the range.
+ * @param physicalAddr: 4KiB aligned physical address of the range.
+ * @param size: The size of the range in bytes. Must be a multiple of 4KiB.
+ *
+ * @return False if the paging structures could not be allocated.
+ */
+bool MapPages(UINT64 *pml4, UINT64 virtualAddr, UINT64 physicalAddr, UINTN size) {
+   for (UINTN offset = 0; offset < size; offset += PAGE_SIZE) {
+      if (!MapPage(pml4, virtualAddr + offset, physicalAddr + offset)) {
+         return false;
+      }
+   }
+   return true;
+}
+
+/**
+ * @brief Maps the kernel stack and the per-CPU areas. The guard page is simply left out.
+ * @param pml4: The root paging structure.
+ * @param stack: The stack set up by AllocateKernelStack().
+ * @param perCpu: The per-CPU areas set up by AllocateKernelStack().
+ *
+ * @return False if the paging structures could not be allocated.
+ */
+bool MapKernelStack(UINT64 *pml4, const KernelStack &stack, const PerCpuAreas &perCpu) {
+   return MapPages(pml4, stack.base, stack.physicalBase, stack.size) &&
+          MapPages(pml4, perCpu.base, perCpu.physicalBase, perCpu.maxCpuCount * perCpu.areaSize);
+}
+
+/**
+ * @brief Switches to the kernel stack and calls the kernel entry point. Only call this once the kernel page
+ * tables are active, as the stack only exists in the higher half.
+ * @param entry: The kernel entry point. Called with the System V ABI.
+ * @param bootInfo: Passed to the kernel entry point.
+ * @param stack: The stack to switch to.
+ */
+[[noreturn]] void EnterKernel(void *entry, BootInfo *bootInfo, const KernelStack &stack) {
+   UINT64 stackTop = stack.base + stack.size;
+   // The stack top is page aligned, so the stack is 16 byte aligned at the call as the ABI requires. A zero
+   // frame pointer ends stack walks in the kernel. Should kmain ever return, there is nothing to go back to.
+   __asm__ volatile("mov %0, %%rsp\n\t"
+                    "xor %%ebp, %%ebp\n\t"
+                    "call *%%rax\n\t"
+                    "1:\n\t"
+                    "hlt\n\t"
+                    "jmp 1b"
+                    :
+                    : "r"(stackTop), "a"(entry), "D"(bootInfo)
+                    : "memory");
+   __builtin_unreachable();
+}
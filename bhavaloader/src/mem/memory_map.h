@@ -0,0 +1,76 @@
+#pragma once
+#include "paging.h"
+
+/**
+ * @brief Decides how the kernel may treat memory of a given UEFI memory type once boot services have exited.
+ * @param efiType: The UEFI memory type of a memory descriptor.
+ *
+ * @return The kernel's classification of the memory.
+ */
+MemoryRegionType ClassifyMemoryType(UINT32 efiType) {
+   switch (efiType) {
+   case EfiConventionalMemory: return MemoryRegionType::Usable;
+   // Everything the loader allocates is tagged with one of its own types, so what is left of EfiLoaderData
+   // is firmware memory allocated on its behalf. The kernel enters on the firmware's GDT and IDT, which sit
+   // in boot services memory, so none of these may be reused before the kernel has loaded its own.
+   case EfiLoaderCode:
+   case EfiLoaderData:
+   case EfiBootServicesCode:
+   case EfiBootServicesData:
+   case LOADER_SCRATCH_MEMORY: return MemoryRegionType::Reclaimable;
+   case EfiACPIReclaimMemory: return MemoryRegionType::AcpiReclaimable;
+   case EfiACPIMemoryNVS: return MemoryRegionType::AcpiNvs;
+   case EfiMemoryMappedIO:
+   case EfiMemoryMappedIOPortSpace: return MemoryRegionType::Mmio;
+   case LOADER_KERNEL_MEMORY: return MemoryRegionType::KernelImage;
+   case LOADER_MODULE_MEMORY: return MemoryRegionType::BootModules;
+   case LOADER_HANDOFF_MEMORY: return MemoryRegionType::LoaderHandoff;
+   default: return MemoryRegionType::Reserved;
+   }
+}
+
+/**
+ * @brief Converts a raw UEFI memory map into a sorted, coalesced table of memory regions.
+ *
+ * This must not allocate memory, since it runs between the final GetMemoryMap() and ExitBootServices().
+ * @param memoryMap: The first descriptor of the UEFI memory map.
+ * @param memoryMapSize: The size of the memory map, in bytes.
+ * @param descriptorSize: The size of a single descriptor, in bytes. May be larger than the struct.
+ * @param OUTregions: The array to fill. Must hold at least one entry per descriptor.
+ *
+ * @return The number of regions written to OUTregions.
+ */
+UINTN BuildMemoryRegionTable(EFI_MEMORY_DESCRIPTOR *memoryMap, UINTN memoryMapSize, UINTN descriptorSize,
+                             MemoryRegion *OUTregions) {
+   UINTN count = 0;
+   for (UINTN offset = 0; offset < memoryMapSize; offset += descriptorSize) {
+      EFI_MEMORY_DESCRIPTOR *descriptor = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)memoryMap + offset);
+      if (descriptor->NumberOfPages == 0) {
+         continue;
+      }
+      MemoryRegion region = {descriptor->PhysicalStart, descriptor->NumberOfPages * PAGE_SIZE,
+                             ClassifyMemoryType(descriptor->Type), 0};
+
+      // Firmware maps are nearly always sorted already, so an insertion sort does almost no work.
+      UINTN i = count;
+      while (i > 0 && OUTregions[i - 1].base > region.base) { i--; }
+      if (i != count) {
+         memmove(&OUTregions[i + 1], &OUTregions[i], (count - i) * sizeof(MemoryRegion));
+      }
+      OUTregions[i] = region;
+      count++;
+   }
+
+   // Merge neighbouring regions of the same type that touch.
+   UINTN merged = 0;
+   for (UINTN i = 0; i < count; i++) {
+      if (merged > 0 && OUTregions[merged - 1].type == OUTregions[i].type &&
+          OUTregions[merged - 1].base + OUTregions[merged - 1].length == OUTregions[i].base) {
+         OUTregions[merged - 1].length += OUTregions[i].length;
+      } else {
+         OUTregions[merged] = OUTregions[i];
+         merged++;
+      }
+   }
+   return merged;
+}
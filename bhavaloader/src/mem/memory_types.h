@@ -0,0 +1,18 @@
+#pragma once
+
+/*
+ * UEFI leaves the memory types from 0x80000000 up to the OS loader. Every allocation the loader makes is
+ * tagged with one of these rather than EfiLoaderData, so the memory map handed to the kernel tells it what
+ * each range holds. Scratch memory can then be reclaimed together with the firmware's boot services memory in
+ * a single pass, without the kernel having to know which loader allocations are still live. That pass has to
+ * wait until the kernel has loaded its own GDT and IDT, as the firmware's live in boot services memory.
+ */
+
+/** The kernel segments, the kernel stack, the per-CPU areas and the early heap. */
+#define LOADER_KERNEL_MEMORY  ((EFI_MEMORY_TYPE)0x80000000)
+/** The boot module region. */
+#define LOADER_MODULE_MEMORY  ((EFI_MEMORY_TYPE)0x80000001)
+/** Everything else the kernel is handed: BootInfo, the log, the page tables and the tables built for it. */
+#define LOADER_HANDOFF_MEMORY ((EFI_MEMORY_TYPE)0x80000002)
+/** Memory the loader only needs until it enters the kernel. */
+#define LOADER_SCRATCH_MEMORY ((EFI_MEMORY_TYPE)0x80000003)
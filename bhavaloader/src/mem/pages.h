@@ -0,0 +1,68 @@
+#pragma once
+#include "paging.h"
+
+/** @brief Gets the number of pages needed to store data of a given size. Will round up to the nearest
+ * whole number of pages.
+ * @param dataSize: The size of the data, in bytes.
+ *
+ * @return The number of 4KiB UEFI pages that need to be allocated to store this data.
+ */
+UINTN GetDataPageSize(UINTN dataSize) {
+   if (dataSize / (1024 * 4) == 0) {
+      return 1;
+   } else {
+      return (UINTN(dataSize / (1024 * 4))) + 1;
+   }
+}
+
+/**
+ * @brief Allocates the necessary number of pages at any address.
+ * @param dataSize: The size of the data, in bytes.
+ * @param memoryType: What the pages will hold, one of the LOADER_*_MEMORY types.
+ *
+ * @return: The address of the beginning of the newly allocated pages, or nullptr on failure.
+ */
+void *AllocatePagesForData(UINTN dataSize, EFI_MEMORY_TYPE memoryType) {
+   EFI_PHYSICAL_ADDRESS addr;
+   UINTN numPages    = GetDataPageSize(dataSize);
+   EFI_STATUS status = ST->BootServices->AllocatePages(AllocateAnyPages, memoryType, numPages, &addr);
+
+   if (status != 0) {
+      ST->BootServices->FreePages(addr, numPages);
+      return nullptr;
+   } else {
+      return (void *)addr;
+   }
+}
+
+/**
+ * @brief Allocates a run of pages at any address whose start is aligned to a given power of two.
+ *
+ * UEFI has no way of requesting an alignment larger than a page, so we over-allocate by the alignment and
+ * hand the unaligned head and tail of the run back to the firmware.
+ * @param numPages: The number of 4KiB pages to allocate.
+ * @param alignment: The required alignment in bytes. Must be a power of two and a multiple of 4KiB.
+ * @param memoryType: What the pages will hold, one of the LOADER_*_MEMORY types.
+ *
+ * @return The aligned physical address of the allocation, or 0 on failure.
+ */
+EFI_PHYSICAL_ADDRESS AllocateAlignedPages(UINTN numPages, UINTN alignment, EFI_MEMORY_TYPE memoryType) {
+   UINTN slackPages = (alignment / PAGE_SIZE) - 1;
+   EFI_PHYSICAL_ADDRESS addr;
+   EFI_STATUS status =
+      ST->BootServices->AllocatePages(AllocateAnyPages, memoryType, numPages + slackPages, &addr);
+   if (status != EFI_SUCCESS) {
+      return 0;
+   }
+
+   EFI_PHYSICAL_ADDRESS alignedAddr = (addr + alignment - 1) & ~(EFI_PHYSICAL_ADDRESS)(alignment - 1);
+   UINTN headPages                  = (alignedAddr - addr) / PAGE_SIZE;
+   UINTN tailPages                  = slackPages - headPages;
+   if (headPages != 0) {
+      ST->BootServices->FreePages(addr, headPages);
+   }
+   if (tailPages != 0) {
+      ST->BootServices->FreePages(alignedAddr + numPages * PAGE_SIZE, tailPages);
+   }
+   return alignedAddr;
+}
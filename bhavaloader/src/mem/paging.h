@@ -0,0 +1,177 @@
+#pragma once
+#include "../elf/elf_header.h"
+#include "../util/memcpy.h"
+#include "kernel_layout.h"
+#include "memory_types.h"
+
+#define PAGE_SIZE       0x1000
+#define LARGE_PAGE_SIZE 0x200000
+
+/** The kernel image is mapped in the top 2GiB of the address space. */
+#define KERNEL_VIRTUAL_BASE 0xFFFFFFFF80000000
+/** All of physical memory is mapped linearly starting here, at the beginning of the higher half. */
+#define DIRECT_MAP_BASE 0xFFFF800000000000
+
+#define PTE_PRESENT  (1ull << 0)
+#define PTE_WRITABLE (1ull << 1)
+#define PTE_LARGE    (1ull << 7)
+#define PTE_ADDRESS  0x000FFFFFFFFFF000ull
+
+#define GIGABYTE_PAGE_SIZE 0x40000000ull
+
+/**
+ * @brief Allocates a single zeroed 4KiB page to be used as a paging structure.
+ *
+ * @return A pointer to the new table, or nullptr on failure.
+ */
+UINT64 *AllocatePageTable() {
+   EFI_PHYSICAL_ADDRESS addr;
+   if (ST->BootServices->AllocatePages(AllocateAnyPages, LOADER_HANDOFF_MEMORY, 1, &addr) != EFI_SUCCESS) {
+      return nullptr;
+   }
+   memset((void *)addr, 0, PAGE_SIZE);
+   return (UINT64 *)addr;
+}
+
+/**
+ * @brief Gets the next level paging structure referenced by an entry, creating it if it does not exist.
+ * @param table: The current level paging structure.
+ * @param index: The index of the entry in the current level.
+ *
+ * @return A pointer to the next level table, or nullptr if one could not be allocated.
+ */
+UINT64 *GetOrCreateNextTable(UINT64 *table, UINTN index) {
+   if (table[index] & PTE_PRESENT) {
+      return (UINT64 *)(table[index] & PTE_ADDRESS);
+   }
+   UINT64 *next = AllocatePageTable();
+   if (next) {
+      table[index] = (UINT64)next | PTE_PRESENT | PTE_WRITABLE;
+   }
+   return next;
+}
+
+/**
+ * @brief Maps a single 4KiB page. The 2MiB region around it must not already be mapped by a large page.
+ * @param pml4: The root paging structure.
+ * @param virtualAddr: 4KiB aligned virtual address to map.
+ * @param physicalAddr: 4KiB aligned physical address to map it to.
+ *
+ * @return False if an intermediate table could not be allocated.
+ */
+bool MapPage(UINT64 *pml4, UINT64 virtualAddr, UINT64 physicalAddr) {
+   UINT64 *pdpt = GetOrCreateNextTable(pml4, (virtualAddr >> 39) & 0x1FF);
+   if (!pdpt) {
+      return false;
+   }
+   UINT64 *pd = GetOrCreateNextTable(pdpt, (virtualAddr >> 30) & 0x1FF);
+   if (!pd) {
+      return false;
+   }
+   UINT64 *pt = GetOrCreateNextTable(pd, (virtualAddr >> 21) & 0x1FF);
+   if (!pt) {
+      return false;
+   }
+   pt[(virtualAddr >> 12) & 0x1FF] = physicalAddr | PTE_PRESENT | PTE_WRITABLE;
+   return true;
+}
+
+/**
+ * @brief Maps a single 2MiB page.
+ * @param pml4: The root paging structure.
+ * @param virtualAddr: 2MiB aligned virtual address to map.
+ * @param physicalAddr: 2MiB aligned physical address to map it to.
+ *
+ * @return False if an intermediate table could not be allocated.
+ */
+bool MapLargePage(UINT64 *pml4, UINT64 virtualAddr, UINT64 physicalAddr) {
+   UINT64 *pdpt = GetOrCreateNextTable(pml4, (virtualAddr >> 39) & 0x1FF);
+   if (!pdpt) {
+      return false;
+   }
+   UINT64 *pd = GetOrCreateNextTable(pdpt, (virtualAddr >> 30) & 0x1FF);
+   if (!pd) {
+      return false;
+   }
+   pd[(virtualAddr >> 21) & 0x1FF] = physicalAddr | PTE_PRESENT | PTE_WRITABLE | PTE_LARGE;
+   return true;
+}
+
+/**
+ * @brief Maps a single 1GiB page. The CPU must support pdpe1gb.
+ * @param pml4: The root paging structure.
+ * @param virtualAddr: 1GiB aligned virtual address to map.
+ * @param physicalAddr: 1GiB aligned physical address to map it to.
+ *
+ * @return False if an intermediate table could not be allocated.
+ */
+bool MapGigabytePage(UINT64 *pml4, UINT64 virtualAddr, UINT64 physicalAddr) {
+   UINT64 *pdpt = GetOrCreateNextTable(pml4, (virtualAddr >> 39) & 0x1FF);
+   if (!pdpt) {
+      return false;
+   }
+   pdpt[(virtualAddr >> 30) & 0x1FF] = physicalAddr | PTE_PRESENT | PTE_WRITABLE | PTE_LARGE;
+   return true;
+}
+
+/**
+ * @brief Maps physical memory from 0 up to physicalLimit both at its identity address and in the direct map
+ * at DIRECT_MAP_BASE.
+ *
+ * The identity map is required so the loader keeps running across the CR3 switch, and so every pointer we
+ * hand to the kernel stays valid. Both ranges share the same PDPTs, so the direct map costs no extra tables.
+ * @param pml4: The root paging structure.
+ * @param physicalLimit: The highest physical address that must be reachable.
+ * @param useGigabytePages: Whether to map with 1GiB pages rather than 2MiB pages.
+ *
+ * @return False if the paging structures could not be allocated.
+ */
+bool MapPhysicalMemory(UINT64 *pml4, UINT64 physicalLimit, bool useGigabytePages) {
+   UINT64 limit = (physicalLimit + GIGABYTE_PAGE_SIZE - 1) & ~(GIGABYTE_PAGE_SIZE - 1);
+   if (useGigabytePages) {
+      for (UINT64 addr = 0; addr < limit; addr += GIGABYTE_PAGE_SIZE) {
+         if (!MapGigabytePage(pml4, addr, addr)) {
+            return false;
+         }
+      }
+   } else {
+      for (UINT64 addr = 0; addr < limit; addr += LARGE_PAGE_SIZE) {
+         if (!MapLargePage(pml4, addr, addr)) {
+            return false;
+         }
+      }
+   }
+
+   // DIRECT_MAP_BASE is 512GiB aligned, so each PML4 entry of the identity map can simply be aliased.
+   UINTN directMapIndex = (DIRECT_MAP_BASE >> 39) & 0x1FF;
+   for (UINTN i = 0; i < directMapIndex && (pml4[i] & PTE_PRESENT); i++) {
+      pml4[directMapIndex + i] = pml4[i];
+   }
+   return true;
+}
+
+/**
+ * @brief Maps the loaded kernel image at KERNEL_VIRTUAL_BASE using 2MiB pages.
+ * @param pml4: The root paging structure.
+ * @param layout: Where the kernel segments were loaded.
+ *
+ * @return False if the paging structures could not be allocated.
+ */
+bool MapKernelImage(UINT64 *pml4, KernelImageLayout layout) {
+   for (UINTN offset = 0; offset < layout.size; offset += LARGE_PAGE_SIZE) {
+      if (!MapLargePage(pml4, KERNEL_VIRTUAL_BASE + offset, layout.physicalBase + offset)) {
+         return false;
+      }
+   }
+   return true;
+}
+
+/**
+ * @brief Switches the CPU over to the given paging structures. Only call this after exiting boot services,
+ * as the firmware expects its own page tables to remain active while it is in control.
+ * @param pml4: The root paging structure.
+ */
+void LoadPageTables(UINT64 *pml4) {
+   // Nothing is left to service an interrupt at this point, so make sure none arrive mid-switch.
+   __asm__ volatile("cli; mov %0, %%cr3" : : "r"(pml4) : "memory");
+}
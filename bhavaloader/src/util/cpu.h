@@ -0,0 +1,48 @@
+#pragma once
+
+struct CpuidResult {
+   UINT32 eax;
+   UINT32 ebx;
+   UINT32 ecx;
+   UINT32 edx;
+};
+
+/**
+ * @brief Executes the CPUID instruction.
+ * @param leaf: The value of EAX, selecting which information to query.
+ * @param subleaf: The value of ECX, for leaves that have subleaves.
+ *
+ * @return The values of the four registers CPUID returns.
+ */
+CpuidResult Cpuid(UINT32 leaf, UINT32 subleaf = 0) {
+   CpuidResult result;
+   __asm__ volatile("cpuid"
+                    : "=a"(result.eax), "=b"(result.ebx), "=c"(result.ecx), "=d"(result.edx)
+                    : "a"(leaf), "c"(subleaf));
+   return result;
+}
+
+/**
+ * @brief Checks whether the CPU can map 1GiB pages through the PDPT (CPUID pdpe1gb).
+ *
+ * @return True if 1GiB pages are supported.
+ */
+bool CpuSupportsGigabytePages() {
+   if (Cpuid(0x80000000).eax < 0x80000001) {
+      return false;
+   }
+   return (Cpuid(0x80000001).edx & (1 << 26)) != 0;
+}
+
+/**
+ * @brief Measures how fast the TSC ticks by timing a short firmware Stall(). Boot services must be active.
+ *
+ * @return The approximate number of TSC ticks per second.
+ */
+UINT64 CalibrateTscFrequency() {
+   const UINTN calibrationMicroseconds = 1000;
+   UINT64 start                        = __builtin_ia32_rdtsc();
+   ST->BootServices->Stall(calibrationMicroseconds);
+   UINT64 end = __builtin_ia32_rdtsc();
+   return (end - start) * (1000000 / calibrationMicroseconds);
+}
@@ -0,0 +1,184 @@
+#pragma once
+#include "stdarg.h"
+
+/*
+ * The loader log. Everything the loader prints is formatted as ASCII text into a ring buffer, and only copied
+ * out to the UEFI console in batches: every OutputString() call can take milliseconds on real hardware. In
+ * quiet mode nothing is copied out at all unless something goes wrong. The buffer is handed to the kernel, so
+ * the whole log can be reviewed after boot either way.
+ */
+
+/** The size of the buffer the log is moved into once page allocation is available. */
+#define LOG_BUFFER_SIZE       0x10000
+/** The size of the buffer used before then. */
+#define LOG_EARLY_BUFFER_SIZE 0x400
+/** Pending output is copied out to the console once this many characters have accumulated. */
+#define LOG_FLUSH_THRESHOLD   0x800
+/** The maximum number of characters handed to the console in a single OutputString() call. */
+#define LOG_CONSOLE_CHUNK     0x200
+
+struct LogState {
+   char *buffer;
+   UINT64 capacity;
+   /** The total number of characters ever logged. The newest character is at (written - 1) % capacity. */
+   UINT64 written;
+   /** The total number of characters ever copied out to the console. */
+   UINT64 flushed;
+   /** When set, the log is never copied out to the console. */
+   bool quiet;
+};
+
+char earlyLogBuffer[LOG_EARLY_BUFFER_SIZE];
+LogState loaderLog = {earlyLogBuffer, LOG_EARLY_BUFFER_SIZE, 0, 0, false};
+
+void LogPutChar(char c) {
+   loaderLog.buffer[loaderLog.written % loaderLog.capacity] = c;
+   loaderLog.written++;
+}
+
+/**
+ * @brief Moves the log into a larger buffer, keeping everything logged so far.
+ * @param buffer: The new buffer. Must stay valid for as long as the log is in use.
+ * @param capacity: The size of the new buffer in bytes. Must not be smaller than the current buffer.
+ */
+void LogMoveToBuffer(char *buffer, UINT64 capacity) {
+   UINT64 kept  = loaderLog.written < loaderLog.capacity ? loaderLog.written : loaderLog.capacity;
+   UINT64 start = loaderLog.written - kept;
+   for (UINT64 i = 0; i < kept; i++) { buffer[i] = loaderLog.buffer[(start + i) % loaderLog.capacity]; }
+   // Keep the running totals in sync with the new buffer, so that the oldest kept character lands at index 0.
+   loaderLog.buffer   = buffer;
+   loaderLog.capacity = capacity;
+   loaderLog.flushed  = loaderLog.flushed > start ? loaderLog.flushed - start : 0;
+   loaderLog.written  = kept;
+}
+
+/**
+ * @brief Copies everything logged since the last flush out to the UEFI console. Does nothing in quiet mode.
+ *
+ * Characters that were overwritten before they could be flushed are skipped, and the gap is marked.
+ */
+void LogFlush() {
+   if (loaderLog.quiet || loaderLog.flushed == loaderLog.written) {
+      return;
+   }
+   // Room for every character to become a CR LF pair, plus the null terminator.
+   CHAR16 chunk[LOG_CONSOLE_CHUNK * 2 + 1];
+   UINTN chunkLength = 0;
+   if (loaderLog.written - loaderLog.flushed > loaderLog.capacity) {
+      loaderLog.flushed = loaderLog.written - loaderLog.capacity;
+      ST->ConOut->OutputString(ST->ConOut, (CHAR16 *)L"...\r\n");
+   }
+   while (loaderLog.flushed < loaderLog.written) {
+      char c = loaderLog.buffer[loaderLog.flushed % loaderLog.capacity];
+      loaderLog.flushed++;
+      // The UEFI console needs a carriage return as well to move the cursor back to the start of the row.
+      if (c == '\n') {
+         chunk[chunkLength++] = L'\r';
+      }
+      chunk[chunkLength++] = c;
+      if (chunkLength >= LOG_CONSOLE_CHUNK * 2 - 1 || loaderLog.flushed == loaderLog.written) {
+         chunk[chunkLength] = 0;
+         ST->ConOut->OutputString(ST->ConOut, chunk);
+         chunkLength = 0;
+      }
+   }
+}
+
+/**
+ * @brief Flushes the log if enough output has accumulated to be worth a trip to the console.
+ */
+void LogFlushIfNeeded() {
+   if (loaderLog.written - loaderLog.flushed >= LOG_FLUSH_THRESHOLD) {
+      LogFlush();
+   }
+}
+
+/**
+ * @brief Logs an unsigned number.
+ * @param value: The number to log.
+ * @param base: The base to log the number in, between 2 and 16.
+ */
+void LogPutUnsigned(UINT64 value, UINT32 base) {
+   // Enough for the longest 64 bit number, in binary.
+   char digits[64];
+   int length = 0;
+   do {
+      UINT32 digit     = value % base;
+      digits[length++] = digit < 10 ? '0' + digit : 'A' + digit - 10;
+      value /= base;
+   } while (value != 0);
+   while (length > 0) { LogPutChar(digits[--length]); }
+}
+
+/**
+ * @brief Logs a null terminated UCS-2 string. Anything outside of ASCII is logged as '?'.
+ */
+void LogPutString(const CHAR16 *string) {
+   if (!string) {
+      string = (const CHAR16 *)L"(null)";
+   }
+   for (; *string != 0; string++) { LogPutChar(*string < 0x80 ? (char)*string : '?'); }
+}
+
+/**
+ * @brief Formats a string into the log. Output is bounded only by the size of the ring buffer, which simply
+ * drops the oldest characters when it fills up.
+ *
+ * Supported conversions are %d (signed decimal), %u (unsigned decimal), %x (hexadecimal), %s (a CHAR16
+ * string), %p (a pointer, in hexadecimal) and %%. The integer conversions take 32 bit arguments, or 64 bit
+ * arguments (UINT64, UINTN, EFI_PHYSICAL_ADDRESS...) when prefixed with l, as in %lx.
+ * @param fmt: The format string.
+ * @param args: The values to format.
+ */
+void LogFormat(const wchar_t *fmt, va_list args) {
+   for (; *fmt != 0; fmt++) {
+      if (*fmt != L'%') {
+         LogPutChar(*fmt < 0x80 ? (char)*fmt : '?');
+         continue;
+      }
+
+      fmt++;
+      bool is64Bit = *fmt == L'l';
+      if (is64Bit) {
+         fmt++;
+      }
+      switch (*fmt) {
+      case L'd': {
+         INT64 value = is64Bit ? va_arg(args, INT64) : va_arg(args, INT32);
+         if (value < 0) {
+            LogPutChar('-');
+            // Negate as unsigned, so the most negative value does not overflow.
+            LogPutUnsigned(0 - (UINT64)value, 10);
+         } else {
+            LogPutUnsigned(value, 10);
+         }
+         break;
+      }
+      case L'u':
+         LogPutUnsigned(is64Bit ? va_arg(args, UINT64) : va_arg(args, UINT32), 10);
+         break;
+      case L'x':
+         LogPutUnsigned(is64Bit ? va_arg(args, UINT64) : va_arg(args, UINT32), 16);
+         break;
+      case L'p':
+         LogPutChar('0');
+         LogPutChar('x');
+         LogPutUnsigned((UINT64)va_arg(args, void *), 16);
+         break;
+      case L's':
+         LogPutString(va_arg(args, const CHAR16 *));
+         break;
+      case L'%':
+         LogPutChar('%');
+         break;
+      case 0:
+         // A lone % at the end of the format string.
+         return;
+      default:
+         // Unknown conversions are logged as they are, so mistakes are visible rather than eating arguments.
+         LogPutChar('%');
+         LogPutChar(*fmt < 0x80 ? (char)*fmt : '?');
+         break;
+      }
+   }
+}
@@ -0,0 +1,373 @@
+#pragma once
+#include "../mem/memory_types.h"
+#include "memcpy.h"
+#include "mp.h"
+
+/*
+ * A small LZ4 frame decompressor for the loader. See https://github.com/lz4/lz4/blob/dev/doc for the frame
+ * and block format descriptions.
+ *
+ * The whole frame is always decoded into one contiguous output buffer, so linked blocks (whose matches may
+ * reach back into previous blocks) need no extra window handling. Checksums are skipped: the loader verifies
+ * the data it loads separately.
+ *
+ * Frames with independent blocks are decoded on all processors at once. Encoders fill every block except
+ * the last up to the maximum block size unless they flush early, so each block is placed as if it did. A
+ * frame where a block comes up short is decoded again in order.
+ */
+
+#define LZ4_FRAME_MAGIC            0x184D2204
+#define LZ4_FLG_VERSION_MASK       0xC0
+#define LZ4_FLG_VERSION            0x40
+#define LZ4_FLG_BLOCK_INDEPENDENCE (1 << 5)
+#define LZ4_FLG_BLOCK_CHECKSUM     (1 << 4)
+#define LZ4_FLG_CONTENT_SIZE       (1 << 3)
+#define LZ4_FLG_DICTIONARY_ID      (1 << 0)
+#define LZ4_BLOCK_UNCOMPRESSED     0x80000000
+#define LZ4_MIN_MATCH              4
+/** Matches and literals are copied in 8 byte chunks while at least this much output space remains. */
+#define LZ4_WILDCOPY_MARGIN        16
+
+/** The parts of an LZ4 frame header the loader cares about. */
+struct Lz4FrameInfo {
+   /** Offset of the first block from the start of the frame. */
+   UINTN headerSize;
+   /** The decompressed size of the frame, or 0 if the frame does not record it. */
+   UINT64 contentSize;
+   /** The most a single block can decompress to, in bytes. */
+   UINTN blockMaxSize;
+   bool hasBlockChecksums;
+   /** Set if no block references data of the blocks before it. */
+   bool blocksIndependent;
+};
+
+UINT32 Lz4ReadLE32(const UINT8 *data) {
+   return (UINT32)data[0] | ((UINT32)data[1] << 8) | ((UINT32)data[2] << 16) | ((UINT32)data[3] << 24);
+}
+
+/**
+ * @brief Checks whether a buffer starts with an LZ4 frame.
+ * @param data: The buffer to check.
+ * @param size: The size of the buffer, in bytes.
+ *
+ * @return True if the buffer starts with the LZ4 frame magic number.
+ */
+bool IsLz4Frame(const UINT8 *data, UINTN size) {
+   return size >= 4 && Lz4ReadLE32(data) == LZ4_FRAME_MAGIC;
+}
+
+/**
+ * @brief Parses the header of an LZ4 frame.
+ * @param data: The start of the frame.
+ * @param size: The size of the buffer holding the frame, in bytes.
+ * @param OUTinfo: Filled with the frame information.
+ *
+ * @return False if the header is malformed or uses an unsupported version.
+ */
+bool ParseLz4FrameHeader(const UINT8 *data, UINTN size, Lz4FrameInfo *OUTinfo) {
+   // Magic, FLG, BD and the header checksum are always present.
+   if (!IsLz4Frame(data, size) || size < 7) {
+      return false;
+   }
+   UINT8 flags = data[4];
+   if ((flags & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION) {
+      return false;
+   }
+   // BD holds the maximum block size as 4 (64 KiB) to 7 (4 MiB) in bits 4-6.
+   UINT8 blockMaxSizeId = (data[5] >> 4) & 0x7;
+   if (blockMaxSizeId < 4) {
+      return false;
+   }
+
+   UINTN headerSize   = 6;
+   UINT64 contentSize = 0;
+   if (flags & LZ4_FLG_CONTENT_SIZE) {
+      if (size < headerSize + 8) {
+         return false;
+      }
+      contentSize = Lz4ReadLE32(data + headerSize) | ((UINT64)Lz4ReadLE32(data + headerSize + 4) << 32);
+      headerSize += 8;
+   }
+   if (flags & LZ4_FLG_DICTIONARY_ID) {
+      // Frames compressed against an external dictionary cannot be decoded without it.
+      return false;
+   }
+   // Skip the header checksum.
+   headerSize += 1;
+   if (size < headerSize) {
+      return false;
+   }
+
+   *OUTinfo = {headerSize, contentSize, (UINTN)1 << (2 * blockMaxSizeId + 8),
+               (flags & LZ4_FLG_BLOCK_CHECKSUM) != 0, (flags & LZ4_FLG_BLOCK_INDEPENDENCE) != 0};
+   return true;
+}
+
+/**
+ * @brief Decodes a single compressed LZ4 block.
+ * @param src: The compressed block data.
+ * @param srcSize: The size of the compressed block, in bytes.
+ * @param dstStart: The start of the whole output buffer. Matches may reach back to here but no further.
+ * @param dst: Where the decoded data of this block starts.
+ * @param dstEnd: One past the end of the output buffer.
+ *
+ * @return One past the last byte written, or nullptr if the block is malformed.
+ */
+UINT8 *Lz4DecodeBlock(const UINT8 *src, UINTN srcSize, UINT8 *dstStart, UINT8 *dst, UINT8 *dstEnd) {
+   const UINT8 *srcEnd = src + srcSize;
+
+   while (src < srcEnd) {
+      UINT8 token = *src++;
+
+      // Literal run.
+      UINTN literalLength = token >> 4;
+      if (literalLength == 15) {
+         UINT8 extra;
+         do {
+            if (src >= srcEnd) {
+               return nullptr;
+            }
+            extra = *src++;
+            literalLength += extra;
+         } while (extra == 255);
+      }
+      if (literalLength > (UINTN)(srcEnd - src) || literalLength > (UINTN)(dstEnd - dst)) {
+         return nullptr;
+      }
+      if (literalLength + LZ4_WILDCOPY_MARGIN <= (UINTN)(srcEnd - src) &&
+          literalLength + LZ4_WILDCOPY_MARGIN <= (UINTN)(dstEnd - dst)) {
+         // Plenty of room on both sides, so overshooting with whole 8 byte copies is harmless.
+         for (UINTN i = 0; i < literalLength; i += 8) { __builtin_memcpy(dst + i, src + i, 8); }
+      } else {
+         for (UINTN i = 0; i < literalLength; i++) { dst[i] = src[i]; }
+      }
+      src += literalLength;
+      dst += literalLength;
+
+      // The last sequence of a block consists of literals only.
+      if (src == srcEnd) {
+         break;
+      }
+
+      // Match copy.
+      if (srcEnd - src < 2) {
+         return nullptr;
+      }
+      UINTN offset = (UINTN)src[0] | ((UINTN)src[1] << 8);
+      src += 2;
+      if (offset == 0 || offset > (UINTN)(dst - dstStart)) {
+         return nullptr;
+      }
+      UINTN matchLength = token & 0x0F;
+      if (matchLength == 15) {
+         UINT8 extra;
+         do {
+            if (src >= srcEnd) {
+               return nullptr;
+            }
+            extra = *src++;
+            matchLength += extra;
+         } while (extra == 255);
+      }
+      matchLength += LZ4_MIN_MATCH;
+      if (matchLength > (UINTN)(dstEnd - dst)) {
+         return nullptr;
+      }
+
+      const UINT8 *match = dst - offset;
+      if (offset >= 8 && matchLength + LZ4_WILDCOPY_MARGIN <= (UINTN)(dstEnd - dst)) {
+         // Source and destination are at least 8 bytes apart, so chunked copies never read unwritten data.
+         for (UINTN i = 0; i < matchLength; i += 8) { __builtin_memcpy(dst + i, match + i, 8); }
+      } else {
+         // Short offsets repeat a pattern and must be copied byte by byte.
+         for (UINTN i = 0; i < matchLength; i++) { dst[i] = match[i]; }
+      }
+      dst += matchLength;
+   }
+   return dst;
+}
+
+/**
+ * @brief Decompresses an entire LZ4 frame into a contiguous buffer.
+ * @param src: The start of the frame.
+ * @param srcSize: The size of the buffer holding the frame, in bytes.
+ * @param dst: The buffer to decompress into.
+ * @param dstCapacity: The size of the destination buffer, in bytes.
+ * @param OUTdecompressedSize: Filled with the number of bytes written to dst.
+ *
+ * @return False if the frame is malformed or does not fit into dst.
+ */
+bool Lz4DecompressFrame(const UINT8 *src, UINTN srcSize, UINT8 *dst, UINTN dstCapacity,
+                        UINTN *OUTdecompressedSize) {
+   Lz4FrameInfo info;
+   if (!ParseLz4FrameHeader(src, srcSize, &info)) {
+      return false;
+   }
+
+   const UINT8 *srcEnd = src + srcSize;
+   const UINT8 *block  = src + info.headerSize;
+   UINT8 *out          = dst;
+   UINT8 *outEnd       = dst + dstCapacity;
+   while (true) {
+      if (srcEnd - block < 4) {
+         return false;
+      }
+      UINT32 blockHeader = Lz4ReadLE32(block);
+      block += 4;
+      if (blockHeader == 0) {
+         break;  // EndMark
+      }
+
+      UINTN blockSize = blockHeader & ~LZ4_BLOCK_UNCOMPRESSED;
+      if (blockSize > (UINTN)(srcEnd - block)) {
+         return false;
+      }
+      if (blockHeader & LZ4_BLOCK_UNCOMPRESSED) {
+         if (blockSize > (UINTN)(outEnd - out)) {
+            return false;
+         }
+         memcpy(out, block, blockSize);
+         out += blockSize;
+      } else {
+         out = Lz4DecodeBlock(block, blockSize, dst, out, outEnd);
+         if (!out) {
+            return false;
+         }
+      }
+      block += blockSize + (info.hasBlockChecksums ? 4 : 0);
+   }
+
+   *OUTdecompressedSize = out - dst;
+   return true;
+}
+
+/** Where one block of a frame is, and where its output goes. */
+struct Lz4BlockSpan {
+   const UINT8 *data;
+   /** The size of the block data, with the uncompressed flag masked off. */
+   UINTN size;
+   bool uncompressed;
+   /** Set to true once the block decoded successfully. */
+   bool decoded;
+   UINTN decodedSize;
+};
+
+/** Shared by every processor decoding one frame. */
+struct Lz4FrameJob {
+   Lz4BlockSpan *blocks;
+   UINTN blockMaxSize;
+   UINT8 *dst;
+   UINTN dstCapacity;
+};
+
+void Lz4DecodeIndependentBlock(UINTN index, void *context) {
+   Lz4FrameJob *job    = (Lz4FrameJob *)context;
+   Lz4BlockSpan &block = job->blocks[index];
+   UINTN outOffset     = index * job->blockMaxSize;
+   UINTN outSpace      = job->dstCapacity - outOffset;
+   UINT8 *out          = job->dst + outOffset;
+   UINT8 *outEnd       = out + (outSpace < job->blockMaxSize ? outSpace : job->blockMaxSize);
+   if (block.uncompressed) {
+      if (block.size > (UINTN)(outEnd - out)) {
+         return;
+      }
+      memcpy(out, block.data, block.size);
+      block.decodedSize = block.size;
+   } else {
+      // The block starts a fresh window, so its matches may not reach back into the previous block.
+      UINT8 *blockEnd = Lz4DecodeBlock(block.data, block.size, out, out, outEnd);
+      if (!blockEnd) {
+         return;
+      }
+      block.decodedSize = blockEnd - out;
+   }
+   block.decoded = true;
+}
+
+/**
+ * @brief Decompresses an entire LZ4 frame into a contiguous buffer, decoding independent blocks on all
+ * processors at once. Frames with linked blocks, or with a block before the last that comes up short, are
+ * decoded sequentially by Lz4DecompressFrame().
+ * @param src: The start of the frame.
+ * @param srcSize: The size of the buffer holding the frame, in bytes.
+ * @param dst: The buffer to decompress into.
+ * @param dstCapacity: The size of the destination buffer, in bytes.
+ * @param OUTdecompressedSize: Filled with the number of bytes written to dst.
+ *
+ * @return False if the frame is malformed or does not fit into dst.
+ */
+bool Lz4DecompressFrameParallel(const UINT8 *src, UINTN srcSize, UINT8 *dst, UINTN dstCapacity,
+                                UINTN *OUTdecompressedSize) {
+   Lz4FrameInfo info;
+   if (!ParseLz4FrameHeader(src, srcSize, &info)) {
+      return false;
+   }
+   if (!info.blocksIndependent || mpState.enabledProcessors < 2) {
+      return Lz4DecompressFrame(src, srcSize, dst, dstCapacity, OUTdecompressedSize);
+   }
+
+   // Walk the block headers once to count the blocks, then again to record them.
+   const UINT8 *srcEnd = src + srcSize;
+   UINTN blockCount    = 0;
+   for (const UINT8 *block = src + info.headerSize;; blockCount++) {
+      if (srcEnd - block < 4) {
+         return false;
+      }
+      UINT32 blockHeader = Lz4ReadLE32(block);
+      block += 4;
+      if (blockHeader == 0) {
+         break;  // EndMark
+      }
+      UINTN blockSize = blockHeader & ~LZ4_BLOCK_UNCOMPRESSED;
+      if (blockSize > (UINTN)(srcEnd - block)) {
+         return false;
+      }
+      block += blockSize + (info.hasBlockChecksums ? 4 : 0);
+   }
+   if (blockCount == 0) {
+      *OUTdecompressedSize = 0;
+      return true;
+   }
+   if (blockCount - 1 > dstCapacity / info.blockMaxSize) {
+      // Either the frame does not fit, or blocks before the last come up short. Only decoding it tells.
+      return Lz4DecompressFrame(src, srcSize, dst, dstCapacity, OUTdecompressedSize);
+   }
+
+   Lz4BlockSpan *blocks = nullptr;
+   if (ST->BootServices->AllocatePool(LOADER_SCRATCH_MEMORY, blockCount * sizeof(Lz4BlockSpan),
+                                      (void **)&blocks) != EFI_SUCCESS) {
+      return Lz4DecompressFrame(src, srcSize, dst, dstCapacity, OUTdecompressedSize);
+   }
+   const UINT8 *block = src + info.headerSize;
+   bool shortBlock    = false;
+   for (UINTN i = 0; i < blockCount; i++) {
+      UINT32 blockHeader = Lz4ReadLE32(block);
+      UINTN blockSize    = blockHeader & ~LZ4_BLOCK_UNCOMPRESSED;
+      blocks[i]          = {block + 4, blockSize, (blockHeader & LZ4_BLOCK_UNCOMPRESSED) != 0, false, 0};
+      block += 4 + blockSize + (info.hasBlockChecksums ? 4 : 0);
+      // Stored blocks give away their size, so a short one is caught before decoding anything.
+      shortBlock |= blocks[i].uncompressed && i != blockCount - 1 && blockSize != info.blockMaxSize;
+   }
+   if (shortBlock) {
+      ST->BootServices->FreePool(blocks);
+      return Lz4DecompressFrame(src, srcSize, dst, dstCapacity, OUTdecompressedSize);
+   }
+
+   Lz4FrameJob job = {blocks, info.blockMaxSize, dst, dstCapacity};
+   ParallelFor(blockCount, dstCapacity, Lz4DecodeIndependentBlock, &job);
+
+   // If a block before the last came up short, the output has gaps. A block that failed may also only have
+   // run out of room at the offset it was given. Either way, decoding in order settles it.
+   bool success           = true;
+   UINTN decompressedSize = 0;
+   for (UINTN i = 0; i < blockCount && success; i++) {
+      success = blocks[i].decoded && (i == blockCount - 1 || blocks[i].decodedSize == info.blockMaxSize);
+      decompressedSize += blocks[i].decodedSize;
+   }
+   ST->BootServices->FreePool(blocks);
+   if (!success) {
+      return Lz4DecompressFrame(src, srcSize, dst, dstCapacity, OUTdecompressedSize);
+   }
+   *OUTdecompressedSize = decompressedSize;
+   return true;
+}
@@ -1,8 +1,96 @@
 #pragma once
+#include <emmintrin.h>
 #include <stddef.h>
+#include "cpu.h"
 
-void *memcpy(void *dest, void *src, size_t n) {
-   for (int i = 0; i < n; i++) { ((char *)dest)[i] = ((char *)src)[i]; }
+/*
+ * Memory primitives for the loader. These are extern "C" so that they also serve the calls the compiler emits
+ * on its own for struct copies and zeroing.
+ *
+ * CPUs with Enhanced REP MOVSB/STOSB (ERMS) move data fastest with a plain rep movsb/stosb, which the
+ * microcode turns into full cache line transfers. Older CPUs run those instructions slowly, so they get a
+ * loop of unaligned 16 byte SSE2 moves instead. SSE2 is part of x86-64, and UEFI enables it before any image
+ * runs.
+ */
 
+/** Keeps GCC from recognising the copy loops below as memcpy/memset and calling the function they are in. */
+#define NO_LIBCALL_PATTERNS __attribute__((optimize("no-tree-loop-distribute-patterns")))
+
+/** Set by InitMemoryPrimitives() if the CPU supports ERMS. */
+bool cpuHasErms = false;
+
+/**
+ * @brief Picks the fastest implementation of the memory primitives for this CPU. Until this is called, the
+ * SSE2 versions are used.
+ */
+void InitMemoryPrimitives() {
+   cpuHasErms = Cpuid(0).eax >= 7 && (Cpuid(7).ebx & (1 << 9)) != 0;
+}
+
+void RepMovsb(void *dest, const void *src, size_t n) {
+   __asm__ volatile("rep movsb" : "+D"(dest), "+S"(src), "+c"(n) : : "memory");
+}
+
+void RepStosb(void *dest, UINT8 value, size_t n) {
+   __asm__ volatile("rep stosb" : "+D"(dest), "+c"(n) : "a"(value) : "memory");
+}
+
+extern "C" {
+NO_LIBCALL_PATTERNS void *memcpy(void *dest, const void *src, size_t n) {
+   if (cpuHasErms) {
+      RepMovsb(dest, src, n);
+      return dest;
+   }
+
+   UINT8 *d       = (UINT8 *)dest;
+   const UINT8 *s = (const UINT8 *)src;
+   for (; n >= 64; n -= 64, d += 64, s += 64) {
+      __m128i a = _mm_loadu_si128((const __m128i *)s);
+      __m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+      __m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+      __m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+      _mm_storeu_si128((__m128i *)d, a);
+      _mm_storeu_si128((__m128i *)(d + 16), b);
+      _mm_storeu_si128((__m128i *)(d + 32), c);
+      _mm_storeu_si128((__m128i *)(d + 48), e);
+   }
+   for (; n >= 16; n -= 16, d += 16, s += 16) {
+      _mm_storeu_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+   }
+   // A short rep movsb is cheap enough everywhere for the last few bytes.
+   RepMovsb(d, s, n);
+   return dest;
+}
+
+NO_LIBCALL_PATTERNS void *memset(void *dest, int value, size_t n) {
+   if (cpuHasErms) {
+      RepStosb(dest, (UINT8)value, n);
+      return dest;
+   }
+
+   UINT8 *d        = (UINT8 *)dest;
+   __m128i pattern = _mm_set1_epi8((char)value);
+   for (; n >= 64; n -= 64, d += 64) {
+      _mm_storeu_si128((__m128i *)d, pattern);
+      _mm_storeu_si128((__m128i *)(d + 16), pattern);
+      _mm_storeu_si128((__m128i *)(d + 32), pattern);
+      _mm_storeu_si128((__m128i *)(d + 48), pattern);
+   }
+   for (; n >= 16; n -= 16, d += 16) { _mm_storeu_si128((__m128i *)d, pattern); }
+   RepStosb(d, (UINT8)value, n);
+   return dest;
+}
+
+NO_LIBCALL_PATTERNS void *memmove(void *dest, const void *src, size_t n) {
+   // Copying forwards is only a problem if the destination starts inside the source.
+   if ((UINTN)dest - (UINTN)src >= n) {
+      return memcpy(dest, src, n);
+   }
+   // Overlapping moves towards higher addresses are rare here (shifting table entries up), so a backwards
+   // rep movsb is good enough.
+   UINT8 *d       = (UINT8 *)dest + n - 1;
+   const UINT8 *s = (const UINT8 *)src + n - 1;
+   __asm__ volatile("std\n\trep movsb\n\tcld" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
    return dest;
-}
\ No newline at end of file
+}
+}
@@ -0,0 +1,205 @@
+#pragma once
+#include "../mem/memory_types.h"
+#include "boot/bootinfo.h"
+
+/*
+ * The kernel draws straight into the framebuffer, and clearing or scrolling the screen touches every byte of
+ * it. The best mode is therefore not simply the largest one: the pixel format decides whether the kernel can
+ * write its colours as they are, padding at the end of each scanline is memory traffic nobody sees, and the
+ * total size of the framebuffer has to stay within what the configured budget allows.
+ */
+
+/** The size the kernel assumes for every pixel. */
+#define VIDEO_BYTES_PER_PIXEL 4
+
+/** The parts of EFI_GRAPHICS_OUTPUT_MODE_INFORMATION the mode selection needs, for one mode. */
+struct VideoMode {
+   UINT32 mode;
+   UINT32 width;
+   UINT32 height;
+   UINT32 pixelsPerScanLine;
+   EFI_GRAPHICS_PIXEL_FORMAT pixelFormat;
+   EFI_PIXEL_BITMASK pixelInformation;
+};
+
+struct VideoModeTable {
+   EFI_GRAPHICS_OUTPUT_PROTOCOL *gop;
+   VideoMode *modes;
+   UINTN modeCount;
+};
+
+/**
+ * @brief Locates the graphics output protocol and queries every mode it offers, once.
+ * @param OUTtable: Filled with the modes. Release it with FreeVideoModeTable().
+ *
+ * @return False if there is no graphics output device or the table could not be allocated.
+ */
+bool LoadVideoModeTable(VideoModeTable *OUTtable) {
+   EFI_GUID gopGUID                  = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
+   EFI_GRAPHICS_OUTPUT_PROTOCOL *gop = nullptr;
+   if (ST->BootServices->LocateProtocol(&gopGUID, nullptr, (void **)&gop) != EFI_SUCCESS) {
+      return false;
+   }
+   UINT32 maxMode   = gop->Mode->MaxMode;
+   VideoMode *modes = nullptr;
+   if (ST->BootServices->AllocatePool(LOADER_SCRATCH_MEMORY, maxMode * sizeof(VideoMode),
+                                      (void **)&modes) != EFI_SUCCESS) {
+      return false;
+   }
+   UINTN modeCount = 0;
+   for (UINT32 i = 0; i < maxMode; i++) {
+      EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *info = nullptr;
+      UINTN infoSize                             = 0;
+      if (gop->QueryMode(gop, i, &infoSize, &info) != EFI_SUCCESS) {
+         continue;
+      }
+      modes[modeCount++] = {i, info->HorizontalResolution, info->VerticalResolution, info->PixelsPerScanLine,
+                            info->PixelFormat, info->PixelInformation};
+      // QueryMode() hands out a fresh pool allocation every time.
+      ST->BootServices->FreePool(info);
+   }
+   *OUTtable = {gop, modes, modeCount};
+   return true;
+}
+
+bool AreVideoModesEqual(const VideoMode &a, const VideoMode &b) {
+   return a.mode == b.mode && a.width == b.width && a.height == b.height &&
+          a.pixelsPerScanLine == b.pixelsPerScanLine && a.pixelFormat == b.pixelFormat &&
+          a.pixelInformation.RedMask == b.pixelInformation.RedMask &&
+          a.pixelInformation.GreenMask == b.pixelInformation.GreenMask &&
+          a.pixelInformation.BlueMask == b.pixelInformation.BlueMask &&
+          a.pixelInformation.ReservedMask == b.pixelInformation.ReservedMask;
+}
+
+/**
+ * @brief Sets up a table holding a single mode picked on an earlier boot, after checking that the firmware
+ * still offers the same modes and describes that one the same way. Only that mode is queried.
+ * @param expected: The mode as it was described back then.
+ * @param maxMode: The number of modes the firmware offered back then.
+ * @param OUTtable: Filled with the mode. Release it with FreeVideoModeTable().
+ *
+ * @return False if anything changed, in which case the modes have to be enumerated with LoadVideoModeTable().
+ */
+bool LoadKnownVideoMode(const VideoMode &expected, UINT32 maxMode, VideoModeTable *OUTtable) {
+   EFI_GUID gopGUID                  = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
+   EFI_GRAPHICS_OUTPUT_PROTOCOL *gop = nullptr;
+   if (ST->BootServices->LocateProtocol(&gopGUID, nullptr, (void **)&gop) != EFI_SUCCESS ||
+       gop->Mode->MaxMode != maxMode) {
+      return false;
+   }
+   EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *info = nullptr;
+   UINTN infoSize                             = 0;
+   if (gop->QueryMode(gop, expected.mode, &infoSize, &info) != EFI_SUCCESS) {
+      return false;
+   }
+   VideoMode mode = {expected.mode, info->HorizontalResolution, info->VerticalResolution,
+                     info->PixelsPerScanLine, info->PixelFormat, info->PixelInformation};
+   ST->BootServices->FreePool(info);
+   VideoMode *modes = nullptr;
+   if (!AreVideoModesEqual(mode, expected) ||
+       ST->BootServices->AllocatePool(LOADER_SCRATCH_MEMORY, sizeof(VideoMode), (void **)&modes) !=
+          EFI_SUCCESS) {
+      return false;
+   }
+   modes[0]  = mode;
+   *OUTtable = {gop, modes, 1};
+   return true;
+}
+
+void FreeVideoModeTable(VideoModeTable *table) {
+   ST->BootServices->FreePool(table->modes);
+   *table = {};
+}
+
+/** @brief The number of bytes the kernel touches to fill the whole screen in a mode, padding included. */
+UINT64 GetVideoModeFootprint(const VideoMode &mode) {
+   return (UINT64)mode.pixelsPerScanLine * mode.height * VIDEO_BYTES_PER_PIXEL;
+}
+
+/**
+ * @brief Rates how well a mode suits the kernel. Higher is better.
+ *
+ * The pixel format dominates: blue-green-red lets the kernel write 0x00RRGGBB as is, anything else has to be
+ * converted. Within a format, modes are rated by their visible pixels scaled by the share of each scanline
+ * that is visible, so an unpadded mode beats a padded one of the same resolution, and a padded mode only
+ * wins if its extra resolution is worth the wasted bandwidth.
+ */
+UINT64 ScoreVideoMode(const VideoMode &mode) {
+   UINT64 formatRank = 0;
+   if (mode.pixelFormat == PixelBlueGreenRedReserved8BitPerColor) {
+      formatRank = 2;
+   } else if (mode.pixelFormat == PixelRedGreenBlueReserved8BitPerColor) {
+      formatRank = 1;
+   }
+   UINT64 effectivePixels = (UINT64)mode.width * mode.height * mode.width / mode.pixelsPerScanLine;
+   return (formatRank << 56) | effectivePixels;
+}
+
+/**
+ * @brief Picks the video mode the kernel should run in.
+ * @param table: The modes to choose from.
+ * @param resolutionX: The requested horizontal resolution, or 0 to pick the best mode within the budget.
+ * @param resolutionY: The requested vertical resolution, or 0 to pick the best mode within the budget.
+ * @param budgetBytes: The largest framebuffer footprint to accept, or 0 for no limit. Ignored if a
+ * resolution was requested. If no mode fits, the mode with the smallest footprint is picked anyway, so check
+ * the footprint of the result against the budget to tell.
+ *
+ * @return The selected mode, or nullptr if the requested resolution is not offered or there is no mode the
+ * kernel could draw into at all.
+ */
+const VideoMode *SelectVideoMode(const VideoModeTable *table, UINT32 resolutionX, UINT32 resolutionY,
+                                 UINT64 budgetBytes) {
+   bool requested            = resolutionX != 0 && resolutionY != 0;
+   const VideoMode *best     = nullptr;
+   const VideoMode *smallest = nullptr;
+   UINT64 bestScore          = 0;
+   for (UINTN i = 0; i < table->modeCount; i++) {
+      const VideoMode &mode = table->modes[i];
+      // Blt only modes have no framebuffer the kernel could draw into.
+      if (mode.pixelFormat == PixelBltOnly || mode.width == 0 || mode.pixelsPerScanLine < mode.width) {
+         continue;
+      }
+      if (requested && (mode.width != resolutionX || mode.height != resolutionY)) {
+         continue;
+      }
+      if (!smallest || GetVideoModeFootprint(mode) < GetVideoModeFootprint(*smallest) ||
+          (GetVideoModeFootprint(mode) == GetVideoModeFootprint(*smallest) &&
+           ScoreVideoMode(mode) > ScoreVideoMode(*smallest))) {
+         smallest = &mode;
+      }
+      if (!requested && budgetBytes != 0 && GetVideoModeFootprint(mode) > budgetBytes) {
+         continue;
+      }
+      UINT64 score = ScoreVideoMode(mode);
+      if (!best || score > bestScore) {
+         best      = &mode;
+         bestScore = score;
+      }
+   }
+   // The budget only exists to keep the kernel console fast. Firmware that offers nothing small enough, such
+   // as a panel with only a 4K mode, must still boot, so fall back to the mode that costs the least to draw.
+   return best ? best : smallest;
+}
+
+/**
+ * @brief Switches to a video mode and describes its framebuffer for the kernel.
+ * @param table: The table the mode came from.
+ * @param mode: The mode to switch to.
+ * @param OUTframebuffer: Filled with the framebuffer of the new mode.
+ *
+ * @return False if the firmware refused to switch modes.
+ */
+bool SetVideoMode(const VideoModeTable *table, const VideoMode *mode, Framebuffer *OUTframebuffer) {
+   EFI_GRAPHICS_OUTPUT_PROTOCOL *gop = table->gop;
+   if (gop->SetMode(gop, mode->mode) != EFI_SUCCESS) {
+      return false;
+   }
+   const EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *info = gop->Mode->Info;
+   const EFI_PIXEL_BITMASK &mask                    = info->PixelInformation;
+
+   *OUTframebuffer = {(uint32_t *)gop->Mode->FrameBufferBase, info->PixelsPerScanLine,
+                      info->HorizontalResolution, info->VerticalResolution, (PixelFormat)info->PixelFormat,
+                      {mask.RedMask, mask.GreenMask, mask.BlueMask, mask.ReservedMask},
+                      gop->Mode->FrameBufferSize};
+   return true;
+}
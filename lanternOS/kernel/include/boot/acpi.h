@@ -0,0 +1,47 @@
+#pragma once
+#include <stdint.h>
+
+/*
+ * An index of the ACPI tables the firmware provides, built by the loader so the kernel can find the MADT,
+ * HPET, MCFG and friends without walking the RSDP and XSDT itself. Shared by the loader and the kernel, so it
+ * must only use fixed width types and freestanding builtins.
+ */
+
+#define ACPI_TABLE_INDEX_MAX 64
+
+/** A table whose checksum the loader has verified. */
+struct AcpiTableEntry {
+   /** The 4 character signature, such as "APIC" for the MADT. Not null terminated. */
+   char signature[4];
+   uint32_t length;
+   /** The physical address of the table header. */
+   uint64_t address;
+};
+
+struct AcpiTableIndex {
+   /** The physical address of the RSDP, or 0 if the firmware did not provide one. */
+   uint64_t rsdpAddress;
+   /** The RSDP revision: 0 for ACPI 1.0, which only has an RSDT, and 2 or later for an XSDT. */
+   uint64_t rsdpRevision;
+   uint64_t tableCount;
+   AcpiTableEntry tables[ACPI_TABLE_INDEX_MAX];
+};
+
+/**
+ * @brief Finds a table by its signature.
+ *
+ * @param index: The index handed over by the loader.
+ * @param signature: The 4 character signature to look for.
+ *
+ * @return The first table with that signature, or nullptr if there is none.
+ */
+inline const AcpiTableEntry *FindAcpiTable(const AcpiTableIndex *index, const char *signature) {
+   for (uint64_t i = 0; i < index->tableCount; i++) {
+      const AcpiTableEntry *table = &index->tables[i];
+      if (table->signature[0] == signature[0] && table->signature[1] == signature[1] &&
+          table->signature[2] == signature[2] && table->signature[3] == signature[3]) {
+         return table;
+      }
+   }
+   return nullptr;
+}
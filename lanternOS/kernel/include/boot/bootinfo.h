@@ -0,0 +1,210 @@
+#pragma once
+#include <stdint.h>
+
+#include "acpi.h"
+#include "symbols.h"
+#include "timeline.h"
+
+/*
+ * Structures handed from BhavaLoader to the kernel. This header is shared by both, so only fixed width
+ * types may be used: the loader is built as a PE32+ image (LLP64) while the kernel is an ELF (LP64).
+ */
+
+/** The layout of a framebuffer pixel. The values match EFI_GRAPHICS_PIXEL_FORMAT. */
+enum class PixelFormat : uint32_t {
+   /** Byte 0 is red, byte 1 green, byte 2 blue and byte 3 unused. */
+   RedGreenBlue,
+   /** Byte 0 is blue, byte 1 green, byte 2 red and byte 3 unused, so 0x00RRGGBB can be written as is. */
+   BlueGreenRed,
+   /** Described by the masks in PixelBitmask. */
+   Bitmask,
+};
+
+struct PixelBitmask {
+   uint32_t redMask;
+   uint32_t greenMask;
+   uint32_t blueMask;
+   uint32_t reservedMask;
+};
+
+struct Framebuffer {
+   uint32_t *frameBufferAddress;
+   uint32_t pixelsPerScanLine;
+   uint32_t horizontalResolution;
+   uint32_t verticalResolution;
+   PixelFormat pixelFormat;
+   /** Only meaningful if pixelFormat is PixelFormat::Bitmask. */
+   PixelBitmask pixelBitmask;
+   /** The size of the framebuffer in bytes, as reported by the firmware. */
+   uint64_t frameBufferSize;
+};
+
+struct FontFormat {
+   /** The raw PSF2 glyph bitmaps. */
+   void *FontBufferAddress;
+   uint32_t numGlyphs;
+   uint32_t glyphSizeInBytes;
+   uint32_t glyphHeight;
+   uint32_t glyphWidth;
+   /**
+    * The glyphs pre-expanded by the loader into one 32 bit mask per pixel: 0xFFFFFFFF where the glyph is set
+    * and 0 elsewhere, so a row of a glyph lines up with a span of framebuffer pixels and can be drawn as
+    * (fg & mask) | (bg & ~mask). Null if the loader did not build an atlas.
+    */
+   uint32_t *atlasAddress;
+   /** The distance between the first mask of two consecutive glyphs, in masks. */
+   uint32_t atlasGlyphStride;
+   /** The distance between the first mask of two consecutive rows of a glyph, in masks. */
+   uint32_t atlasRowStride;
+};
+
+struct GlobalInitializers {
+   uint64_t *ctorAddresses;
+   int ctorCount;
+   uint64_t *dtorAddresses;
+   int dtorCount;
+};
+
+enum class MemoryRegionType : uint32_t {
+   /** Free memory the kernel may use right away. */
+   Usable,
+   /**
+    * Firmware boot services memory, the loader itself and the loader's scratch buffers. Nothing BootInfo
+    * points to lives here, but the CPU enters the kernel still running on the firmware's GDT and IDT, which
+    * do. Only reclaim it once the kernel has loaded its own GDT and IDT.
+    */
+   Reclaimable,
+   /** ACPI tables. Free once the kernel has finished parsing them. */
+   AcpiReclaimable,
+   /** ACPI non-volatile storage. Must be preserved across sleep states. */
+   AcpiNvs,
+   /** Memory mapped IO ranges described by the firmware. */
+   Mmio,
+   /** Anything else. */
+   Reserved,
+   /** The kernel segments, the kernel stack, the per-CPU areas and the early heap. */
+   KernelImage,
+   /** The boot module region. Free once the kernel is done with every module. */
+   BootModules,
+   /** BootInfo and everything it points to that is not a module: the log, page tables, symbol index... */
+   LoaderHandoff,
+};
+
+/** A contiguous range of physical memory. Ranges are page aligned. */
+struct MemoryRegion {
+   uint64_t base;
+   uint64_t length;
+   MemoryRegionType type;
+   uint32_t padding;
+};
+
+/**
+ * The physical memory map at the time the loader exited boot services. Regions are sorted by base address,
+ * never overlap, and adjacent regions of the same type have been merged into one.
+ */
+struct MemoryRegionTable {
+   MemoryRegion *regions;
+   uint64_t regionCount;
+};
+
+/**
+ * Everything the loader logged, as ASCII text with '\n' line endings. The buffer is a ring: once more than
+ * capacity characters have been written, only the newest capacity characters are kept, and the oldest of them
+ * is at written % capacity. buffer is null if the loader could not set aside memory for its log.
+ */
+struct LoaderLog {
+   const char *buffer;
+   uint64_t capacity;
+   uint64_t written;
+};
+
+#define BOOT_MODULE_MAX         8
+#define BOOT_MODULE_NAME_LENGTH 32
+
+enum class BootModuleType : uint32_t {
+   Kernel,
+   Font,
+   Initrd,
+   Symbols,
+};
+
+/** A file the loader read from the boot volume, exactly as it is stored there. */
+struct BootModule {
+   BootModuleType type;
+   uint32_t padding;
+   uint64_t base;
+   uint64_t size;
+   /** The path of the file on the boot volume, as null terminated ASCII. Truncated if it does not fit. */
+   char name[BOOT_MODULE_NAME_LENGTH];
+};
+
+/**
+ * The boot modules. They are stored back to back in a single physically contiguous region, each starting on a
+ * page boundary, so the kernel can map or release them all at once.
+ */
+struct BootModuleTable {
+   uint64_t regionBase;
+   uint64_t regionSize;
+   uint64_t moduleCount;
+   BootModule modules[BOOT_MODULE_MAX];
+};
+
+/**
+ * The stack kmain starts on. It sits in the higher half, in the 2MiB slot directly after the kernel image,
+ * and is mapped with 4KiB pages. The page just below it is left unmapped, so running off the end of the stack
+ * faults rather than silently overwriting memory.
+ */
+struct KernelStack {
+   /** The lowest mapped address of the stack. kmain starts with its stack pointer at base + size. */
+   uint64_t base;
+   uint64_t size;
+   /** Where the stack is in physical memory. It is physically contiguous. */
+   uint64_t physicalBase;
+   /** The address of the unmapped guard page. */
+   uint64_t guardPage;
+};
+
+#define BOOT_MAX_CPUS     64
+#define PER_CPU_AREA_SIZE 0x1000
+
+/**
+ * Zeroed memory for per-CPU data, one PER_CPU_AREA_SIZE area for each of up to BOOT_MAX_CPUS processors, so
+ * the kernel needs no allocator to set up its CPUs. Mapped in the higher half right after the kernel stack.
+ */
+struct PerCpuAreas {
+   /** The area of processor i starts at base + i * areaSize. */
+   uint64_t base;
+   uint64_t areaSize;
+   uint64_t maxCpuCount;
+   /** The number of enabled processors the firmware reported, at most maxCpuCount. */
+   uint64_t cpuCount;
+   uint64_t physicalBase;
+};
+
+/**
+ * Zeroed memory the kernel can allocate from before it has a memory manager. It is physically contiguous,
+ * 2MiB aligned and a multiple of 2MiB long, and reached through the direct map. Empty if the loader was
+ * configured without one.
+ */
+struct EarlyHeapRegion {
+   /** The address of the heap in the direct map. */
+   uint64_t base;
+   uint64_t size;
+   uint64_t physicalBase;
+};
+
+struct BootInfo {
+   Framebuffer framebuffer;
+   FontFormat font;
+   GlobalInitializers initializers;
+   MemoryRegionTable memoryMap;
+   BootTimeline timeline;
+   LoaderLog loaderLog;
+   BootModuleTable modules;
+   /** Empty if neither the kernel nor a symbol module carried a symbol table. */
+   KernelSymbolTable symbols;
+   AcpiTableIndex acpi;
+   KernelStack stack;
+   PerCpuAreas perCpu;
+   EarlyHeapRegion earlyHeap;
+};
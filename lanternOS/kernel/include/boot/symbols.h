@@ -0,0 +1,71 @@
+#pragma once
+#include <stdint.h>
+
+/*
+ * The kernel symbol index, built by the loader from the kernel's ELF symbol table so the kernel can turn code
+ * addresses back into function names without parsing ELF or allocating memory. Shared by the loader and the
+ * kernel, so it must only use fixed width types and freestanding builtins.
+ */
+
+/** A function in the kernel image. */
+struct KernelSymbol {
+   /** The run-time (higher half) address of the function. */
+   uint64_t address;
+   /** The size of the function in bytes, or 0 if the symbol table did not record it. */
+   uint32_t size;
+   /** Offset of the null terminated function name in the string pool. */
+   uint32_t nameOffset;
+};
+
+/** Every kernel function symbol, sorted by address, and one packed pool holding all of their names. */
+struct KernelSymbolTable {
+   const KernelSymbol *symbols;
+   uint64_t symbolCount;
+   const char *stringPool;
+   uint64_t stringPoolSize;
+};
+
+/**
+ * @brief Finds the function containing an address with a binary search over the symbol index.
+ *
+ * @param table: The symbol index handed over by the loader.
+ * @param address: The address to look up, such as a return address.
+ * @param OUToffset: Filled with the distance from the start of the function to address. May be nullptr.
+ *
+ * @return The function containing address, or nullptr if the address lies outside of every known function.
+ */
+inline const KernelSymbol *LookupKernelSymbol(const KernelSymbolTable *table, uint64_t address,
+                                              uint64_t *OUToffset) {
+   // Find the last symbol starting at or before address.
+   uint64_t low  = 0;
+   uint64_t high = table->symbolCount;
+   while (low < high) {
+      uint64_t middle = low + (high - low) / 2;
+      if (table->symbols[middle].address <= address) {
+         low = middle + 1;
+      } else {
+         high = middle;
+      }
+   }
+   if (low == 0) {
+      return nullptr;
+   }
+   const KernelSymbol *symbol = &table->symbols[low - 1];
+   uint64_t offset            = address - symbol->address;
+   if (symbol->size != 0 && offset >= symbol->size) {
+      return nullptr;
+   }
+   if (OUToffset) {
+      *OUToffset = offset;
+   }
+   return symbol;
+}
+
+/**
+ * @brief Gets the name of a symbol out of the string pool.
+ *
+ * @return The null terminated name.
+ */
+inline const char *GetKernelSymbolName(const KernelSymbolTable *table, const KernelSymbol *symbol) {
+   return table->stringPool + symbol->nameOffset;
+}
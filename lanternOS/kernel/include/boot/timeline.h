@@ -0,0 +1,61 @@
+#pragma once
+#include <stdint.h>
+
+/*
+ * Boot phase timestamps, recorded with the TSC from firmware entry into the loader until the kernel is up.
+ * Shared by the loader and the kernel, so it must only use fixed width types and freestanding builtins.
+ */
+
+#define BOOT_TIMELINE_MAX_ENTRIES 32
+#define BOOT_TIMELINE_NAME_LENGTH 24
+
+/** A checkpoint marking the end of a boot phase. */
+struct BootTimelineEntry {
+   char name[BOOT_TIMELINE_NAME_LENGTH];
+   uint64_t tsc;
+};
+
+struct BootTimeline {
+   /** TSC ticks per second, as calibrated by the loader. */
+   uint64_t tscFrequency;
+   uint64_t entryCount;
+   BootTimelineEntry entries[BOOT_TIMELINE_MAX_ENTRIES];
+};
+
+/**
+ * @brief Records the end of a boot phase. The time spent in a phase is the TSC delta to the previous entry.
+ * Entries past BOOT_TIMELINE_MAX_ENTRIES are dropped.
+ *
+ * @param timeline: The timeline to record into.
+ * @param name: The name of the phase that just finished. Truncated to BOOT_TIMELINE_NAME_LENGTH - 1 chars.
+ */
+inline void MarkBootPhase(BootTimeline *timeline, const char *name) {
+   uint64_t tsc = __builtin_ia32_rdtsc();
+   if (timeline->entryCount >= BOOT_TIMELINE_MAX_ENTRIES) {
+      return;
+   }
+   BootTimelineEntry *entry = &timeline->entries[timeline->entryCount];
+   int i                    = 0;
+   for (; i < BOOT_TIMELINE_NAME_LENGTH - 1 && name[i] != 0; i++) { entry->name[i] = name[i]; }
+   entry->name[i] = 0;
+   entry->tsc     = tsc;
+   timeline->entryCount++;
+}
+
+/**
+ * @brief Converts a number of TSC ticks into microseconds.
+ *
+ * @param timeline: The timeline holding the calibrated TSC frequency.
+ * @param ticks: The number of ticks to convert.
+ *
+ * @return The duration in microseconds, or 0 if the TSC was never calibrated.
+ */
+inline uint64_t BootTicksToMicroseconds(const BootTimeline *timeline, uint64_t ticks) {
+   if (timeline->tscFrequency == 0) {
+      return 0;
+   }
+   // Split the conversion so that ticks * 1000000 cannot overflow for long boots.
+   uint64_t seconds = ticks / timeline->tscFrequency;
+   uint64_t rest    = ticks % timeline->tscFrequency;
+   return seconds * 1000000 + (rest * 1000000) / timeline->tscFrequency;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <stdint.h>
+
+#include "boot/bootinfo.h"
+
+/*
+ * A bump allocator over the early heap the loader handed over. It needs no setup beyond InitEarlyHeap(), so
+ * it works from the first instruction of kmain, before global constructors run. Memory is never freed: the
+ * whole heap is meant for structures that live as long as the kernel, or until a real memory manager takes
+ * over. The loader zeroes the heap and nothing is ever handed out twice, so every allocation starts zeroed.
+ */
+
+/**
+ * @brief Starts allocating from the early heap. Must be called before anything else in this file.
+ *
+ * @param region: The heap described in BootInfo. May be empty, in which case every allocation fails.
+ */
+void InitEarlyHeap(const EarlyHeapRegion &region);
+
+/**
+ * @brief Allocates zeroed memory from the early heap.
+ *
+ * @param size: The number of bytes to allocate.
+ * @param alignment: The required alignment of the allocation in bytes. Must be a power of two.
+ *
+ * @return The allocation, or nullptr if the heap does not have enough memory left.
+ */
+void *EarlyAllocate(uint64_t size, uint64_t alignment = 16);
+
+/** @brief Gets the number of bytes allocated so far, including alignment padding. */
+uint64_t GetEarlyHeapUsed();
+
+/** @brief Gets the total size of the early heap in bytes. */
+uint64_t GetEarlyHeapSize();
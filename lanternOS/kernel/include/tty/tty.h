@@ -1,20 +1,7 @@
 #pragma once
 #include <stdint.h>
 
-struct Framebuffer {
-   uint32_t *frameBufferAddress;
-   uint32_t pixelsPerScanLine;
-   uint32_t horizontalResolution;
-   uint32_t verticalResolution;
-};
-
-struct FontFormat {
-   void *FontBufferAddress;
-   uint32_t numGlyphs;
-   uint32_t glyphSizeInBytes;
-   uint32_t glyphHeight;
-   uint32_t glyphWidth;
-};
+#include "boot/bootinfo.h"
 
 class TTY {
    public:
@@ -59,7 +46,8 @@ class TTY {
    void Puts(const char *array);
 
    /**
-    * @brief Places a single ASCII character at the current cursor position.
+    * @brief Places a single ASCII character at the current cursor position. Characters past the end of the
+    * font are drawn as '?'.
     *
     * @param charToPrint: The ASCII character to print to the screen.
     * @param foreground: The RGB foreground color for the character. Valid from 0x00000000 - 0xFFFFFFFF.
@@ -116,9 +104,47 @@ class TTY {
    /** The current foreground color of the TTY. */
    uint32_t m_fgColor {0};
 
+   /**
+    * Every glyph fully drawn in m_cacheFgColor on m_cacheBgColor, glyphHeight rows of glyphWidth pixels each,
+    * so drawing a character is one copy per row. Glyphs are only drawn into it when they are first printed
+    * with the current color pair. Null if the early heap had no room for it.
+    */
+   uint32_t *m_glyphCache {nullptr};
+   /** The number of glyphs in the cache: the font's first glyphs, up to the 256 a char can select. */
+   uint32_t m_cachedGlyphCount {0};
+   /** The value of m_cacheGeneration each glyph was last drawn into the cache at. 0 means never. */
+   uint32_t *m_glyphGenerations {nullptr};
+   /** Bumped whenever the cached color pair changes, which invalidates every glyph at once. */
+   uint32_t m_cacheGeneration {1};
+   uint32_t m_cacheFgColor {0};
+   uint32_t m_cacheBgColor {0};
+
    /** Any Non-floating-point value should only need this many characters maximum to be represented. */
    const uint8_t MAXNUMERALREPRESENTATION = 22;
 
+   /**
+    * @brief Gets a glyph drawn in the given colors from the glyph cache, drawing it first if it is not there.
+    *
+    * @param glyph: The glyph to get.
+    * @param foreground: The color of the set pixels.
+    * @param background: The color of the clear pixels.
+    *
+    * @return glyphHeight rows of glyphWidth pixels, or nullptr if there is no cache or no such glyph.
+    */
+   const uint32_t *GetCachedGlyph(uint8_t glyph, uint32_t foreground, uint32_t background);
+
+   /**
+    * @brief Draws a glyph into a buffer, one row after another.
+    *
+    * @param glyph: The glyph to draw.
+    * @param foreground: The color of the set pixels.
+    * @param background: The color of the clear pixels.
+    * @param rowPixels: Where to draw the first row.
+    * @param rowStride: The distance between the first pixels of two consecutive rows, in pixels.
+    */
+   void DrawGlyph(uint8_t glyph, uint32_t foreground, uint32_t background, uint32_t *rowPixels,
+                  uint64_t rowStride);
+
    void PrintFormattedWithModifiers(const char *str, long paddingAmount, long precisionAmount,
                                     bool leftAdjusted, char *alternateFormStr);
 
@@ -129,19 +155,28 @@ class TTY {
     * @param x: The x coordinate of the pixel.
     * @param y: The y coordinate of the pixel.
     *
-    * @return The pixel color.
+    * @return The pixel value, in the framebuffer's format.
     */
    uint32_t GetPixelColor(uint32_t posX, uint32_t posY);
 
+   /**
+    * @brief Converts a 0x00RRGGBB color, as the public interface takes them, into the pixel format of the
+    * framebuffer.
+    *
+    * @param color: The color to convert.
+    *
+    * @return The pixel value to write into the framebuffer.
+    */
+   uint32_t ToFramebufferColor(uint32_t color);
+
    /**
     * @brief Draw a single pixel to the screen based on (x,y) coordinates.
     * The (0,0) coordinate is the top-left pixel of the screen.
     *
     * @param x: The x coordinate of the pixel. Valid from 0 - framebuffer.horizontalResolution.
     * @param y: The y coordinate of the pixel. Valid from 0 - framebuffer.verticalResolution.
-    * @param pixelColor: The color to fill the pixel with. Valid from 0x00000000 - 0xFFFFFFFF.
-    *                    0xFF000000 represents blue value, 0x00FF0000 represents green value, 0x0000FF00
-    *                    represents red.
+    * @param pixelColor: The pixel value to write, already in the framebuffer's format. See
+    *                    ToFramebufferColor().
     */
    void PlotPixel(uint32_t x, uint32_t y, uint32_t pixelColor);
 };
@@ -1,14 +1,9 @@
+#include "boot/bootinfo.h"
 #include "libk/string.h"
+#include "mem/early_heap.h"
 #include "stdint.h"
 #include "tty/tty.h"
 
-struct GlobalInitializers {
-   uint64_t *ctorAddresses;
-   int ctorCount;
-   uint64_t *dtorAddresses;
-   int dtorCount;
-};
-
 typedef void (*global_ctor)(void);
 void CallGlobalConstructors(GlobalInitializers initializers) {
    for (int i = 0; i < initializers.ctorCount; i++) {
@@ -17,19 +12,99 @@ void CallGlobalConstructors(GlobalInitializers initializers) {
    }
 }
 
+/**
+ * @brief Sums the size of every region of a given type in the memory map.
+ *
+ * @param memoryMap: The memory region table handed over by the loader.
+ * @param type: The type of region to count.
+ *
+ * @return The total size in bytes.
+ */
+uint64_t GetTotalMemoryOfType(MemoryRegionTable memoryMap, MemoryRegionType type) {
+   uint64_t total = 0;
+   for (uint64_t i = 0; i < memoryMap.regionCount; i++) {
+      if (memoryMap.regions[i].type == type) {
+         total += memoryMap.regions[i].length;
+      }
+   }
+   return total;
+}
+
+/**
+ * @brief Prints how long each boot phase took, from firmware entry into the loader up to now.
+ *
+ * @param term: The terminal to print to.
+ * @param timeline: The timeline recorded by the loader and the kernel.
+ */
+void PrintBootTimeline(TTY &term, const BootTimeline *timeline) {
+   if (timeline->tscFrequency == 0 || timeline->entryCount == 0) {
+      return;
+   }
+   term.kprintf("Boot timeline (TSC at %u kHz):\n", (unsigned int)(timeline->tscFrequency / 1000));
+   uint64_t previousTsc = 0;
+   for (uint64_t i = 0; i < timeline->entryCount; i++) {
+      const BootTimelineEntry &entry = timeline->entries[i];
+      uint64_t micros                = BootTicksToMicroseconds(timeline, entry.tsc - previousTsc);
+      term.kprintf("  %s: %u us\n", entry.name, (unsigned int)micros);
+      previousTsc = entry.tsc;
+   }
+   uint64_t total = BootTicksToMicroseconds(timeline, timeline->entries[timeline->entryCount - 1].tsc);
+   term.kprintf("  total since reset: %u us\n", (unsigned int)total);
+}
+
 extern "C" {
-int kmain(Framebuffer framebuffer, FontFormat fontFormat, GlobalInitializers initializers) {
+int kmain(BootInfo *bootInfo) {
    int stackMarker = 0;
-   CallGlobalConstructors(initializers);
+   // Before anything else, so that even global constructors can allocate.
+   InitEarlyHeap(bootInfo->earlyHeap);
+   MarkBootPhase(&bootInfo->timeline, "kmain entry");
+   CallGlobalConstructors(bootInfo->initializers);
+   MarkBootPhase(&bootInfo->timeline, "global ctors");
 
-   TTY term(framebuffer, fontFormat);
+   TTY term(bootInfo->framebuffer, bootInfo->font);
    term.SetBackgroundColor(0x1A1A1A);
    term.SetForegroundColor(0xFFCC00);
+   MarkBootPhase(&bootInfo->timeline, "TTY init");
 
    term.kprintf("Welcome to LanternOS!\n");
    term.kprintf("Copyright (c) 2021. Licensed under the MIT License.\n");
-   term.kprintf("GOP Framebuffer is located at address: %#.8x.\n", framebuffer.frameBufferAddress);
+   term.kprintf("GOP Framebuffer is located at address: %#.8x.\n", bootInfo->framebuffer.frameBufferAddress);
+   term.kprintf("Framebuffer: %ux%u, %u px per scanline, pixel format %u, %u KiB.\n",
+                bootInfo->framebuffer.horizontalResolution, bootInfo->framebuffer.verticalResolution,
+                bootInfo->framebuffer.pixelsPerScanLine, (unsigned int)bootInfo->framebuffer.pixelFormat,
+                (unsigned int)(bootInfo->framebuffer.frameBufferSize >> 10));
    term.kprintf("Approximate location of the stack pointer is: %#.8x.\n", &stackMarker);
+   uint64_t usableMemory      = GetTotalMemoryOfType(bootInfo->memoryMap, MemoryRegionType::Usable);
+   uint64_t reclaimableMemory = GetTotalMemoryOfType(bootInfo->memoryMap, MemoryRegionType::Reclaimable);
+   uint64_t handoffMemory     = GetTotalMemoryOfType(bootInfo->memoryMap, MemoryRegionType::LoaderHandoff);
+   term.kprintf("Memory map: %u regions, %u MiB usable, %u MiB reclaimable, %u KiB handed over.\n",
+                (unsigned int)bootInfo->memoryMap.regionCount, (unsigned int)(usableMemory >> 20),
+                (unsigned int)(reclaimableMemory >> 20), (unsigned int)(handoffMemory >> 10));
+   term.kprintf("Boot modules: %u, %u KiB starting at %#.8x.\n", (unsigned int)bootInfo->modules.moduleCount,
+                (unsigned int)(bootInfo->modules.regionSize >> 10), bootInfo->modules.regionBase);
+   uint64_t symbolOffset      = 0;
+   const KernelSymbol *symbol = LookupKernelSymbol(&bootInfo->symbols, (uint64_t)&kmain, &symbolOffset);
+   if (symbol) {
+      term.kprintf("Kernel symbols: %u functions, kmain resolves to %s+%u.\n",
+                   (unsigned int)bootInfo->symbols.symbolCount,
+                   GetKernelSymbolName(&bootInfo->symbols, symbol), (unsigned int)symbolOffset);
+   }
+   term.kprintf("Kernel stack: %u KiB at 0x%p, %u per-CPU areas for %u processors.\n",
+                (unsigned int)(bootInfo->stack.size >> 10), (void *)bootInfo->stack.base,
+                (unsigned int)bootInfo->perCpu.maxCpuCount, (unsigned int)bootInfo->perCpu.cpuCount);
+   term.kprintf("Early heap: %u KiB at 0x%p, %u bytes used.\n", (unsigned int)(GetEarlyHeapSize() >> 10),
+                (void *)bootInfo->earlyHeap.base, (unsigned int)GetEarlyHeapUsed());
+   const AcpiTableEntry *madt = FindAcpiTable(&bootInfo->acpi, "APIC");
+   term.kprintf("ACPI: %u tables, MADT %s.\n", (unsigned int)bootInfo->acpi.tableCount,
+                madt ? "found" : "missing");
+   PrintBootTimeline(term, &bootInfo->timeline);
+   if (bootInfo->loaderLog.buffer) {
+      uint64_t keptLength = bootInfo->loaderLog.written < bootInfo->loaderLog.capacity
+                               ? bootInfo->loaderLog.written
+                               : bootInfo->loaderLog.capacity;
+      term.kprintf("Loader log: %u characters kept at 0x%p.\n", (unsigned int)keptLength,
+                   bootInfo->loaderLog.buffer);
+   }
 
    while (true)
       ;
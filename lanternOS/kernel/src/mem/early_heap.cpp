@@ -0,0 +1,30 @@
+#include "mem/early_heap.h"
+
+/** The heap bounds. Plain zero-initialised data, so they are valid before global constructors have run. */
+static uint64_t heapBase;
+static uint64_t heapNext;
+static uint64_t heapEnd;
+
+void InitEarlyHeap(const EarlyHeapRegion &region) {
+   heapBase = region.base;
+   heapNext = region.base;
+   heapEnd  = region.base + region.size;
+}
+
+void *EarlyAllocate(uint64_t size, uint64_t alignment) {
+   uint64_t start = (heapNext + alignment - 1) & ~(alignment - 1);
+   // Checked as a difference so that a huge size can not wrap around the end of the address space.
+   if (start < heapNext || start > heapEnd || size > heapEnd - start) {
+      return nullptr;
+   }
+   heapNext = start + size;
+   return (void *)start;
+}
+
+uint64_t GetEarlyHeapUsed() {
+   return heapNext - heapBase;
+}
+
+uint64_t GetEarlyHeapSize() {
+   return heapEnd - heapBase;
+}
@@ -5,6 +5,7 @@
 #include "libk/ctype.h"
 #include "libk/stdlib.h"
 #include "libk/string.h"
+#include "mem/early_heap.h"
 
 TTY::TTY(Framebuffer fb, FontFormat font) {
    m_framebuf   = fb;
@@ -12,6 +13,42 @@ TTY::TTY(Framebuffer fb, FontFormat font) {
 
    m_numCharCols = m_framebuf.horizontalResolution / m_loadedFont.glyphWidth;
    m_numCharRows = m_framebuf.verticalResolution / m_loadedFont.glyphHeight;
+
+   // Characters are single bytes, so glyphs past the first 256 are never printed and not worth caching. The
+   // pixels and the generations share one allocation, so the bump heap is not left holding half a cache.
+   // The early heap comes zeroed, so every glyph starts out as never drawn.
+   m_cachedGlyphCount  = m_loadedFont.numGlyphs < 256 ? m_loadedFont.numGlyphs : 256;
+   uint64_t glyphBytes = (uint64_t)m_loadedFont.glyphWidth * m_loadedFont.glyphHeight * sizeof(uint32_t);
+   m_glyphCache        = (uint32_t *)EarlyAllocate(m_cachedGlyphCount * (glyphBytes + sizeof(uint32_t)), 64);
+   if (m_glyphCache) {
+      m_glyphGenerations = (uint32_t *)((uint8_t *)m_glyphCache + m_cachedGlyphCount * glyphBytes);
+   }
+}
+
+/**
+ * @brief Moves an 8 bit color channel into the bits of a pixel bitmask, keeping as many of its most
+ * significant bits as the mask has room for.
+ */
+static uint32_t ScaleColorChannel(uint32_t value, uint32_t mask) {
+   if (mask == 0) {
+      return 0;
+   }
+   // GOP masks are contiguous runs of bits.
+   uint32_t shift  = __builtin_ctz(mask);
+   uint32_t width  = __builtin_popcount(mask);
+   uint32_t scaled = width >= 8 ? value << (width - 8) : value >> (8 - width);
+   return (scaled << shift) & mask;
+}
+
+uint32_t TTY::ToFramebufferColor(uint32_t color) {
+   switch (m_framebuf.pixelFormat) {
+   case PixelFormat::BlueGreenRed: return color;
+   case PixelFormat::RedGreenBlue: return ((color & 0xFF) << 16) | (color & 0xFF00) | ((color >> 16) & 0xFF);
+   default:
+      return ScaleColorChannel((color >> 16) & 0xFF, m_framebuf.pixelBitmask.redMask) |
+             ScaleColorChannel((color >> 8) & 0xFF, m_framebuf.pixelBitmask.greenMask) |
+             ScaleColorChannel(color & 0xFF, m_framebuf.pixelBitmask.blueMask);
+   }
 }
 
 uint32_t TTY::GetPixelColor(uint32_t posX, uint32_t posY) {
@@ -32,15 +69,17 @@ void TTY::PlotPixel(uint32_t x, uint32_t y, uint32_t pixelColor) {
 }
 
 void TTY::SetBackgroundColor(uint32_t pixelColor) {
+   uint32_t newPixel = ToFramebufferColor(pixelColor);
+   uint32_t fgPixel  = ToFramebufferColor(m_fgColor);
    if (m_bgColor == m_fgColor) {
       for (uint32_t x = 0; x < m_framebuf.horizontalResolution; x++) {
-         for (uint32_t y = 0; y < m_framebuf.verticalResolution; y++) { PlotPixel(x, y, pixelColor); }
+         for (uint32_t y = 0; y < m_framebuf.verticalResolution; y++) { PlotPixel(x, y, newPixel); }
       }
    } else {
       for (uint32_t x = 0; x < m_framebuf.horizontalResolution; x++) {
          for (uint32_t y = 0; y < m_framebuf.verticalResolution; y++) {
-            if (GetPixelColor(x, y) != m_fgColor) {
-               PlotPixel(x, y, pixelColor);
+            if (GetPixelColor(x, y) != fgPixel) {
+               PlotPixel(x, y, newPixel);
             }
          }
       }
@@ -50,10 +89,12 @@ void TTY::SetBackgroundColor(uint32_t pixelColor) {
 }
 
 void TTY::SetForegroundColor(uint32_t pixelColor) {
+   uint32_t newPixel = ToFramebufferColor(pixelColor);
+   uint32_t fgPixel  = ToFramebufferColor(m_fgColor);
    for (uint32_t x = 0; x < m_framebuf.horizontalResolution; x++) {
       for (uint32_t y = 0; y < m_framebuf.verticalResolution; y++) {
-         if (GetPixelColor(x, y) == m_fgColor) {
-            PlotPixel(x, y, pixelColor);
+         if (GetPixelColor(x, y) == fgPixel) {
+            PlotPixel(x, y, newPixel);
          }
       }
    }
@@ -61,9 +102,70 @@ void TTY::SetForegroundColor(uint32_t pixelColor) {
 }
 
 void TTY::ClearScreen() {
+   uint32_t bgPixel = ToFramebufferColor(m_bgColor);
    for (uint32_t x = 0; x < m_framebuf.horizontalResolution; x++) {
-      for (uint32_t y = 0; y < m_framebuf.verticalResolution; y++) { PlotPixel(x, y, m_bgColor); }
+      for (uint32_t y = 0; y < m_framebuf.verticalResolution; y++) { PlotPixel(x, y, bgPixel); }
+   }
+}
+
+void TTY::DrawGlyph(uint8_t glyph, uint32_t foreground, uint32_t background, uint32_t *rowPixels,
+                    uint64_t rowStride) {
+   if (m_loadedFont.atlasAddress != nullptr) {
+      /**
+       * The loader has already expanded every glyph into one mask per pixel, so each row of the glyph lines
+       * up with the row of pixels it is drawn into, and each pixel is a branch-free select between the two
+       * colors.
+       */
+      const uint32_t *rowMasks = m_loadedFont.atlasAddress + glyph * m_loadedFont.atlasGlyphStride;
+      for (uint32_t y = 0; y < m_loadedFont.glyphHeight; y++) {
+         for (uint32_t x = 0; x < m_loadedFont.glyphWidth; x++) {
+            rowPixels[x] = (foreground & rowMasks[x]) | (background & ~rowMasks[x]);
+         }
+         rowMasks += m_loadedFont.atlasRowStride;
+         rowPixels += rowStride;
+      }
+   } else {
+      /**
+       * Without an atlas we decode the PSF2 bitmap directly. Each row of the glyph is stored in whole bytes,
+       * most significant bit first. A bit of 0 means that corresponding pixel should be drawn as background
+       * color, while a bit of 1 means it should be drawn as foreground color.
+       */
+      const uint8_t *fontPtr =
+         (uint8_t *)m_loadedFont.FontBufferAddress + glyph * m_loadedFont.glyphSizeInBytes;
+      uint32_t bytesPerRow = (m_loadedFont.glyphWidth + 7) / 8;
+      for (uint32_t y = 0; y < m_loadedFont.glyphHeight; y++) {
+         for (uint32_t x = 0; x < m_loadedFont.glyphWidth; x++) {
+            bool set     = (fontPtr[x / 8] & (0b10000000 >> (x % 8))) != 0;
+            rowPixels[x] = set ? foreground : background;
+         }
+         fontPtr += bytesPerRow;
+         rowPixels += rowStride;
+      }
+   }
+}
+
+const uint32_t *TTY::GetCachedGlyph(uint8_t glyph, uint32_t foreground, uint32_t background) {
+   if (m_glyphCache == nullptr || glyph >= m_cachedGlyphCount) {
+      return nullptr;
+   }
+   if (foreground != m_cacheFgColor || background != m_cacheBgColor) {
+      m_cacheFgColor = foreground;
+      m_cacheBgColor = background;
+      // Generation 0 is reserved for glyphs that were never drawn. Once the counter wraps, glyphs stamped
+      // with the generations it is about to reuse would look current, so all are marked as never drawn.
+      if (++m_cacheGeneration == 0) {
+         for (uint32_t i = 0; i < m_cachedGlyphCount; i++) { m_glyphGenerations[i] = 0; }
+         m_cacheGeneration = 1;
+      }
+   }
+
+   uint32_t *glyphPixels =
+      m_glyphCache + (uint64_t)glyph * m_loadedFont.glyphWidth * m_loadedFont.glyphHeight;
+   if (m_glyphGenerations[glyph] != m_cacheGeneration) {
+      DrawGlyph(glyph, foreground, background, glyphPixels, m_loadedFont.glyphWidth);
+      m_glyphGenerations[glyph] = m_cacheGeneration;
    }
+   return glyphPixels;
 }
 
 void TTY::PutChar(uint8_t charToPrint, uint32_t foreground, uint32_t background) {
@@ -73,49 +175,33 @@ void TTY::PutChar(uint8_t charToPrint, uint32_t foreground, uint32_t background)
       return;
    }
 
-   // Gets a pointer to the offset in memory where the glyph we want to print is stored.
-   uint8_t *fontPtr = (uint8_t *)m_loadedFont.FontBufferAddress + charToPrint * m_loadedFont.glyphSizeInBytes;
+   // Characters the font has no glyph for are shown as '?', or as its first glyph if it lacks even that.
+   if (charToPrint >= m_loadedFont.numGlyphs) {
+      charToPrint = m_loadedFont.numGlyphs > '?' ? '?' : 0;
+   }
 
    if (m_currentCharPosX > m_numCharCols - 1) {
       NewLine();
    }
+   // Glyphs are drawn and cached in the framebuffer's own pixel format.
+   foreground = ToFramebufferColor(foreground);
+   background = ToFramebufferColor(background);
    unsigned long pixelXOffset = m_currentCharPosX * m_loadedFont.glyphWidth;
    unsigned long pixelYOffset = m_currentCharPosY * m_loadedFont.glyphHeight;
 
-   /**
-    * This nested forloop checks the glyph in memory and determines, pixel by pixel,
-    * whether a foreground or background pixel should be drawn.
-    * Since our font is 10 pixels wide, each row of the glyph is encoded in 10 bits, which means we must
-    * process two bytes of data for every row.
-    * A bit of 0 means that corresponding pixel should be drawn as background color, while a bit of 1 means it
-    * should be drawn as foreground color.
-    */
-   for (unsigned long y = pixelYOffset; y < pixelYOffset + m_loadedFont.glyphHeight; y++) {
-      // We process the first byte by simply iterating over every bit inside it, and checking if it is set
-      // to 1 or 0.
-      for (unsigned long x = pixelXOffset; x < pixelXOffset + 8; x++) {
-         if ((*fontPtr & (0b10000000 >> (x - pixelXOffset))) != 0) {
-            PlotPixel(x, y, foreground);
-         } else {
-            PlotPixel(x, y, background);
-         }
-      }
-      // We then increment the pointer to the next byte of data representing this row.
-      fontPtr++;
-      // This time, we only test the first two bits. The other 6 bits of the second byte are always 0.
-      // We must be sure to add 8 to the x pixel coordinate, so that we are writing to pixels exactly where we
-      // "left off" from the previous loop.
-      for (unsigned long x = pixelXOffset; x < pixelXOffset + 2; x++) {
-         if ((*fontPtr & (0b10000000 >> (x - pixelXOffset))) != 0) {
-            PlotPixel(x + 8, y, foreground);
-         } else {
-            PlotPixel(x + 8, y, background);
-         }
-      }
+   uint32_t *rowPixels =
+      m_framebuf.frameBufferAddress + pixelYOffset * m_framebuf.pixelsPerScanLine + pixelXOffset;
 
-      // Now that we have completed an entire row of the glyph, we increment to the pointer to the
-      // first byte of the next row, and repeat the loop.
-      fontPtr++;
+   // Once a glyph is in the cache in these colors, drawing it is a plain copy of each of its rows.
+   const uint32_t *glyphPixels = GetCachedGlyph(charToPrint, foreground, background);
+   if (glyphPixels != nullptr) {
+      for (uint32_t y = 0; y < m_loadedFont.glyphHeight; y++) {
+         for (uint32_t x = 0; x < m_loadedFont.glyphWidth; x++) { rowPixels[x] = glyphPixels[x]; }
+         glyphPixels += m_loadedFont.glyphWidth;
+         rowPixels += m_framebuf.pixelsPerScanLine;
+      }
+   } else {
+      DrawGlyph(charToPrint, foreground, background, rowPixels, m_framebuf.pixelsPerScanLine);
    }
 
    m_currentCharPosX++;
@@ -3,6 +3,64 @@ import argparse
 import subprocess
 import os
 import shutil
+import struct
+
+MANIFEST_MAGIC = 0x4D555342  # "BSUM"
+MANIFEST_VERSION = 1
+MANIFEST_WHOLE_FILE = 0xFFFFFFFF
+PT_LOAD = 1
+
+
+def crc32c_table():
+    table = []
+    for i in range(256):
+        crc = i
+        for _ in range(8):
+            crc = (crc >> 1) ^ (0x82F63B78 if crc & 1 else 0)
+        table.append(crc)
+    return table
+
+
+CRC32C_TABLE = crc32c_table()
+
+
+def crc32c(data):
+    crc = 0xFFFFFFFF
+    for byte in data:
+        crc = (crc >> 8) ^ CRC32C_TABLE[(crc ^ byte) & 0xFF]
+    return crc ^ 0xFFFFFFFF
+
+
+def kernel_segment_entries(path, name):
+    """Returns one manifest entry for every PT_LOAD segment of the uncompressed kernel at path."""
+    with open(path, "rb") as f:
+        elf = f.read()
+    phoff = struct.unpack_from("<Q", elf, 32)[0]
+    phentsize, phnum = struct.unpack_from("<HH", elf, 54)
+    entries = []
+    for i in range(phnum):
+        header = phoff + i * phentsize
+        p_type = struct.unpack_from("<I", elf, header)[0]
+        p_offset = struct.unpack_from("<Q", elf, header + 8)[0]
+        p_filesz = struct.unpack_from("<Q", elf, header + 32)[0]
+        if p_type == PT_LOAD:
+            segment = elf[p_offset:p_offset + p_filesz]
+            entries.append((name, i, crc32c(segment), len(segment)))
+    return entries
+
+
+def file_entry(path, name):
+    with open(path, "rb") as f:
+        data = f.read()
+    return (name, MANIFEST_WHOLE_FILE, crc32c(data), len(data))
+
+
+def write_manifest(path, entries):
+    """Writes bhava.sum, which BhavaLoader checks the kernel segments and boot modules against."""
+    with open(path, "wb") as f:
+        f.write(struct.pack("<IIII", MANIFEST_MAGIC, MANIFEST_VERSION, len(entries), 0))
+        for name, segment, crc, size in entries:
+            f.write(struct.pack("<32sIIQ", name.encode("ascii"), segment, crc, size))
 
 
 def main():
@@ -19,6 +77,8 @@ def main():
         " This is only needed if you installed the toolchain to a nondefault directory.")
     parser.add_argument("--build", help="Whether to build Debug or Release. Default is release.")
     parser.add_argument("--tests", action='store_true', help="Whether you wish to build and run unit tests.")
+    parser.add_argument("--compress", action='store_true',
+                        help="Store the kernel image as an LZ4 frame. Requires the lz4 command line tool.")
     parser.add_argument("Mingw_Header_Dir",
                         help="Provide the full path to your installation of the mingw headers.")
     args = parser.parse_args()
@@ -66,6 +126,14 @@ def main():
     os.chdir("../build/{}/kernel/bin/".format(build_type))
     subprocess.run(["objcopy", "--only-keep-debug", "LanternOS", "LanternOS.dbg"])
     subprocess.run(["objcopy", "--strip-debug", "LanternOS"])
+    # Segments are checksummed before compression, as that is the form the loader checks them in.
+    manifest_entries = kernel_segment_entries("LanternOS", "LanternOS")
+    if args.compress:
+        # BhavaLoader needs the decompressed size up front, so it must be recorded in the frame header.
+        # Small independent blocks (-B4, 64 KiB) let it decompress the kernel on every processor at once.
+        subprocess.run(["lz4", "-9", "-B4", "-f", "-q", "--content-size", "--no-frame-crc", "LanternOS",
+                        "LanternOS.lz4"])
+        os.replace("LanternOS.lz4", "LanternOS")
     os.chdir("../../../../scripts")
 
     if (build_type == "Debug"):
@@ -77,6 +145,12 @@ def main():
     os.replace("../build/{}/kernel/bin/LanternOS".format(build_type), "../VMTestBed/Boot/LanternOS")
 
     shutil.copyfile("../Vendor/font/font.psf", "../VMTestBed/Boot/font.psf")
+    shutil.copyfile("../bhavaloader/bhava.cfg", "../VMTestBed/Boot/bhava.cfg")
+
+    manifest_entries.append(file_entry("../VMTestBed/Boot/font.psf", "font.psf"))
+    if os.path.exists("../VMTestBed/Boot/LanternOS.dbg"):
+        manifest_entries.append(file_entry("../VMTestBed/Boot/LanternOS.dbg", "LanternOS.dbg"))
+    write_manifest("../VMTestBed/Boot/bhava.sum", manifest_entries)
 
     os.environ["LD_PRELOAD"] = "{}/../namelesslibc/build/Release/namelesslibc/bin/libnamelesslibkfortesting.so".format(
         os.getcwd())
@@ -84,6 +158,13 @@ def main():
         print("================================")
         print("========= UNIT TESTS ===========")
         print("================================")
+        print("Begin running tests for bhavaloader...")
+        # These build with the host compiler, the loader code runs against a mock firmware.
+        subprocess.run(["cmake", "-S../bhavaloader/host", "-B../build/{}/bhavaloader-host".format(build_type),
+                        "-DCMAKE_BUILD_TYPE={}".format(build_type)])
+        subprocess.run(["cmake", "--build", "../build/{}/bhavaloader-host".format(build_type)])
+        subprocess.run(["ctest", "--test-dir", "../build/{}/bhavaloader-host".format(build_type),
+                        "--output-on-failure"])
         print("Begin running tests for libk...")
         os.chdir("../namelesslibc/build/{}/namelesslibc/bin/".format(build_type))
         subprocess.run(['./namelesslibk_tests'])